@@ -0,0 +1,1250 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include "mem_hash.h"
+
+using namespace mem_hash;
+
+//perf_data.txt中的数据大小
+const int DATA_SIZES[] = {512, 768, 1024, 1280, 5120, 5376};
+const int DATA_SIZE_NUM = sizeof(DATA_SIZES) / sizeof(DATA_SIZES[0]);
+
+static uint64_t NowUs()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+//各校验引擎在不同数据大小下的吞吐
+int bench_crc(int argc, char *argv[])
+{
+	int loops = 200000;
+	if (argc > 0)
+		loops = atoi(argv[0]);
+
+	char data[5376];
+	for (int i = 0; i < (int)sizeof(data); i++)
+		data[i] = (char)(rand() & 0xFF);
+
+	printf("%-16s", "[impl]\\[size]");
+	for (int s = 0; s < DATA_SIZE_NUM; s++)
+		printf("%10dB", DATA_SIZES[s]);
+	printf("   (MB/s)\n");
+
+	for (uint32_t impl = 0; impl < CRC32_IMPL_NUM; impl++) {
+		const struct crc32_engine *engine = Crc32GetImpl(impl);
+		if (engine == NULL) {
+			printf("%-16s unsupported\n", "-");
+			continue;
+		}
+
+		printf("%-16s", engine->name);
+		for (int s = 0; s < DATA_SIZE_NUM; s++) {
+			uint32_t crc32 = 0;
+			uint64_t begin = NowUs();
+			for (int i = 0; i < loops; i++)
+				crc32 ^= engine->append(0, data, DATA_SIZES[s]);
+			uint64_t cost = NowUs() - begin;
+			if (cost == 0)
+				cost = 1;
+			printf("%11.0f", (double)DATA_SIZES[s] * loops / cost);
+			//防止循环被优化掉
+			if (crc32 == 0x5A5A5A5A)
+				printf("*");
+		}
+		printf("\n");
+	}
+
+	//同一算法的不同实现结果必须一致
+	for (uint32_t impl = 0; impl < CRC32_IMPL_NUM; impl++) {
+		const struct crc32_engine *engine = Crc32GetImpl(impl);
+		if (engine == NULL)
+			continue;
+		const struct crc32_engine *base = Crc32GetImpl(
+			engine->type == CRC_TYPE_LEGACY ?
+			CRC32_IMPL_LEGACY_BYTE : CRC32_IMPL_CRC32C_SLICE8);
+		for (int len = 0; len <= 64; len++) {
+			uint32_t a = engine->append(engine->append(0, data, len),
+						    data + len, 100);
+			uint32_t b = base->append(0, data, len + 100);
+			if (a != b) {
+				printf("%s mismatch at len %d\n", engine->name, len);
+				return -1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+//-----读扩展性：全局mutex包装与并发模式的对比
+struct read_ctx {
+	MemHash*         mem;
+	pthread_mutex_t* mutex;
+	uint64_t         key_num;
+	volatile int     stop;
+	uint64_t         ops;
+	int              writer;
+};
+
+static void* ReadScaleWorker(void* arg)
+{
+	struct read_ctx *ctx = (struct read_ctx *)arg;
+	char buf[10240];
+	unsigned int seed = (unsigned int)(uintptr_t)&buf;
+	uint64_t ops = 0;
+
+	while (!ctx->stop) {
+		uint64_t key = rand_r(&seed) % ctx->key_num + 1;
+		int len = 0;
+		if (ctx->mutex != NULL)
+			pthread_mutex_lock(ctx->mutex);
+		if (ctx->writer)
+			ctx->mem->Set(key, buf, 512);
+		else
+			ctx->mem->Get(key, buf, sizeof(buf), len);
+		if (ctx->mutex != NULL)
+			pthread_mutex_unlock(ctx->mutex);
+		ops++;
+	}
+
+	ctx->ops = ops;
+	return NULL;
+}
+
+int bench_read_scale(int argc, char *argv[])
+{
+	int max_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	int seconds     = 2;
+	int writers     = 0;
+	const char *name = "bench_read.memhash";
+	if (argc > 0) max_threads = atoi(argv[0]);
+	if (argc > 1) seconds     = atoi(argv[1]);
+	if (argc > 2) writers     = atoi(argv[2]);
+	if (argc > 3) name        = argv[3];
+
+	const uint64_t key_num = 100000;
+	char data[512];
+	memset(data, 'a', sizeof(data));
+
+	printf("readers  writers  %14s  %14s   (Get/s)\n", "global-mutex", "seqlock");
+	for (int threads = 1; threads <= max_threads; threads *= 2) {
+		double result[2];
+		for (int mode = 0; mode < 2; mode++) {
+			unlink(name);
+			MemHash *mem = new MemHash();
+			struct mem_option option;
+			option.concurrent = mode;
+			mem->Init(name, 0, CLOSE_MLOCK, 0, MS_ASYNC,
+				  10, 20000, 200000, option);
+			for (uint64_t key = 1; key <= key_num; key++)
+				mem->Set(key, data, sizeof(data));
+
+			pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+			int total = threads + writers;
+			struct read_ctx *ctx = new struct read_ctx[total];
+			pthread_t *tids = new pthread_t[total];
+			for (int i = 0; i < total; i++) {
+				ctx[i].mem     = mem;
+				ctx[i].mutex   = mode == 0 ? &mutex : NULL;
+				ctx[i].key_num = key_num;
+				ctx[i].stop    = 0;
+				ctx[i].ops     = 0;
+				ctx[i].writer  = i >= threads;
+				pthread_create(&tids[i], NULL, ReadScaleWorker, &ctx[i]);
+			}
+
+			sleep(seconds);
+			uint64_t ops = 0;
+			for (int i = 0; i < total; i++)
+				ctx[i].stop = 1;
+			for (int i = 0; i < total; i++) {
+				pthread_join(tids[i], NULL);
+				if (!ctx[i].writer)
+					ops += ctx[i].ops;
+			}
+			result[mode] = (double)ops / seconds;
+
+			delete [] ctx;
+			delete [] tids;
+			delete mem;
+		}
+		printf("%7d  %7d  %14.0f  %14.0f\n",
+		       threads, writers, result[0], result[1]);
+	}
+
+	unlink(name);
+	return 0;
+}
+
+//-----key指纹：不同NODE占用率下命中、未命中查找的耗时
+//同一seed产生同样的key序列，tag区分命中和未命中的key
+static uint64_t RandKey(uint64_t tag)
+{
+	return ((uint64_t)rand() << 31 | rand()) | tag << 62;
+}
+
+static double LookupNs(MemHash* mem, uint64_t tag, uint64_t num, int expect)
+{
+	srand(1);
+	uint64_t start = NowUs();
+	uint64_t found = 0;
+	for (uint64_t i = 0; i < num; i++)
+		found += mem->IsExist(RandKey(tag)) == 1;
+	uint64_t cost = NowUs() - start;
+
+	if (found != (expect ? num : 0))
+		printf("lookup result mismatch: found %lu\n", found);
+	return (double)cost * 1000 / num;
+}
+
+int bench_fingerprint(int argc, char *argv[])
+{
+	uint32_t bucket_time = 20;
+	uint32_t bucket_len  = 50000;
+	const char *name = "bench_fp.memhash";
+	if (argc > 0) bucket_time = atoi(argv[0]);
+	if (argc > 1) bucket_len  = atoi(argv[1]);
+	if (argc > 2) name        = argv[2];
+
+	const int FILLS[] = {50, 80, 95};
+	const uint64_t lookups = 200000;
+	char data[8];
+	memset(data, 'a', sizeof(data));
+
+	printf("bucket_time %u bucket_len %u, avx2 %s\n", bucket_time, bucket_len,
+	       __builtin_cpu_supports("avx2") ? "yes" : "no");
+	printf("fill  %12s  %12s  %12s  %12s   (ns/IsExist)\n",
+	       "hit", "hit-fp", "miss", "miss-fp");
+	for (int f = 0; f < 3; f++) {
+		double result[2][2];
+		for (int mode = 0; mode < 2; mode++) {
+			unlink(name);
+			MemHash *mem = new MemHash();
+			struct mem_option option;
+			//value内联在NODE节点中，只测查找
+			option.inline_size = sizeof(data);
+			option.fingerprint = mode;
+			mem->Init(name, 0, CLOSE_MLOCK, 0, MS_ASYNC,
+				  bucket_time, bucket_len, 1, option);
+
+			//随机key填充到目标占用率
+			uint64_t inserted = 0;
+			uint32_t node_perct = 0, block_perct = 0;
+			srand(1);
+			while (node_perct < (uint32_t)FILLS[f]) {
+				if (mem->Set(RandKey(1), data, sizeof(data)) != 0)
+					break;
+				inserted++;
+				if (inserted % 1000 == 0)
+					mem->Stat(node_perct, block_perct);
+			}
+
+			//重放同样的随机序列查找命中的key
+			uint64_t num = inserted < lookups ? inserted : lookups;
+			result[mode][0] = LookupNs(mem, 1, num, 1);
+			result[mode][1] = LookupNs(mem, 2, lookups, 0);
+
+			delete mem;
+		}
+		printf("%3d%%  %12.1f  %12.1f  %12.1f  %12.1f\n", FILLS[f],
+		       result[0][0], result[1][0], result[0][1], result[1][1]);
+	}
+
+	unlink(name);
+	return 0;
+}
+
+//-----每阶取模：硬件除法与快速取模的对比
+int bench_fastmod(int argc, char *argv[])
+{
+	uint32_t levels = MAX_BUCKET_SIZE;
+	uint32_t max    = 1000000;
+	int      loops  = 20000;
+	if (argc > 0) levels = atoi(argv[0]);
+	if (argc > 1) max    = atoi(argv[1]);
+	if (argc > 2) loops  = atoi(argv[2]);
+	if (levels == 0 || levels > MAX_BUCKET_SIZE)
+		levels = MAX_BUCKET_SIZE;
+
+	//和BucketInit一样取小于max的质数
+	uint32_t    primes[MAX_BUCKET_SIZE];
+	__uint128_t m[MAX_BUCKET_SIZE];
+	uint32_t n = 0;
+	for (uint32_t v = max; v > 2 && n < levels; v--) {
+		uint32_t d = 2;
+		while (d * d <= v && v % d != 0)
+			d++;
+		if (d * d > v) {
+			primes[n] = v;
+			m[n]      = FastModM(v);
+			n++;
+		}
+	}
+
+	//结果必须和%完全一致
+	uint64_t edge[] = {0, 1, 0xFFFFFFFFULL, 0x100000000ULL,
+			   0x7FFFFFFFFFFFFFFFULL, 0xFFFFFFFFFFFFFFFFULL};
+	srand(1);
+	for (int i = 0; i < 1000000; i++) {
+		uint64_t key = i < 6 ? edge[i] :
+			((uint64_t)rand() << 42) ^ ((uint64_t)rand() << 21) ^ rand();
+		for (uint32_t j = 0; j < n; j++) {
+			if (FastMod(key, m[j], primes[j]) != key % primes[j]) {
+				printf("mismatch key %lu prime %u\n", key, primes[j]);
+				return -1;
+			}
+		}
+	}
+
+	uint64_t keys[256];
+	for (int i = 0; i < 256; i++)
+		keys[i] = ((uint64_t)rand() << 42) ^ ((uint64_t)rand() << 21) ^ rand();
+
+	double result[2];
+	for (int mode = 0; mode < 2; mode++) {
+		uint64_t sum = 0;
+		uint64_t begin = NowUs();
+		for (int i = 0; i < loops; i++) {
+			uint64_t key = keys[i & 255] + i;
+			for (uint32_t j = 0; j < n; j++)
+				sum += mode == 0 ? key % primes[j] :
+					FastMod(key, m[j], primes[j]);
+		}
+		result[mode] = (double)(NowUs() - begin) * 1000 / ((double)loops * n);
+		//防止循环被优化掉
+		if (sum == 0x5A5A5A5A)
+			printf("*");
+	}
+
+	printf("levels %u, %-10s %8.2f ns/probe, %-10s %8.2f ns/probe\n",
+	       n, "div", result[0], "fastmod", result[1]);
+	return 0;
+}
+
+//-----批量接口：与逐个调用的吞吐对比
+int bench_multi(int argc, char *argv[])
+{
+	int      batch   = 100;
+	uint64_t key_num = 500000;
+	int      size    = 256;
+	const char *name = "bench_multi.memhash";
+	if (argc > 0) batch   = atoi(argv[0]);
+	if (argc > 1) key_num = atoi(argv[1]);
+	if (argc > 2) size    = atoi(argv[2]);
+	if (argc > 3) name    = argv[3];
+	if (batch <= 0 || size <= 0 || size > 10240)
+		return -1;
+
+	//小value内联在NODE节点中
+	unlink(name);
+	MemHash *mem = new MemHash();
+	struct mem_option option;
+	option.inline_size = size <= 64 ? size : 0;
+	mem->Init(name, 0, CLOSE_MLOCK, 0, MS_ASYNC, 20, key_num / 10 + 1,
+		  option.inline_size ? 1 : key_num * ((size + 511) / 512) + 1000,
+		  option);
+
+	char value[10240];
+	memset(value, 'a', sizeof(value));
+	for (uint64_t key = 1; key <= key_num; key++)
+		mem->Set(key, value, size);
+
+	//随机key，一半不存在用于IsExist
+	const int rounds = 2000;
+	uint64_t *keys = new uint64_t[batch];
+	int      *ret  = new int[batch];
+	int      *dlen = new int[batch];
+	int      *lens = new int[batch];
+	int      *maxs = new int[batch];
+	char    **bufs = new char*[batch];
+	const char **vals = new const char*[batch];
+	for (int i = 0; i < batch; i++) {
+		bufs[i] = new char[10240];
+		maxs[i] = 10240;
+		lens[i] = size;
+		vals[i] = value;
+	}
+
+	printf("batch %d keys %lu size %d\n", batch, key_num, size);
+	printf("%-10s  %14s  %14s   (ops/s)\n", "op", "loop", "multi");
+	const char *ops[] = {"Get", "IsExist", "Set"};
+	for (int op = 0; op < 3; op++) {
+		double result[2];
+		for (int mode = 0; mode < 2; mode++) {
+			srand(1);
+			uint64_t begin = NowUs();
+			for (int r = 0; r < rounds; r++) {
+				for (int i = 0; i < batch; i++)
+					keys[i] = (uint64_t)rand() % (op == 1 ? key_num * 2 : key_num) + 1;
+				if (mode == 1) {
+					if (op == 0)
+						mem->MultiGet(keys, batch, bufs, maxs, dlen, ret);
+					else if (op == 1)
+						mem->MultiIsExist(keys, batch, ret);
+					else
+						mem->MultiSet(keys, batch, vals, lens, ret);
+					continue;
+				}
+				for (int i = 0; i < batch; i++) {
+					if (op == 0)
+						ret[i] = mem->Get(keys[i], bufs[i], maxs[i], dlen[i]);
+					else if (op == 1)
+						ret[i] = mem->IsExist(keys[i]);
+					else
+						ret[i] = mem->Set(keys[i], vals[i], lens[i]);
+				}
+			}
+			uint64_t cost = NowUs() - begin;
+			result[mode] = (double)rounds * batch * 1000000 / (cost ? cost : 1);
+		}
+		printf("%-10s  %14.0f  %14.0f\n", ops[op], result[0], result[1]);
+	}
+
+	for (int i = 0; i < batch; i++)
+		delete [] bufs[i];
+	delete [] bufs;
+	delete [] vals;
+	delete [] keys;
+	delete [] ret;
+	delete [] dlen;
+	delete [] lens;
+	delete [] maxs;
+	delete mem;
+	unlink(name);
+	return 0;
+}
+
+//-----连续分配：反复删改打散空闲链表后多BLOCK value的读取耗时
+int bench_extent(int argc, char *argv[])
+{
+	uint64_t key_num = 100000;
+	int      size    = 4000;
+	uint64_t churn   = 400000;
+	const char *name = "bench_extent.memhash";
+	if (argc > 0) key_num = atoi(argv[0]);
+	if (argc > 1) size    = atoi(argv[1]);
+	if (argc > 2) churn   = atoi(argv[2]);
+	if (argc > 3) name    = argv[3];
+	if (key_num == 0 || size <= 0 || size > 10240)
+		return -1;
+
+	char value[10240];
+	char out[10240];
+	memset(value, 'a', sizeof(value));
+	const uint64_t lookups = 200000;
+
+	printf("keys %lu size %d churn %lu\n", key_num, size, churn);
+	printf("%-10s  %12s  %12s\n", "alloc", "ns/Get", "MB/s");
+	const char *modes[] = {"chained", "extent"};
+	for (int mode = 0; mode < 2; mode++) {
+		unlink(name);
+		MemHash *mem = new MemHash();
+		struct mem_option option;
+		option.extent_alloc = mode;
+		//BLOCK数量留出删改时的余量
+		uint32_t block_num = key_num * ((size + 511) / 512) * 5 / 4 + 1000;
+		mem->Init(name, 0, CLOSE_MLOCK, 0, MS_ASYNC, 20, key_num / 10 + 1,
+			  block_num, option);
+
+		//大小随机的value反复删改，空闲链表顺序被打乱
+		srand(1);
+		for (uint64_t key = 1; key <= key_num; key++)
+			mem->Set(key, value, 1 + rand() % size);
+		for (uint64_t i = 0; i < churn; i++) {
+			uint64_t key = (uint64_t)rand() % key_num + 1;
+			mem->Del(key);
+			mem->Set(key, value, 1 + rand() % size);
+		}
+		for (uint64_t key = 1; key <= key_num; key++) {
+			mem->Del(key);
+			mem->Set(key, value, size);
+		}
+
+		srand(2);
+		uint64_t bytes = 0;
+		uint64_t begin = NowUs();
+		for (uint64_t i = 0; i < lookups; i++) {
+			int len = 0;
+			if (mem->Get((uint64_t)rand() % key_num + 1, out,
+				     sizeof(out), len) == 0)
+				bytes += len;
+		}
+		uint64_t cost = NowUs() - begin;
+		if (cost == 0)
+			cost = 1;
+		printf("%-10s  %12.1f  %12.1f\n", modes[mode],
+		       (double)cost * 1000 / lookups, (double)bytes / cost);
+
+		delete mem;
+	}
+
+	unlink(name);
+	return 0;
+}
+
+//-----BLOCK区整理：反复删改后整理前后的碎片度及读取耗时
+static double ReadNs(MemHash* mem, uint64_t key_num, uint64_t lookups)
+{
+	char out[10240];
+	srand(2);
+	uint64_t begin = NowUs();
+	for (uint64_t i = 0; i < lookups; i++) {
+		int len = 0;
+		mem->Get((uint64_t)rand() % key_num + 1, out, sizeof(out), len);
+	}
+	return (double)(NowUs() - begin) * 1000 / lookups;
+}
+
+int bench_compact(int argc, char *argv[])
+{
+	uint64_t key_num = 100000;
+	int      size    = 4000;
+	uint64_t churn   = 400000;
+	const char *name = "bench_compact.memhash";
+	if (argc > 0) key_num = atoi(argv[0]);
+	if (argc > 1) size    = atoi(argv[1]);
+	if (argc > 2) churn   = atoi(argv[2]);
+	if (argc > 3) name    = argv[3];
+	if (key_num == 0 || size <= 0 || size > 10240)
+		return -1;
+
+	unlink(name);
+	MemHash *mem = new MemHash();
+	uint32_t block_num = key_num * ((size + 511) / 512) * 5 / 4 + 1000;
+	mem->Init(name, 0, CLOSE_MLOCK, 0, MS_ASYNC, 20, key_num / 10 + 1,
+		  block_num);
+
+	char value[10240];
+	memset(value, 'a', sizeof(value));
+	srand(1);
+	for (uint64_t key = 1; key <= key_num; key++)
+		mem->Set(key, value, 1 + rand() % size);
+	for (uint64_t i = 0; i < churn; i++) {
+		uint64_t key = (uint64_t)rand() % key_num + 1;
+		mem->Del(key);
+		mem->Set(key, value, 1 + rand() % size);
+	}
+
+	const uint64_t lookups = 200000;
+	struct compact_stat stat;
+	mem->CompactStat(stat);
+	printf("keys %lu size %d churn %lu\n", key_num, size, churn);
+	printf("before   link_frag %3u%%  spread_frag %3u%%  %8.1f ns/Get\n",
+	       stat.link_frag, stat.spread_frag, ReadNs(mem, key_num, lookups));
+
+	//每次最多1ms，直到一轮整理没有再搬移BLOCK链
+	uint64_t steps = 0, chains = 0;
+	uint64_t begin = NowUs();
+	do {
+		chains = stat.chains_moved;
+		while (mem->CompactStep(1000) != 0)
+			steps++;
+		mem->CompactStat(stat);
+	} while (stat.chains_moved != chains);
+	uint64_t cost = NowUs() - begin;
+
+	printf("after    link_frag %3u%%  spread_frag %3u%%  %8.1f ns/Get\n",
+	       stat.link_frag, stat.spread_frag, ReadNs(mem, key_num, lookups));
+	printf("passes %lu steps %lu chains %lu moved %lu bytes, cost %lu us\n",
+	       stat.passes, steps, stat.chains_moved, stat.bytes_moved, cost);
+
+	delete mem;
+	unlink(name);
+	return 0;
+}
+
+//perf_data.txt中的msync频率
+const int SYNC_FREQS[] = {0, 1, 100, 1000, 10000};
+const int SYNC_FREQ_NUM = sizeof(SYNC_FREQS) / sizeof(SYNC_FREQS[0]);
+
+//按perf_data.txt的方式统计Set的吞吐：MS_ASYNC/MS_SYNC下整个映射落地与只落地
+//变更页各一张表
+int bench_sync(int argc, char *argv[])
+{
+	uint64_t key_num    = 5000;
+	uint32_t bucket_len = 100000;
+	uint32_t max_block  = 500000;
+	const char *name = "bench_sync.memhash";
+	if (argc > 0) key_num    = atoi(argv[0]);
+	if (argc > 1) bucket_len = atoi(argv[1]);
+	if (argc > 2) max_block  = atoi(argv[2]);
+	if (argc > 3) name       = argv[3];
+	if (key_num == 0 || bucket_len == 0 || max_block == 0)
+		return -1;
+
+	char value[5376];
+	memset(value, 'a', sizeof(value));
+	const int flags[] = {MS_ASYNC, MS_SYNC};
+
+	unlink(name);
+	for (int m = 0; m < 4; m++) {
+		int flag  = flags[m / 2];
+		int dirty = m % 2;
+		int ops[DATA_SIZE_NUM][SYNC_FREQ_NUM];
+		for (int f = 0; f < SYNC_FREQ_NUM; f++) {
+			struct mem_option option;
+			option.dirty_sync = dirty;
+			MemHash *mem = new MemHash();
+			mem->Init(name, 0, CLOSE_MLOCK, SYNC_FREQS[f], flag,
+				  50, bucket_len, max_block, option);
+			//打开后的第一次落地是整个映射
+			mem->MemSync(MS_SYNC);
+
+			for (int d = 0; d < DATA_SIZE_NUM; d++) {
+				uint64_t begin = NowUs();
+				for (uint64_t key = 1; key <= key_num; key++)
+					mem->Set(key, value, DATA_SIZES[d]);
+				uint64_t cost = NowUs() - begin;
+				ops[d][f] = cost == 0 ? 0 : key_num * 1000000 / cost;
+
+				for (uint64_t key = 1; key <= key_num; key++)
+					mem->Del(key);
+			}
+			delete mem;
+		}
+
+		printf("%s\t%s\tmsync频率\n", flag == MS_SYNC ? "MS_SYNC" : "MS_ASYNC",
+		       dirty ? "dirty_sync" : "full_sync");
+		printf("data");
+		for (int f = 0; f < SYNC_FREQ_NUM; f++)
+			printf("\t%d", SYNC_FREQS[f]);
+		printf("\n");
+		for (int d = 0; d < DATA_SIZE_NUM; d++) {
+			printf("%dB", DATA_SIZES[d]);
+			for (int f = 0; f < SYNC_FREQ_NUM; f++)
+				printf("\t%d", ops[d][f]);
+			printf("\n");
+		}
+		printf("\n");
+	}
+
+	unlink(name);
+	return 0;
+}
+
+//写操作中按msync_freq同步落地与后台落地线程的对比：吞吐、单次Set的最大耗时，
+//以及每写batch个key调用一次WaitDurable的耗时
+int bench_flush(int argc, char *argv[])
+{
+	uint64_t key_num     = 20000;
+	int      size        = 1024;
+	uint32_t interval_ms = 100;
+	const char *name = "bench_flush.memhash";
+	if (argc > 0) key_num     = atoi(argv[0]);
+	if (argc > 1) size        = atoi(argv[1]);
+	if (argc > 2) interval_ms = atoi(argv[2]);
+	if (argc > 3) name        = argv[3];
+	if (key_num == 0 || size <= 0 || size > 10240)
+		return -1;
+
+	char value[10240];
+	memset(value, 'a', sizeof(value));
+	const uint64_t batch = 1000;
+	uint32_t block_num = key_num * ((size + 511) / 512) + 1000;
+
+	unlink(name);
+	for (int m = 0; m < 3; m++) {
+		//0：每batch次写入MS_SYNC落地；1：后台按间隔落地；2：后台按间隔落地并等待
+		struct mem_option option;
+		if (m != 0) {
+			option.flush_interval_ms = interval_ms;
+			option.flush_dirty_bytes = (uint64_t)batch * size;
+		}
+		MemHash *mem = new MemHash();
+		mem->Init(name, 0, CLOSE_MLOCK, m == 0 ? batch : 0, MS_SYNC,
+			  20, key_num / 10 + 1, block_num, option);
+
+		uint64_t max_us = 0, wait_us = 0, waits = 0;
+		uint64_t begin = NowUs();
+		for (uint64_t key = 1; key <= key_num; key++) {
+			uint64_t t = NowUs();
+			mem->Set(key, value, size);
+			t = NowUs() - t;
+			if (t > max_us)
+				max_us = t;
+			if (m == 2 && key % batch == 0) {
+				t = NowUs();
+				mem->WaitDurable();
+				wait_us += NowUs() - t;
+				waits++;
+			}
+		}
+		uint64_t cost = NowUs() - begin;
+
+		printf("%-16s %8lu ops/s  max Set %6lu us",
+		       m == 0 ? "inline msync" : (m == 1 ? "flusher" : "flusher+wait"),
+		       cost == 0 ? 0 : key_num * 1000000 / cost, max_us);
+		if (waits != 0)
+			printf("  WaitDurable %6lu us", wait_us / waits);
+		printf("\n");
+
+		delete mem;
+		unlink(name);
+	}
+
+	return 0;
+}
+
+//各时钟源下单次NowMs的耗时，以及小value Set/Get的吞吐
+int bench_clock(int argc, char *argv[])
+{
+	uint64_t key_num = 200000;
+	int      size    = 16;
+	const char *name = "bench_clock.memhash";
+	if (argc > 0) key_num = atoi(argv[0]);
+	if (argc > 1) size    = atoi(argv[1]);
+	if (argc > 2) name    = argv[2];
+	if (key_num == 0 || size <= 0 || size > 10240)
+		return -1;
+
+	char value[10240], out[10240];
+	memset(value, 'a', sizeof(value));
+	const char *names[] = {"REALTIME", "COARSE", "CACHED", "TSC"};
+	const uint64_t loops = 10000000;
+
+	printf("%-10s %10s %12s %12s\n", "[source]", "ns/NowMs", "Set ops/s",
+	       "Get ops/s");
+	unlink(name);
+	for (uint32_t src = CLOCK_SOURCE_REALTIME; src <= CLOCK_SOURCE_TSC; src++) {
+		struct mem_option option;
+		option.clock_source = src;
+		MemHash *mem = new MemHash();
+		mem->Init(name, 0, CLOSE_MLOCK, 0, MS_ASYNC, 20,
+			  key_num / 10 + 1, key_num + 1000, option);
+
+		uint64_t begin = NowUs();
+		for (uint64_t i = 0; i < loops; i++)
+			mem->NowMs();
+		uint64_t clock_cost = NowUs() - begin;
+
+		begin = NowUs();
+		for (uint64_t key = 1; key <= key_num; key++)
+			mem->Set(key, value, size);
+		uint64_t set_cost = NowUs() - begin;
+
+		begin = NowUs();
+		for (uint64_t key = 1; key <= key_num; key++) {
+			int len = 0;
+			mem->Get(key, out, sizeof(out), len);
+		}
+		uint64_t get_cost = NowUs() - begin;
+
+		printf("%-10s %10.2f %12lu %12lu\n", names[src],
+		       (double)clock_cost * 1000 / loops,
+		       set_cost == 0 ? 0 : key_num * 1000000 / set_cost,
+		       get_cost == 0 ? 0 : key_num * 1000000 / get_cost);
+
+		delete mem;
+		unlink(name);
+	}
+
+	return 0;
+}
+
+//缓存场景：key空间大于表的容量，90%的请求落在热点key上，Get未命中时Set
+//对比关闭、开启淘汰模式时Set失败的次数、淘汰次数及命中率
+int bench_evict(int argc, char *argv[])
+{
+	uint32_t ops  = 1000000;
+	uint32_t keys = 1000000;
+	uint32_t hot  = 20000;
+	const char *name = "bench_evict.memhash";
+	if (argc > 0) ops  = atoi(argv[0]);
+	if (argc > 1) keys = atoi(argv[1]);
+	if (argc > 2) hot  = atoi(argv[2]);
+	if (argc > 3) name = argv[3];
+	if (ops == 0 || keys == 0 || hot == 0 || hot > keys)
+		return -1;
+
+	char value[1024], out[1024];
+	memset(value, 'a', sizeof(value));
+
+	printf("%-8s %10s %8s %8s %10s %10s %6s %10s\n", "[evict]", "ops/s",
+	       "fail -2", "fail -3", "probe", "clock", "hit%", "blocks");
+	unlink(name);
+	for (int evict = 0; evict < 2; evict++) {
+		//NODE节点及BLOCK都只能容纳热点key的两倍左右
+		struct mem_option option;
+		option.evict = evict;
+		MemHash *mem = new MemHash();
+		mem->Init(name, 0, CLOSE_MLOCK, 0, MS_ASYNC, 4, hot / 2 + 1,
+			  hot * 2, option);
+
+		srand(1);
+		uint32_t fail2 = 0, fail3 = 0;
+		uint64_t begin = NowUs();
+		for (uint32_t i = 0; i < ops; i++) {
+			uint64_t key = rand() % 10 != 0 ? 1 + rand() % hot :
+				       1 + rand() % keys;
+			int len = 0;
+			if (mem->Get(key, out, sizeof(out), len) == 0)
+				continue;
+			int ret = mem->Set(key, value, 100 + key % 900);
+			if (ret == -2)
+				fail2++;
+			else if (ret == -3)
+				fail3++;
+		}
+		uint64_t cost = NowUs() - begin;
+
+		struct evict_stat stat;
+		mem->EvictStat(stat);
+		printf("%-8s %10lu %8u %8u %10lu %10lu %6u %10lu\n",
+		       evict ? "on" : "off",
+		       cost == 0 ? 0 : (uint64_t)ops * 1000000 / cost, fail2, fail3,
+		       stat.probe_evicted, stat.clock_evicted, stat.hit_ratio,
+		       stat.blocks_freed);
+
+		delete mem;
+		unlink(name);
+	}
+
+	return 0;
+}
+
+//随机查找大NODE区域的吞吐（对TLB miss敏感），以及各映射选项打开文件的耗时
+//透明大页对页缓存只在tmpfs（shmem_enabled为advise）上生效，可把文件放在/dev/shm下
+int bench_tlb(int argc, char *argv[])
+{
+	uint32_t bucket_len = 250000;
+	uint32_t lookups    = 5000000;
+	const char *name = "bench_tlb.memhash";
+	if (argc > 0) bucket_len = atoi(argv[0]);
+	if (argc > 1) lookups    = atoi(argv[1]);
+	if (argc > 2) name       = argv[2];
+	if (bucket_len == 0 || lookups == 0)
+		return -1;
+
+	const uint32_t bucket_time = 20;
+	uint64_t key_num = (uint64_t)bucket_time * bucket_len / 2;
+	char value[8];
+	memset(value, 'a', sizeof(value));
+
+	//value内联在NODE节点中，查找只访问NODE区域
+	unlink(name);
+	{
+		struct mem_option option;
+		option.inline_size = sizeof(value);
+		MemHash *mem = new MemHash();
+		mem->Init(name, 0, CLOSE_MLOCK, 0, MS_ASYNC, bucket_time,
+			  bucket_len, 1000, option);
+		for (uint64_t key = 1; key <= key_num; key++)
+			mem->Set(key, value, sizeof(value));
+		delete mem;
+	}
+
+	struct {
+		const char* name;
+		int         huge_page;
+		int         prefault;
+		int         numa_policy;
+	} modes[] = {
+		{"default",          0, PREFAULT_NONE,     NUMA_POLICY_DEFAULT},
+		{"populate",         0, PREFAULT_POPULATE, NUMA_POLICY_DEFAULT},
+		{"parallel",         0, PREFAULT_PARALLEL, NUMA_POLICY_DEFAULT},
+		{"hugepage",         1, PREFAULT_NONE,     NUMA_POLICY_DEFAULT},
+		{"hugepage+parallel", 1, PREFAULT_PARALLEL, NUMA_POLICY_DEFAULT},
+		{"interleave",       0, PREFAULT_PARALLEL, NUMA_POLICY_INTERLEAVE},
+	};
+
+	printf("%-18s %10s %12s %12s\n", "[mode]", "map us", "lookups/s",
+	       "ns/lookup");
+	for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+		struct mem_option option;
+		option.huge_page         = modes[m].huge_page;
+		option.prefault          = modes[m].prefault;
+		option.node_numa_policy  = modes[m].numa_policy;
+		option.block_numa_policy = modes[m].numa_policy;
+		MemHash *mem = new MemHash();
+		mem->Init(name, 0, CLOSE_MLOCK, 0, MS_ASYNC, bucket_time,
+			  bucket_len, 1000, option);
+		struct open_stat stat;
+		mem->OpenStat(stat);
+
+		//一半的key不存在，查找走完所有阶
+		srand(1);
+		uint32_t found = 0;
+		uint64_t begin = NowUs();
+		for (uint32_t i = 0; i < lookups; i++)
+			found += mem->IsExist(1 + (uint64_t)rand() * rand() %
+					      (key_num * 2)) == 1;
+		uint64_t cost = NowUs() - begin;
+
+		printf("%-18s %10lu %12lu %12.1f\n", modes[m].name, stat.map_cost_us,
+		       cost == 0 ? 0 : (uint64_t)lookups * 1000000 / cost,
+		       (double)cost * 1000 / lookups);
+		if (found == 0)
+			printf("no key found\n");
+		delete mem;
+	}
+
+	unlink(name);
+	return 0;
+}
+
+int bench_cold(int argc, char *argv[])
+{
+	uint64_t key_num = 200000;
+	int      size    = 4000;
+	int      batch   = 64;
+	const char *name = "bench_cold.memhash";
+	if (argc > 0) key_num = atoi(argv[0]);
+	if (argc > 1) size    = atoi(argv[1]);
+	if (argc > 2) batch   = atoi(argv[2]);
+	if (argc > 3) name    = argv[3];
+	if (key_num == 0 || batch <= 0 || size <= 0 || size > 10240)
+		return -1;
+
+	char value[10240];
+	memset(value, 'a', sizeof(value));
+	unlink(name);
+	{
+		struct mem_option option;
+		MemHash *mem = new MemHash();
+		mem->Init(name, 0, CLOSE_MLOCK, 0, MS_SYNC, 20, key_num / 10 + 1,
+			  key_num * ((size + 511) / 512) + 1000, option);
+		for (uint64_t key = 1; key <= key_num; key++)
+			mem->Set(key, value, size);
+		delete mem;
+	}
+
+	struct {
+		const char* name;
+		int         random_access;
+		int         willneed;
+	} modes[] = {
+		{"default",         0, 0},
+		{"random",          1, 0},
+		{"willneed",        0, 1},
+		{"random+willneed", 1, 1},
+	};
+
+	uint64_t *keys = new uint64_t[batch];
+	int      *ret  = new int[batch];
+	int      *dlen = new int[batch];
+	int      *maxs = new int[batch];
+	char    **bufs = new char*[batch];
+	for (int i = 0; i < batch; i++) {
+		bufs[i] = new char[10240];
+		maxs[i] = 10240;
+	}
+
+	//每种模式打开前丢弃文件的页缓存，NODE区域锁定，value从磁盘读入
+	printf("keys %lu size %d batch %d\n", key_num, size, batch);
+	printf("%-16s %12s %12s\n", "[mode]", "gets/s", "us/batch");
+	const int rounds = 200;
+	for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+		int fd = open(name, O_RDONLY);
+		if (fd >= 0) {
+			posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+			close(fd);
+		}
+
+		struct mem_option option;
+		option.random_access = modes[m].random_access;
+		option.willneed      = modes[m].willneed;
+		MemHash *mem = new MemHash();
+		mem->Init(name, 0, NODE_MLOCK, 0, MS_ASYNC, 20, key_num / 10 + 1,
+			  key_num * ((size + 511) / 512) + 1000, option);
+
+		srand(1);
+		uint64_t begin = NowUs();
+		for (int r = 0; r < rounds; r++) {
+			for (int i = 0; i < batch; i++)
+				keys[i] = (uint64_t)rand() % key_num + 1;
+			mem->MultiGet(keys, batch, bufs, maxs, dlen, ret);
+		}
+		uint64_t cost = NowUs() - begin;
+		printf("%-16s %12.0f %12.1f\n", modes[m].name,
+		       (double)rounds * batch * 1000000 / (cost ? cost : 1),
+		       (double)cost / rounds);
+		delete mem;
+	}
+
+	for (int i = 0; i < batch; i++)
+		delete [] bufs[i];
+	delete [] bufs;
+	delete [] keys;
+	delete [] ret;
+	delete [] dlen;
+	delete [] maxs;
+	unlink(name);
+	return 0;
+}
+
+//快照期间持续写入的线程
+struct snap_ctx {
+	MemHash* mem;
+	uint64_t key_num;
+	int      size;
+	int      stop;
+	uint64_t ops;
+	uint64_t max_us;
+};
+
+static void* SnapWriter(void* arg)
+{
+	struct snap_ctx *ctx = (struct snap_ctx *)arg;
+	char value[10240];
+	memset(value, 'b', sizeof(value));
+	srand(2);
+	while (!__atomic_load_n(&ctx->stop, __ATOMIC_ACQUIRE)) {
+		uint64_t begin = NowUs();
+		ctx->mem->Set((uint64_t)rand() % ctx->key_num + 1, value, ctx->size);
+		uint64_t cost = NowUs() - begin;
+		if (cost > ctx->max_us)
+			ctx->max_us = cost;
+		ctx->ops++;
+	}
+
+	return NULL;
+}
+
+//快照的耗时、快照期间另一个线程的写入吞吐及单次Set的最大耗时，以及导入的吞吐
+int bench_snapshot(int argc, char *argv[])
+{
+	uint64_t key_num = 200000;
+	int      size    = 1024;
+	const char *name = "bench_snapshot.memhash";
+	if (argc > 0) key_num = atoi(argv[0]);
+	if (argc > 1) size    = atoi(argv[1]);
+	if (argc > 2) name    = argv[2];
+	if (key_num == 0 || size <= 0 || size > 10240)
+		return -1;
+
+	char snap_name[1024], load_name[1024];
+	snprintf(snap_name, sizeof(snap_name), "%s.snap", name);
+	snprintf(load_name, sizeof(load_name), "%s.load", name);
+	uint32_t max_block = key_num * ((size + 511) / 512) + 1000;
+
+	char value[10240];
+	memset(value, 'a', sizeof(value));
+	unlink(name);
+	struct mem_option option;
+	option.concurrent = 1;
+	MemHash *mem = new MemHash();
+	mem->Init(name, 0, CLOSE_MLOCK, 0, MS_ASYNC, 20, key_num / 10 + 1,
+		  max_block, option);
+	for (uint64_t key = 1; key <= key_num; key++)
+		mem->Set(key, value, size);
+
+	struct snap_ctx ctx;
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.mem     = mem;
+	ctx.key_num = key_num;
+	ctx.size    = size;
+	pthread_t tid;
+	pthread_create(&tid, NULL, SnapWriter, &ctx);
+	uint64_t begin = NowUs();
+	int ret = mem->Snapshot(snap_name);
+	uint64_t cost = NowUs() - begin;
+	__atomic_store_n(&ctx.stop, 1, __ATOMIC_RELEASE);
+	pthread_join(tid, NULL);
+
+	struct snapshot_stat stat;
+	mem->SnapshotStat(stat);
+	delete mem;
+	if (ret != 0) {
+		printf("snapshot failed\n");
+		return -1;
+	}
+	printf("keys %lu size %d\n", key_num, size);
+	printf("snapshot: %lu records, %lu captured, %lu us, %.0f MB/s\n",
+	       stat.records, stat.captured, cost,
+	       (double)stat.bytes / (cost ? cost : 1));
+	printf("writer:   %.0f sets/s, max set %lu us\n",
+	       (double)ctx.ops * 1000000 / (cost ? cost : 1), ctx.max_us);
+
+	unlink(load_name);
+	mem = new MemHash();
+	struct mem_option load_option;
+	mem->Init(load_name, 0, CLOSE_MLOCK, 0, MS_ASYNC, 20, key_num / 10 + 1,
+		  max_block, load_option);
+	begin = NowUs();
+	ret = mem->LoadSnapshot(snap_name);
+	cost = NowUs() - begin;
+	mem->SnapshotStat(stat);
+	delete mem;
+	printf("load:     %lu records, %lu us, %.0f MB/s%s\n", stat.records, cost,
+	       (double)stat.bytes / (cost ? cost : 1), ret == 0 ? "" : " (failed)");
+
+	unlink(name);
+	unlink(snap_name);
+	unlink(load_name);
+	return 0;
+}
+
+//迁移数据：ForEachKey + Get + Set逐条拷贝，与Dump到文件后Restore（1个及threads
+//个导入线程）的对比
+int bench_restore(int argc, char *argv[])
+{
+	uint64_t key_num = 1000000;
+	int      size    = 100;
+	uint32_t threads = 4;
+	const char *name = "bench_restore.memhash";
+	if (argc > 0) key_num = atoi(argv[0]);
+	if (argc > 1) size    = atoi(argv[1]);
+	if (argc > 2) threads = atoi(argv[2]);
+	if (argc > 3) name    = argv[3];
+	if (key_num == 0 || size <= 0 || size > 10240 || threads == 0)
+		return -1;
+
+	char dump_name[1024], dst_name[1024];
+	snprintf(dump_name, sizeof(dump_name), "%s.dump", name);
+	snprintf(dst_name, sizeof(dst_name), "%s.dst", name);
+	uint32_t max_block = key_num * ((size + 511) / 512) + 1000;
+
+	//目标的阶数、阶长度与源不同，value不超过128字节时内联
+	char value[10240];
+	memset(value, 'a', sizeof(value));
+	unlink(name);
+	MemHash *src = new MemHash();
+	struct mem_option src_option;
+	src->Init(name, 0, CLOSE_MLOCK, 0, MS_ASYNC, 20, key_num / 10 + 1,
+		  max_block, src_option);
+	for (uint64_t key = 1; key <= key_num; key++)
+		src->Set(key, value, size);
+
+	struct mem_option dst_option;
+	dst_option.inline_size = size <= 128 ? 128 : 0;
+	printf("keys %lu size %d\n", key_num, size);
+
+	//逐条拷贝
+	{
+		unlink(dst_name);
+		MemHash *dst = new MemHash();
+		dst->Init(dst_name, 0, CLOSE_MLOCK, 0, MS_ASYNC, 30, key_num / 15 + 1,
+			  max_block, dst_option);
+		char buf[10240];
+		uint64_t begin = NowUs(), copied = 0;
+		uint64_t key = 0;
+		while (src->ForEachKey(key) == 1) {
+			int len = 0;
+			if (src->Get(key, buf, sizeof(buf), len) == 0 &&
+			    dst->Set(key, buf, len) == 0)
+				copied++;
+		}
+		uint64_t cost = NowUs() - begin;
+		printf("%-16s %10lu keys %10lu us %12.0f keys/s\n", "foreach+set",
+		       copied, cost, (double)copied * 1000000 / (cost ? cost : 1));
+		delete dst;
+	}
+
+	uint64_t begin = NowUs();
+	int fd = open(dump_name, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	int ret = fd == -1 ? -1 : src->Dump(fd);
+	if (fd != -1)
+		close(fd);
+	uint64_t cost = NowUs() - begin;
+	delete src;
+	if (ret != 0) {
+		printf("dump failed\n");
+		return -1;
+	}
+	printf("%-16s %10lu keys %10lu us %12.0f keys/s\n", "dump", key_num, cost,
+	       (double)key_num * 1000000 / (cost ? cost : 1));
+
+	uint32_t modes[] = {1, threads};
+	for (int m = 0; m < 2; m++) {
+		unlink(dst_name);
+		MemHash *dst = new MemHash();
+		dst->Init(dst_name, 0, CLOSE_MLOCK, 0, MS_ASYNC, 30, key_num / 15 + 1,
+			  max_block, dst_option);
+		begin = NowUs();
+		ret = dst->LoadSnapshot(dump_name, modes[m]);
+		cost = NowUs() - begin;
+		struct snapshot_stat stat;
+		dst->SnapshotStat(stat);
+		char label[32];
+		snprintf(label, sizeof(label), "restore x%u", modes[m]);
+		printf("%-16s %10lu keys %10lu us %12.0f keys/s%s\n", label,
+		       stat.records, cost, (double)stat.records * 1000000 / (cost ? cost : 1),
+		       ret == 0 ? "" : " (failed)");
+		delete dst;
+	}
+
+	unlink(name);
+	unlink(dump_name);
+	unlink(dst_name);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2) {
+		printf("usage: %s crc [loops]\n", argv[0]);
+		printf("       %s read_scale [max_threads] [seconds] "
+		       "[writers] [file]\n", argv[0]);
+		printf("       %s fingerprint [bucket_time] [bucket_len] [file]\n",
+		       argv[0]);
+		printf("       %s fastmod [levels] [bucket_len] [loops]\n", argv[0]);
+		printf("       %s multi [batch] [keys] [size] [file]\n", argv[0]);
+		printf("       %s extent [keys] [size] [churn] [file]\n", argv[0]);
+		printf("       %s compact [keys] [size] [churn] [file]\n", argv[0]);
+		printf("       %s sync [keys] [bucket_len] [max_block] [file]\n",
+		       argv[0]);
+		printf("       %s flush [keys] [size] [interval_ms] [file]\n",
+		       argv[0]);
+		printf("       %s clock [keys] [size] [file]\n", argv[0]);
+		printf("       %s evict [ops] [keys] [hot] [file]\n", argv[0]);
+		printf("       %s tlb [bucket_len] [lookups] [file]\n", argv[0]);
+		printf("       %s cold [keys] [size] [batch] [file]\n", argv[0]);
+		printf("       %s snapshot [keys] [size] [file]\n", argv[0]);
+		printf("       %s restore [keys] [size] [threads] [file]\n", argv[0]);
+		return -1;
+	}
+
+	if (strcmp(argv[1], "crc") == 0)
+		return bench_crc(argc - 2, argv + 2);
+
+	if (strcmp(argv[1], "read_scale") == 0)
+		return bench_read_scale(argc - 2, argv + 2);
+
+	if (strcmp(argv[1], "fingerprint") == 0)
+		return bench_fingerprint(argc - 2, argv + 2);
+
+	if (strcmp(argv[1], "fastmod") == 0)
+		return bench_fastmod(argc - 2, argv + 2);
+
+	if (strcmp(argv[1], "multi") == 0)
+		return bench_multi(argc - 2, argv + 2);
+
+	if (strcmp(argv[1], "extent") == 0)
+		return bench_extent(argc - 2, argv + 2);
+
+	if (strcmp(argv[1], "compact") == 0)
+		return bench_compact(argc - 2, argv + 2);
+
+	if (strcmp(argv[1], "sync") == 0)
+		return bench_sync(argc - 2, argv + 2);
+
+	if (strcmp(argv[1], "flush") == 0)
+		return bench_flush(argc - 2, argv + 2);
+
+	if (strcmp(argv[1], "clock") == 0)
+		return bench_clock(argc - 2, argv + 2);
+
+	if (strcmp(argv[1], "evict") == 0)
+		return bench_evict(argc - 2, argv + 2);
+
+	if (strcmp(argv[1], "tlb") == 0)
+		return bench_tlb(argc - 2, argv + 2);
+
+	if (strcmp(argv[1], "cold") == 0)
+		return bench_cold(argc - 2, argv + 2);
+
+	if (strcmp(argv[1], "snapshot") == 0)
+		return bench_snapshot(argc - 2, argv + 2);
+
+	if (strcmp(argv[1], "restore") == 0)
+		return bench_restore(argc - 2, argv + 2);
+
+	printf("unknown bench: %s\n", argv[1]);
+	return -1;
+}
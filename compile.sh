@@ -1,2 +1,3 @@
 #!/bin/sh
-g++ main.cpp mem_hash.cpp -lrt -DDEBUG -Wall -g
+g++ main.cpp mem_hash.cpp mem_crc.cpp -lrt -lpthread -DDEBUG -Wall -g
+g++ bench_mem_hash.cpp mem_hash.cpp mem_crc.cpp -lrt -lpthread -Wall -O2 -o bench_mem_hash
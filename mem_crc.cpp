@@ -0,0 +1,191 @@
+#include <string.h>
+#include "mem_crc.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#define MEM_CRC_X86 1
+#endif
+
+namespace mem_hash {
+
+//旧算法（高位在前）的8张表，crc32c（反射）的8张表
+static uint32_t legacy_table[8][256];
+static uint32_t crc32c_table[8][256];
+
+static void Crc32InitTables()
+{
+	for (uint32_t i = 0; i < 256; i++) {
+		uint32_t reg = i << 24;
+		for (int j = 0; j < 8; j++)
+			reg = (reg & 0x80000000) ? (reg << 1) ^ PLOY : (reg << 1);
+		legacy_table[0][i] = reg;
+
+		reg = i;
+		for (int j = 0; j < 8; j++)
+			reg = (reg & 1) ? (reg >> 1) ^ PLOY_CRC32C : (reg >> 1);
+		crc32c_table[0][i] = reg;
+	}
+
+	for (uint32_t i = 0; i < 256; i++) {
+		for (int k = 1; k < 8; k++) {
+			uint32_t reg = legacy_table[k - 1][i];
+			legacy_table[k][i] = (reg << 8) ^ legacy_table[0][reg >> 24];
+			reg = crc32c_table[k - 1][i];
+			crc32c_table[k][i] = (reg >> 8) ^ crc32c_table[0][reg & 0xFF];
+		}
+	}
+}
+
+//进程加载时生成表，之后只读，多线程安全
+static struct crc32_table_init {
+	crc32_table_init() { Crc32InitTables(); }
+} crc32_table_init_;
+
+//-----旧算法：初值0，无结果取反，与旧文件中的crc32一致
+static uint32_t Crc32LegacyByte(uint32_t crc32, const char* data, size_t len)
+{
+	const unsigned char *p = (const unsigned char *)data;
+	uint32_t reg = crc32;
+
+	for (size_t i = 0; i < len; i++)
+		reg = (reg << 8) ^ legacy_table[0][(p[i] ^ (reg >> 24)) & 0xFF];
+
+	return reg;
+}
+
+static uint32_t Crc32LegacySlice8(uint32_t crc32, const char* data, size_t len)
+{
+	const unsigned char *p = (const unsigned char *)data;
+	uint32_t reg = crc32;
+
+	while (len >= 8) {
+		reg ^= ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+		       ((uint32_t)p[2] << 8)  |  (uint32_t)p[3];
+		reg = legacy_table[7][reg >> 24]          ^
+		      legacy_table[6][(reg >> 16) & 0xFF] ^
+		      legacy_table[5][(reg >> 8) & 0xFF]  ^
+		      legacy_table[4][reg & 0xFF]         ^
+		      legacy_table[3][p[4]]               ^
+		      legacy_table[2][p[5]]               ^
+		      legacy_table[1][p[6]]               ^
+		      legacy_table[0][p[7]];
+		p   += 8;
+		len -= 8;
+	}
+
+	return Crc32LegacyByte(reg, (const char *)p, len);
+}
+
+//-----crc32c：标准初值与结果取反，Append时先还原寄存器
+static uint32_t Crc32cSlice8(uint32_t crc32, const char* data, size_t len)
+{
+	const unsigned char *p = (const unsigned char *)data;
+	uint32_t reg = ~crc32;
+
+	while (len >= 8) {
+		uint32_t low;
+		memcpy(&low, p, sizeof(low));
+		reg ^= low;
+		reg = crc32c_table[7][reg & 0xFF]         ^
+		      crc32c_table[6][(reg >> 8) & 0xFF]  ^
+		      crc32c_table[5][(reg >> 16) & 0xFF] ^
+		      crc32c_table[4][reg >> 24]          ^
+		      crc32c_table[3][p[4]]               ^
+		      crc32c_table[2][p[5]]               ^
+		      crc32c_table[1][p[6]]               ^
+		      crc32c_table[0][p[7]];
+		p   += 8;
+		len -= 8;
+	}
+
+	while (len > 0) {
+		reg = (reg >> 8) ^ crc32c_table[0][(reg ^ *p) & 0xFF];
+		p++;
+		len--;
+	}
+
+	return ~reg;
+}
+
+#ifdef MEM_CRC_X86
+__attribute__((target("sse4.2")))
+static uint32_t Crc32cSse42(uint32_t crc32, const char* data, size_t len)
+{
+	const unsigned char *p = (const unsigned char *)data;
+#ifdef __x86_64__
+	uint64_t reg = (uint32_t)~crc32;
+
+	while (len >= 8) {
+		uint64_t word;
+		memcpy(&word, p, sizeof(word));
+		reg  = _mm_crc32_u64(reg, word);
+		p   += 8;
+		len -= 8;
+	}
+#else
+	uint32_t reg = ~crc32;
+#endif
+
+	uint32_t reg32 = (uint32_t)reg;
+	while (len >= 4) {
+		uint32_t word;
+		memcpy(&word, p, sizeof(word));
+		reg32 = _mm_crc32_u32(reg32, word);
+		p    += 4;
+		len  -= 4;
+	}
+
+	while (len > 0) {
+		reg32 = _mm_crc32_u8(reg32, *p);
+		p++;
+		len--;
+	}
+
+	return ~reg32;
+}
+#endif
+
+static const struct crc32_engine crc32_engines[CRC32_IMPL_NUM] = {
+	{CRC_TYPE_LEGACY, CRC32_IMPL_LEGACY_BYTE,   "legacy-byte",   Crc32LegacyByte},
+	{CRC_TYPE_LEGACY, CRC32_IMPL_LEGACY_SLICE8, "legacy-slice8", Crc32LegacySlice8},
+	{CRC_TYPE_CRC32C, CRC32_IMPL_CRC32C_SLICE8, "crc32c-slice8", Crc32cSlice8},
+#ifdef MEM_CRC_X86
+	{CRC_TYPE_CRC32C, CRC32_IMPL_CRC32C_SSE42,  "crc32c-sse42",  Crc32cSse42},
+#else
+	{CRC_TYPE_CRC32C, CRC32_IMPL_CRC32C_SSE42,  "crc32c-sse42",  NULL},
+#endif
+};
+
+const struct crc32_engine* Crc32GetImpl(uint32_t impl)
+{
+	if (impl >= CRC32_IMPL_NUM)
+		return NULL;
+
+#ifdef MEM_CRC_X86
+	if (impl == CRC32_IMPL_CRC32C_SSE42 && !__builtin_cpu_supports("sse4.2"))
+		return NULL;
+#endif
+
+	if (crc32_engines[impl].append == NULL)
+		return NULL;
+
+	return &crc32_engines[impl];
+}
+
+const struct crc32_engine* Crc32GetEngine(uint32_t type)
+{
+	if (type == CRC_TYPE_LEGACY)
+		return Crc32GetImpl(CRC32_IMPL_LEGACY_SLICE8);
+
+	if (type == CRC_TYPE_CRC32C) {
+		const struct crc32_engine *engine =
+			Crc32GetImpl(CRC32_IMPL_CRC32C_SSE42);
+		if (engine != NULL)
+			return engine;
+		return Crc32GetImpl(CRC32_IMPL_CRC32C_SLICE8);
+	}
+
+	return NULL;
+}
+
+}//namespace mem_hash
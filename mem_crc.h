@@ -0,0 +1,41 @@
+#ifndef MEM_HASH_MEM_CRC_H
+#define MEM_HASH_MEM_CRC_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace mem_hash {
+//crc32 多项式（旧格式文件使用）
+const uint32_t PLOY            = 0x04C11DB7;
+//crc32c 多项式（反射形式）
+const uint32_t PLOY_CRC32C     = 0x82F63B78;
+
+//文件中记录的校验算法
+const uint32_t CRC_TYPE_LEGACY = 0;
+const uint32_t CRC_TYPE_CRC32C = 1;
+
+//校验引擎的具体实现
+enum crc32_impl {
+	CRC32_IMPL_LEGACY_BYTE   = 0,
+	CRC32_IMPL_LEGACY_SLICE8 = 1,
+	CRC32_IMPL_CRC32C_SLICE8 = 2,
+	CRC32_IMPL_CRC32C_SSE42  = 3,
+	CRC32_IMPL_NUM           = 4
+};
+
+//校验引擎，Append(Append(0, a), b) == Append(0, a + b)
+struct crc32_engine {
+	uint32_t    type;
+	uint32_t    impl;
+	const char* name;
+	uint32_t  (*append)(uint32_t crc32, const char* data, size_t len);
+};
+
+//根据文件记录的校验算法选择当前CPU上最快的实现
+const struct crc32_engine* Crc32GetEngine(uint32_t type);
+//获取指定实现，CPU不支持时返回NULL
+const struct crc32_engine* Crc32GetImpl(uint32_t impl);
+
+}
+
+#endif
@@ -9,27 +9,297 @@
 #include <unistd.h>
 #include <math.h>
 #include <stdarg.h>
+#include <stddef.h>
+#include <limits.h>
+#include <sys/syscall.h>
 #include "mem_hash.h"
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#include <cpuid.h>
+#define MEM_HASH_X86 1
+#endif
+
 namespace mem_hash {
-#define LOG(fmt, args...) Log_("[%s][%d][%s] : " fmt, \
-				__FILE__, \
-				__LINE__, \
-				__FUNCTION__, ##args);
+//每个LOG位置有自己的限速状态
+#define LOG_AT(level, fmt, args...) do { \
+		static struct log_site log_site_; \
+		Log_(level, &log_site_, "[%s][%d][%s] : " fmt, \
+		     __FILE__, \
+		     __LINE__, \
+		     __FUNCTION__, ##args); \
+	} while (0)
+#define LOG_ERROR(fmt, args...) LOG_AT(LOG_LEVEL_ERROR, fmt, ##args)
+#define LOG_WARN(fmt, args...)  LOG_AT(LOG_LEVEL_WARN,  fmt, ##args)
+#define LOG(fmt, args...)       LOG_AT(LOG_LEVEL_INFO,  fmt, ##args)
+#define LOG_DEBUG(fmt, args...) LOG_AT(LOG_LEVEL_DEBUG, fmt, ##args)
+
+//日志环形队列的槽，seq为Vyukov有界队列的序号
+struct log_slot {
+	uint64_t seq;
+	time_t   tval;
+	uint32_t len;
+	char     text[MAX_LOG_LEN];
+};
+
+//LOG位置的限速状态：当前统计的秒、本秒已输出及被限制的条数
+struct log_site {
+	uint64_t window;
+	uint32_t count;
+	uint32_t suppressed;
+};
 
 #define GET_BLOCK_USED_FLAG(x) 	(x &  0x1)
 #define SET_BLOCK_USED_FLAG(x) 	(x = x | 0x1)
 #define CLR_BLOCK_USED_FLAG(x)	(x = x & ~0x1)
+//BLOCK链第一个BLOCK的第2位：整条链是地址连续的区段，可以按地址顺序访问
+#define GET_BLOCK_EXTENT_FLAG(x) (x &  0x2)
+#define SET_BLOCK_EXTENT_FLAG(x) (x = x | 0x2)
+#define CLR_BLOCK_EXTENT_FLAG(x) (x = x & ~0x2)
+#define BITMAP_GET(map, i)	((map)[(i) >> 3] &   (1 << ((i) & 7)))
+#define BITMAP_SET(map, i)	((map)[(i) >> 3] |=  (1 << ((i) & 7)))
+#define BITMAP_CLR(map, i)	((map)[(i) >> 3] &= ~(1 << ((i) & 7)))
+
+//恢复时多个线程可能同时标记同一个BLOCK节点
+#define SET_BLOCK_USED_FLAG_ATOMIC(x)	__sync_fetch_and_or(&(x), 0x1)
+
+//无锁读需要转为加锁读
+#define SEQ_READ_LOCKED 1
+
+//恢复的各个阶段
+enum {
+	RECOVER_CLEAR_FLAG = 0,
+	RECOVER_CHECK_NODE = 1,
+	RECOVER_FREE_BLOCK = 2,
+	RECOVER_EXTENT_MAP = 3
+};
+
+struct recover_task {
+	MemHash*  mem;
+	pthread_t tid;
+	int       phase;
+	//BLOCK相关阶段处理的级别
+	uint32_t  cls;
+	uint32_t  begin;
+	uint32_t  end;
+	//CheckNodeBlock统计结果
+	uint32_t  node_used;
+	//RecoverBlock区间内空闲队列的首尾及空闲个数
+	int32_t   free_head;
+	int32_t   free_tail;
+	uint32_t  free_num;
+};
+
+//共享模式下的文件锁：第0字节为初始化锁，第1字节为挂接锁（每个进程持读锁）
+enum {
+	FILE_LOCK_INIT   = 0,
+	FILE_LOCK_ATTACH = 1
+};
+
+//并行导入：读取线程按key把记录分到各导入线程的批次队列
+struct import_task {
+	MemHash*        mem;
+	pthread_t       tid;
+	pthread_mutex_t lock;
+	pthread_cond_t  cond;
+	//队列中的批次（环形），head为下一个要导入的，tail为下一个放入的位置
+	char*           batch[IMPORT_QUEUE_DEPTH];
+	size_t          batch_len[IMPORT_QUEUE_DEPTH];
+	uint32_t        head;
+	uint32_t        tail;
+	int             eof;
+	//读取线程正在填充的批次
+	char*           fill;
+	size_t          fill_len;
+	size_t          fill_cap;
+	//快照的crc32算法、时间单位，导入开始时的NODE节点时间
+	const struct crc32_engine* engine;
+	uint32_t        tval_ms;
+	time_t          now;
+	//MemHash为空，不查找已有的key
+	int             fresh;
+	//任一线程失败后其他线程不再写入
+	int*            failed;
+	int             ret;
+	uint64_t        records;
+	uint64_t        bytes;
+	uint64_t        expired;
+};
+
+//批量接口预取时在新区域找到的节点，valid为0时不能代替GetNode
+struct node_hint {
+	struct mem_node* node;
+	uint32_t         layout_seq;
+	int              valid;
+};
+
+//GetView引用的BLOCK链，freed表示链已不被节点引用，最后一个引用释放时回收nbu个BLOCK
+struct view_pin {
+	int32_t  pos;
+	uint32_t nbu;
+	uint32_t ref;
+	int      freed;
+};
+
+//并行预取的一段
+struct prefault_task {
+	pthread_t tid;
+	char*     begin;
+	size_t    len;
+};
+
+//预取按大页大小对齐切分
+const size_t PREFAULT_ALIGN = 2UL << 20;
+
+//mbind、get_mempolicy的参数（不依赖libnuma）
+const int MPOL_BIND_           = 2;
+const int MPOL_INTERLEAVE_     = 3;
+const int MPOL_F_MEMS_ALLOWED_ = 1 << 2;
+const int MPOL_MF_MOVE_        = 1 << 1;
+
+static void* PrefaultWorker(void* arg)
+{
+	struct prefault_task *task = (struct prefault_task *)arg;
+
+#ifdef MADV_POPULATE_READ
+	if (madvise(task->begin, task->len, MADV_POPULATE_READ) == 0)
+		return NULL;
+#endif
+	//内核不支持时逐页读一个字节，与MAP_POPULATE一样只建立只读映射，不产生脏页
+	size_t page = sysconf(_SC_PAGESIZE);
+	for (size_t off = 0; off < task->len; off += page)
+		(void)*(volatile char *)(task->begin + off);
+
+	return NULL;
+}
+
+static uint64_t NowUs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+//使用open file description锁，同一进程内多个fd之间也互斥
+static int FileLock(int fd, off_t start, short type, int wait)
+{
+	struct flock fl;
+	memset(&fl, 0, sizeof(fl));
+	fl.l_type   = type;
+	fl.l_whence = SEEK_SET;
+	fl.l_start  = start;
+	fl.l_len    = 1;
+
+	return fcntl(fd, wait ? F_OFD_SETLKW : F_OFD_SETLK, &fl);
+}
+
+//作用域内持有锁，mutex为NULL时不加锁
+class MemHash::LockGuard {
+public:
+	LockGuard(MemHash* mem, pthread_mutex_t* mutex) : mutex_(mutex)
+	{
+		if (mutex_ != NULL)
+			mem->LockMutex(mutex_);
+	}
+
+	~LockGuard()
+	{
+		if (mutex_ != NULL)
+			pthread_mutex_unlock(mutex_);
+	}
+
+private:
+	pthread_mutex_t* mutex_;
+};
+
+MemView::MemView()
+{
+	iovcnt   = 0;
+	size     = 0;
+	lock_    = NULL;
+	mem_     = NULL;
+	pin_pos_ = -1;
+}
+
+MemView::~MemView()
+{
+	Release();
+}
+
+void MemView::Release()
+{
+	//共享模式下回收BLOCK链时仍持有key所在的锁
+	if (mem_ != NULL)
+		mem_->UnpinChain(pin_pos_);
+
+	if (lock_ != NULL)
+		pthread_mutex_unlock(lock_);
+
+	iovcnt   = 0;
+	size     = 0;
+	lock_    = NULL;
+	mem_     = NULL;
+	pin_pos_ = -1;
+}
+
+mem_option::mem_option()
+{
+	recover_threads = 1;
+	recover_mode    = RECOVER_MODE_FULL;
+	concurrent      = 0;
+	shared          = 0;
+	lock_stripes    = DEFAULT_LOCK_STRIPES;
+	block_classes   = 0;
+	inline_size     = 0;
+	fingerprint     = 0;
+	extent_alloc    = 0;
+	grow_reserve    = 0;
+	dirty_sync      = 0;
+	flush_interval_ms = 0;
+	flush_dirty_bytes = 0;
+	log_path        = NULL;
+	log_level       = LOG_LEVEL_INFO;
+	log_rate        = DEFAULT_LOG_RATE;
+	clock_source    = CLOCK_SOURCE_REALTIME;
+	data_store_ms   = 0;
+	evict           = 0;
+	huge_page       = 0;
+	random_access   = 0;
+	willneed        = 0;
+	prefault        = PREFAULT_NONE;
+	prefault_threads = 0;
+	node_numa_policy  = NUMA_POLICY_DEFAULT;
+	node_numa_mask    = 0;
+	block_numa_policy = NUMA_POLICY_DEFAULT;
+	block_numa_mask   = 0;
+	memset(block_class_size,  0, sizeof(block_class_size));
+	memset(block_class_count, 0, sizeof(block_class_count));
+}
 
 MemHash::MemHash()
 {
 	bucket_time     = 0;
 	bucket_len      = 0;
 	max_node        = 0;
+	old_node_       = NULL;
+	old_max_node_   = 0;
+	old_bucket_time_ = 0;
+	old_bucket_len_  = 0;
+	node_total_     = 0;
+	layout_seq_     = 0;
+	reserve_size_   = 0;
+	grow_fd_        = -1;
 	max_block       = 0;		
+	class_num_      = 0;
+	block_zone_size = 0;
+	fp_             = NULL;
+	fp_zone_size    = 0;
+	fp_avx2_        = 0;
 	total_size      = 0;
+	head_ext_size   = 0;
 	mem_base        = NULL;
 	head_           = NULL;
+	head_ext_       = NULL;
 	node_           = NULL;
 	block_          = NULL;
 	foreach_key_pos = 0;
@@ -37,22 +307,187 @@ MemHash::MemHash()
 	msync_freq      = 0;
 	msync_flag      = 0;
 	data_change     = 0;
+	dirty_map_      = NULL;
+	dirty_shift_    = 0;
+	dirty_all_      = 0;
+	dirty_head_len_ = 0;
 	data_store_time = 0;
+	tval_ms_        = 0;
+	expire_limit_   = 0;
+	clock_ms_       = 0;
+	clock_started_  = 0;
+	clock_stop_     = 0;
+	tsc_base_       = 0;
+	tsc_base_ms_    = 0;
+	tsc_mult_       = 0;
 
 	memset(bucket, 0, sizeof(uint32_t) * MAX_BUCKET_SIZE);
+	memset(bucket_base, 0, sizeof(bucket_base));
+	memset(bucket_m, 0, sizeof(bucket_m));
+	memset(old_bucket_, 0, sizeof(old_bucket_));
+	memset(old_bucket_base_, 0, sizeof(old_bucket_base_));
+	memset(old_bucket_m_, 0, sizeof(old_bucket_m_));
+	memset(&layout_info_, 0, sizeof(layout_info_));
+	memset(classes_, 0, sizeof(classes_));
+	memset(&legacy_ext_, 0, sizeof(legacy_ext_));
+	memset(&open_stat_, 0, sizeof(open_stat_));
+	legacy_ext_.ext_info_.crc_type = CRC_TYPE_LEGACY;
 	//crc32
-	Crc32CreateTable(crc32_table);
+	crc_head_engine_ = Crc32GetEngine(CRC_TYPE_LEGACY);
+	crc_engine_      = crc_head_engine_;
+	//lazy效验
+	extent_active_     = 0;
+	lazy_active_       = 0;
+	lazy_stop_         = 0;
+	lazy_started_      = 0;
+	node_verified_     = NULL;
+	block_marked_      = NULL;
+	block_freed_       = NULL;
+	lazy_node_cursor_  = 0;
+	lazy_block_cursor_ = 0;
+	memset(lazy_scan_cursor_, 0, sizeof(lazy_scan_cursor_));
+	memset(lazy_free_num_, 0, sizeof(lazy_free_num_));
+	lazy_begin_us_     = 0;
+	//BLOCK区整理
+	compact_cursor_      = 0;
+	compact_own_map_     = 0;
+	compact_started_     = 0;
+	compact_stop_        = 0;
+	compact_budget_us_   = 0;
+	compact_interval_ms_ = 0;
+	compact_passes_      = 0;
+	compact_chains_      = 0;
+	compact_bytes_       = 0;
+	//过期清理
+	sweep_cursor_        = 0;
+	sweep_started_       = 0;
+	sweep_stop_          = 0;
+	sweep_budget_us_     = 0;
+	sweep_interval_ms_   = 0;
+	sweep_passes_        = 0;
+	sweep_nodes_         = 0;
+	sweep_blocks_        = 0;
+	//淘汰模式
+	hot_                 = NULL;
+	evict_hand_          = 0;
+	evict_probe_         = 0;
+	evict_clock_         = 0;
+	evict_blocks_        = 0;
+	evict_hits_          = 0;
+	evict_misses_        = 0;
+	//快照
+	snap_done_           = NULL;
+	snap_total_          = 0;
+	snap_now_            = 0;
+	snap_buf_            = NULL;
+	snap_len_            = 0;
+	snap_cap_            = 0;
+	snap_error_          = 0;
+	memset(&snap_stat_, 0, sizeof(snap_stat_));
+	//并行导入
+	import_active_       = 0;
+	pthread_mutex_init(&import_lock_, NULL);
+	//GetView引用
+	pins_                = NULL;
+	pin_num_             = 0;
+	pin_cap_             = 0;
+	pthread_mutex_init(&pin_lock_, NULL);
+	//后台落地
+	flush_started_       = 0;
+	flush_stop_          = 0;
+	flush_request_       = 0;
+	write_gen_           = 0;
+	durable_gen_         = 0;
+	flush_dirty_         = 0;
+	//共享模式
+	lock_fd_           = -1;
+	shared_first_      = 0;
+	//操作可能在持锁时再次进入（Append调用Set）
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&op_lock_, &attr);
+	pthread_mutexattr_destroy(&attr);
+	//log
+	log_fd          = -1;
+	log_ring_       = NULL;
+	log_head_       = 0;
+	log_tail_       = 0;
+	log_stop_       = 0;
+	log_written_    = 0;
+	log_dropped_    = 0;
+	log_suppressed_ = 0;
+	//后台落地按单调时钟等待
+	pthread_condattr_t cond_attr;
+	pthread_condattr_init(&cond_attr);
+	pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+	pthread_mutex_init(&flush_lock_, NULL);
+	pthread_cond_init(&flush_cond_, &cond_attr);
+	pthread_cond_init(&durable_cond_, &cond_attr);
+	pthread_condattr_destroy(&cond_attr);
 }
 
 MemHash::~MemHash()
 {
 	int ret = 0;
-	close(log_fd);
-	ret = munmap(mem_base, total_size);
+
+	//停止后台效验线程
+	if (lazy_started_) {
+		__atomic_store_n(&lazy_stop_, 1, __ATOMIC_RELEASE);
+		pthread_join(lazy_tid_, NULL);
+	}
+	SweepStop();
+	CompactStop();
+	FlushStop();
+	ClockStop();
+
+	//共享模式下只有最后一个退出的进程可以写正常关闭标记
+	int last = 1;
+	if (lock_fd_ != -1) {
+		FileLock(lock_fd_, FILE_LOCK_INIT, F_WRLCK, 1);
+		last = FileLock(lock_fd_, FILE_LOCK_ATTACH, F_WRLCK, 0) == 0;
+	}
+
+	//没有释放的MemView引用的链不再有效，已被回收的在这里归还
+	struct view_pin *pins = pins_;
+	uint32_t pin_num = pin_num_;
+	pin_num_ = 0;
+	for (uint32_t i = 0; i < pin_num; i++) {
+		if (pins[i].freed)
+			FreeBlockChain(pins[i].pos, pins[i].nbu);
+	}
+	free(pins);
+	pins_ = NULL;
+
+	//连续分配期间没有维护文件中的空闲队列，关闭前重建
+	ExtentFini();
+
+	//数据全部落地后再写正常关闭标记，下次打开可跳过恢复
+	//后台效验未完成时空闲队列不完整，不能写标记
+	if (mem_base != NULL && head_ext_ != &legacy_ext_ &&
+	    !lazy_active_ && last && !head_ext_->owner_dead) {
+		MemSync(MS_SYNC);
+		head_ext_->clean_shutdown = CLEAN_SHUTDOWN;
+		MemSyncHead();
+	}
+
+	//关闭fd同时释放文件锁
+	if (lock_fd_ != -1)
+		close(lock_fd_);
+
+	if (grow_fd_ != -1)
+		close(grow_fd_);
+
+	LogStop();
+	//预留了地址空间时一起释放
+	ret = munmap(mem_base, reserve_size_ != 0 ? reserve_size_ : total_size);
 	if (ret == -1) {
 		printf("MemHash::~MemHash munmap error[%d]. %s\n", 
 				errno, strerror(errno));
 	}
+	free(dirty_map_);
+	free(hot_);
+	free(snap_buf_);
 }
 
 int MemHash::Init(const char* name,
@@ -62,16 +497,30 @@ int MemHash::Init(const char* name,
 		  int       msync_flag,
 		  uint32_t  bucket_time,
 		  uint32_t  bucket_len,
-		  uint32_t  max_block)
+		  uint32_t  max_block,
+		  const struct mem_option& option)
 {
-	//打开日志文件
-	log_fd = open("run.log", O_CREAT | O_RDWR | O_APPEND, 0666);
-	if (log_fd == -1) {
-		printf("MemHash::Init open log error[%d]. %s\n", 
-				errno, strerror(errno));
-		exit(-1);
+	option_ = option;
+	if (option_.recover_threads == 0)
+		option_.recover_threads = 1;
+	if (option_.recover_threads > MAX_RECOVER_THREADS)
+		option_.recover_threads = MAX_RECOVER_THREADS;
+	if (option_.lock_stripes == 0)
+		option_.lock_stripes = 1;
+	if (option_.lock_stripes > MAX_LOCK_STRIPES)
+		option_.lock_stripes = MAX_LOCK_STRIPES;
+	//共享模式下读操作无锁，其他进程可能随时挂接，不能使用lazy效验
+	//空闲位图只在进程内，不能用于共享模式
+	if (option_.shared) {
+		option_.concurrent   = 1;
+		option_.recover_mode = RECOVER_MODE_FULL;
+		option_.extent_alloc = 0;
 	}
 
+	//打开日志文件，启动后台日志线程
+	LogStart();
+	ClockInit();
+
 	//超时设置
 	if (data_store_time <= 0)
 		this->data_store_time = 0;
@@ -85,16 +534,42 @@ int MemHash::Init(const char* name,
 	else
 		this->msync_freq = 0;
 
-	if (msync_flag != MS_ASYNC || msync_flag != MS_SYNC)
+	if (msync_flag != MS_ASYNC && msync_flag != MS_SYNC)
 		this->msync_flag = MS_ASYNC;
 	else
 		this->msync_flag = msync_flag;
 
-	int fd = open(name, O_RDWR, 0666);
+	uint64_t begin = NowUs();
+	int fd = -1;
+	if (option_.shared)
+		fd = SharedOpen(name);
+	else
+		fd = open(name, O_RDWR, 0666);
 	if (fd == -1) 
 		InitNewMemHash(name, bucket_time, bucket_len, max_block);
 	else 
 		InitOldMemHash(fd,   bucket_time, bucket_len, max_block);
+	if (option_.shared)
+		SharedOpenDone();
+	//lazy效验期间空闲队列还不完整，效验完成后再建立空闲位图
+	if (option_.extent_alloc && !lazy_active_)
+		ExtentInit();
+	if (option_.dirty_sync)
+		DirtyInit();
+	if (option_.evict)
+		EvictInit();
+	//超时换算为NODE节点的时间单位
+	uint64_t store_ms = option_.data_store_ms != 0 ? option_.data_store_ms :
+			    (uint64_t)this->data_store_time * 1000;
+	expire_limit_ = tval_ms_ ? store_ms : (store_ms + 999) / 1000;
+	if (option_.flush_interval_ms != 0 || option_.flush_dirty_bytes != 0)
+		FlushStart();
+	open_stat_.cost_us = NowUs() - begin;
+
+	LOG("[Init][path(%d)][threads(%u)][cost(%luus)]",
+			open_stat_.path,
+			open_stat_.recover_threads,
+			open_stat_.cost_us);
 
 	return 0;
 }
@@ -118,9 +593,18 @@ void MemHash::InitNewMemHash(const char* name,
 	//初始化阶数、阶长度以及bucket数组
 	BucketInit(bucket_time, bucket_len);
 	//根据阶数、阶长度初始化max_node
-	NodeInit();
-	//初始化max_block
-	BlockInit(max_block);
+	struct node_info node_info;
+	NodeInfoNew(node_info);
+	NodeInit(node_info);
+	struct fp_info fp_info;
+	FpInfoNew(fp_info);
+	FpInit(fp_info);
+	//初始化BLOCK分级及max_block
+	struct class_info info;
+	BlockClassNew(max_block, info);
+	BlockInit(info);
+	//新文件带扩展头部
+	HeadExtInit(MEM_HASH_VERSION);
 	//初始化total_size
 	TotalSizeInit();
 
@@ -131,25 +615,18 @@ void MemHash::InitNewMemHash(const char* name,
 		exit(-1);
 	} 
 
-	mem_base = (char *)mmap(NULL, total_size,
-				PROT_READ | PROT_WRITE,
-				MAP_SHARED, fd, 0); 
+	uint64_t map_begin = NowUs();
+	mem_base = MapFile(fd);
 	if (mem_base == MAP_FAILED) {
 		printf("MemHash::InitNewMemHash mmap error[%d]. %s\n",
 				errno, strerror(errno));
 		exit(-1);
 	}
-
-	if (mlock_open_flag == OPEN_MLOCK) {	
-		ret = mlock(mem_base, total_size);
-		if (ret == -1) {
-			printf("MemHash::InitNewMemHash mlock error[%d]. %s\n",
-					errno, strerror(errno));
-			exit(-1);
-		} 
-	}
+	MapSetup();
+	open_stat_.map_cost_us = NowUs() - map_begin;
 
 	MemInitNew();
+	open_stat_.path = OPEN_PATH_NEW;
 
 	close(fd);
 	return ;
@@ -170,12 +647,12 @@ int MemHash::Meta(const char* name,
 	
 	int ret = 0;
 	struct mem_head tmp_head;
+	memset(&tmp_head, 0, sizeof(tmp_head));
 	ret = pread(fd , &tmp_head, 
 			sizeof(struct mem_head),
 			sizeof(struct mem_barrier));
-	close(fd);
-
 	if (ret == -1) {
+		close(fd);
 		printf("MemHash::Meta pread error[%d]. %s\n", 
 				errno, strerror(errno));
 		return -2;
@@ -184,16 +661,40 @@ int MemHash::Meta(const char* name,
 	uint32_t crc32_check = 0;
 
 	//crc32头部效验
-	crc32_check = Crc32Compute((char *)&tmp_head.head_info_,
-				   sizeof(tmp_head.head_info_));
+	crc32_check = Crc32Head((char *)&tmp_head.head_info_,
+				sizeof(tmp_head.head_info_));
 	if (crc32_check != tmp_head.crc32_head_info) {
+		close(fd);
 		printf("MemHash::Meta crc32 error.\n"); 
 		return -3;
 	}
 
+	//扩容过的文件以扩展头部中的布局为准
+	uint32_t version = 0;
+	struct layout_info layout;
+	memset(&layout, 0, sizeof(layout));
+	if (HeadExtVersion(fd, version) != 0) {
+		close(fd);
+		printf("MemHash::Meta error. bad head ext\n"); 
+		return -3;
+	}
+	if (LayoutOld(fd, version, layout) != 0) {
+		close(fd);
+		printf("MemHash::Meta layout crc32 error.\n"); 
+		return -3;
+	}
+	close(fd);
+
 	bucket_time = tmp_head.head_info_.bucket_time;
 	bucket_len  = tmp_head.head_info_.bucket_len;
 	max_block   = tmp_head.head_info_.max_block;
+	if (layout.grow_count != 0) {
+		bucket_time = layout.bucket_time;
+		bucket_len  = layout.bucket_len;
+		max_block   = 0;
+		for (uint32_t i = 0; i < layout.class_info_.class_num; i++)
+			max_block += layout.class_info_.count[i];
+	}
 
 	return 0;
 }
@@ -206,14 +707,65 @@ void MemHash::InitOldMemHash(int fd,
 	LOG("MemHash::InitOldMemHash  Using Old MemHash.\n");
 	int ret = 0;
 
+	//旧文件是否带扩展头部
+	uint32_t version = 0;
+	if (HeadExtVersion(fd, version) != 0) {
+		printf("MemHash::InitOldMemHash error. "
+		       "bad head ext or unknown head magic\n");
+		exit(-1);
+	}
+	//扩容过的文件按扩展头部中的布局打开，不使用参数
+	if (LayoutOld(fd, version, layout_info_) != 0) {
+		printf("MemHash::InitOldMemHash  layout error.\n");
+		exit(-1);
+	}
+	int grown = layout_info_.grow_count != 0;
+	if (grown) {
+		if (bucket_time != layout_info_.bucket_time ||
+		    bucket_len  != layout_info_.bucket_len)
+			LOG("[Init][grown file][bucket_time(%u)][bucket_len(%u)]",
+			    layout_info_.bucket_time, layout_info_.bucket_len);
+		bucket_time = layout_info_.bucket_time;
+		bucket_len  = layout_info_.bucket_len;
+	}
+	//迁移未完成的文件不能与其他进程共享
+	if (layout_info_.old_node_offset != 0 && option_.shared) {
+		printf("MemHash::InitOldMemHash error. "
+		       "node zone migration in progress, shared mode not allowed\n");
+		exit(-1);
+	}
+
 	//初始化阶数、阶长度以及bucket数组
 	BucketInit(bucket_time, bucket_len);
 	//根据阶数、阶长度初始化max_node
-	NodeInit();
-	//初始化max_block
-	BlockInit(max_block);
+	struct node_info node_info;
+	NodeInfoOld(fd, version, node_info);
+	NodeInit(node_info);
+	if (layout_info_.old_node_offset != 0)
+		OldZoneInit(layout_info_.old_bucket_time,
+			    layout_info_.old_bucket_len);
+	struct fp_info fp_info;
+	if (grown)
+		fp_info.fp_num = layout_info_.fp_num;
+	else
+		FpInfoOld(fd, version, fp_info);
+	FpInit(fp_info);
+	//初始化BLOCK分级及max_block，版本3以上从文件读取
+	struct class_info info;
+	if (grown)
+		info = layout_info_.class_info_;
+	else
+		BlockClassOld(fd, version, max_block, info);
+	BlockInit(info);
+	if (grown) {
+		for (uint32_t i = 0; i < class_num_; i++)
+			classes_[i].offset = layout_info_.class_offset[i];
+	}
+	HeadExtInit(version);
 	//初始化total_size
 	TotalSizeInit();
+	if (grown)
+		total_size = layout_info_.total_size;
 
 	struct stat tmp_stat;
 	ret = fstat(fd, &tmp_stat);
@@ -223,33 +775,49 @@ void MemHash::InitOldMemHash(int fd,
 		exit(-1);
 	} 
 	
+	//扩容时在切换布局之前崩溃，文件末尾多出的部分不再使用
+	if (version >= 6 && (size_t)tmp_stat.st_size > total_size) {
+		LOG("[Init][truncate unfinished grow][%lu -> %lu]",
+		    (uint64_t)tmp_stat.st_size, (uint64_t)total_size);
+		if (ftruncate(fd, total_size) == -1) {
+			printf("MemHash::InitOldMemHash ftruncate error[%d]. %s\n",
+					errno, strerror(errno));
+			exit(-1);
+		}
+		tmp_stat.st_size = total_size;
+	}
+
 	//效验MemHash文件大小
-	if ((uint32_t)tmp_stat.st_size != total_size) {
+	if ((size_t)tmp_stat.st_size != total_size) {
 		printf("MemHash::InitOldMemHash error. \
 			stat.st_size != total_size\n");
 		exit(-1);
 	}
 	
-	mem_base = (char *)mmap(NULL, total_size,
-				PROT_READ | PROT_WRITE,
-				MAP_SHARED, fd, 0); 
+	uint64_t map_begin = NowUs();
+	mem_base = MapFile(fd);
 	if (mem_base == MAP_FAILED) {
 		printf("MemHash::InitOldMemHash mmap error[%d]. %s\n",
 				errno, strerror(errno));
 		exit(-1);
 	}
-
-	if (mlock_open_flag == OPEN_MLOCK) {
-		ret = mlock(mem_base, total_size);
-		if (ret == -1) {
-			printf("MemHash::InitOldMemHash mlock error[%d]. %s\n",
-					errno, strerror(errno));
-			exit(-1);
-		} 
-	}
+	MapSetup();
+	open_stat_.map_cost_us = NowUs() - map_begin;
 
 	MemInitOld();
 	close(fd);
+
+	//迁移时在清除旧节点之前崩溃，新区域已有同样的节点，清除旧节点
+	uint32_t cursor = head_ext_->migrate_cursor;
+	if (old_node_ != NULL && cursor < old_max_node_) {
+		struct mem_node *tmp_node = NodeAt(max_node + cursor);
+		if (tmp_node->key != 0 && GetNodeNew(tmp_node->key) != NULL) {
+			ClearNode(tmp_node);
+			if (open_stat_.path == OPEN_PATH_FULL)
+				head_->node_used--;
+			LOG("[Init][migrate][clear duplicate node(%u)]", cursor);
+		}
+	}
 	
 	return ;
 }
@@ -278,392 +846,4147 @@ void MemHash::BucketInit(uint32_t  bucket_time,
 		exit(-1);
 	}
 
+	//查找时不再累加每阶的起始位置，也不做除法
+	uint32_t base_pos = 0;
+	for (uint32_t i = 0; i < bucket_time; i++) {
+		bucket_base[i] = base_pos;
+		bucket_m[i]    = FastModM(bucket[i]);
+		base_pos += bucket[i];
+	}
+
 	return ;
 }
 
-void MemHash::NodeInit() 
+int MemHash::LayoutOld(int fd, uint32_t version, struct layout_info& layout)
 {
-	int node_count = 0;
-	
-	for (uint32_t i = 0; i < bucket_time; i++) {
-		node_count += bucket[i];
+	memset(&layout, 0, sizeof(layout));
+
+	if (version < 6)
+		return 0;
+
+	//布局决定文件大小，mmap之前读取有效的一份并效验
+	struct mem_head_ext tmp_ext;
+	size_t len = offsetof(struct mem_head_ext, migrate_cursor);
+	int ret = pread(fd, &tmp_ext, len,
+			sizeof(struct mem_barrier) + sizeof(struct mem_head));
+	if (ret != (int)len)
+		return -1;
+
+	uint32_t slot = tmp_ext.layout_slot;
+	if (slot > 1)
+		return -1;
+	uint32_t crc32_check = Crc32Head((char *)&tmp_ext.layout_[slot],
+					 sizeof(tmp_ext.layout_[slot]));
+	if (crc32_check != tmp_ext.crc32_layout[slot])
+		return -1;
+
+	layout = tmp_ext.layout_[slot];
+	return 0;
+}
+
+void MemHash::LayoutFill(struct layout_info& layout)
+{
+	memset(&layout, 0, sizeof(layout));
+
+	layout.grow_count  = layout_info_.grow_count;
+	layout.bucket_time = bucket_time;
+	layout.bucket_len  = bucket_len;
+	layout.fp_num      = fp_ != NULL ? max_node : 0;
+	layout.node_offset = (char *)node_ - mem_base;
+	if (old_node_ != NULL) {
+		layout.old_bucket_time = old_bucket_time_;
+		layout.old_bucket_len  = old_bucket_len_;
+		layout.old_node_offset = (char *)old_node_ - mem_base;
 	}
 
-	this->max_node = node_count;	
+	layout.class_info_.class_num = class_num_;
+	for (uint32_t i = 0; i < class_num_; i++) {
+		layout.class_info_.data_size[i] = classes_[i].data_size;
+		layout.class_info_.count[i]     = classes_[i].count;
+		layout.class_offset[i]          = classes_[i].base - mem_base;
+	}
+	layout.total_size = total_size;
 
 	return ;
 }
 
-void MemHash::BlockInit(uint32_t max_block)
+void MemHash::LayoutWrite(const struct layout_info& layout)
 {
-	this->max_block = max_block;
+	//先写不在使用的一份并落地，再切换
+	uint32_t slot = 1 - head_ext_->layout_slot;
+	head_ext_->layout_[slot] = layout;
+	head_ext_->crc32_layout[slot] = Crc32Head((char *)&head_ext_->layout_[slot],
+						  sizeof(head_ext_->layout_[slot]));
+	MemSyncHead();
+
+	head_ext_->layout_slot = slot;
+	MemSyncHead();
+	layout_info_ = layout;
 
 	return ;
 }
 
-void MemHash::TotalSizeInit()
+void MemHash::OldZoneInit(uint32_t bucket_time, uint32_t bucket_len)
 {
-	//---|barrier|head|barrier|node zone|barrier|block zone|barrier|---
-	total_size = sizeof(struct mem_barrier) * 1         +
-		     sizeof(struct mem_head)    * 1         +
-		     sizeof(struct mem_barrier) * 1         +
-		     sizeof(struct mem_node)    * max_node  +
-		     sizeof(struct mem_barrier) * 1         +
-		     sizeof(struct mem_block)   * max_block + 
-		     sizeof(struct mem_barrier) * 1;         
+	int ret = GeneratePrimes(old_bucket_, bucket_len, bucket_time);
+	if (bucket_time > MAX_BUCKET_SIZE || ret != (int)bucket_time) {
+		printf("MemHash::OldZoneInit error. "
+		       "old bucket_time[%u] bucket_len[%u]\n", bucket_time, bucket_len);
+		exit(-1);
+	}
+
+	old_bucket_time_ = bucket_time;
+	old_bucket_len_  = bucket_len;
+	old_max_node_    = 0;
+	for (uint32_t i = 0; i < bucket_time; i++) {
+		old_bucket_base_[i] = old_max_node_;
+		old_bucket_m_[i]    = FastModM(old_bucket_[i]);
+		old_max_node_      += old_bucket_[i];
+	}
+	node_total_ = max_node + old_max_node_;
 
 	return ;
 }
 
-void MemHash::MemInitNew()
+char* MemHash::MapFile(int fd)
 {
-	//---|barrier|head|barrier|node zone|barrier|block zone|barrier|---
-	char *p = mem_base;
+	int populate = option_.prefault == PREFAULT_POPULATE ? MAP_POPULATE : 0;
+	if (option_.shared || option_.grow_reserve <= total_size)
+		return (char *)mmap(NULL, total_size, PROT_READ | PROT_WRITE,
+				    MAP_SHARED | populate, fd, 0);
+
+	//预留地址空间，文件映射在开头，扩容时在其后就地映射，mem_base不变
+	void *reserve = mmap(NULL, option_.grow_reserve, PROT_NONE,
+			     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (reserve == MAP_FAILED)
+		return (char *)MAP_FAILED;
+
+	char *base = (char *)mmap(reserve, total_size, PROT_READ | PROT_WRITE,
+				  MAP_SHARED | MAP_FIXED | populate, fd, 0);
+	if (base == MAP_FAILED) {
+		munmap(reserve, option_.grow_reserve);
+		return base;
+	}
 
-	struct mem_barrier tmp_barrier;
-	memcpy(tmp_barrier.barrier, "MEMHASHZ", 8);
+	reserve_size_ = option_.grow_reserve;
+	grow_fd_      = dup(fd);
+	return base;
+}
 
-	//barrier
-	memcpy(p, &tmp_barrier, sizeof(struct mem_barrier));
-	p += sizeof(struct mem_barrier);
+void MemHash::MapSetup()
+{
+	//先按NODE区域的策略处理整个映射，再处理各级BLOCK，未扩容时BLOCK区域在文件末尾
+	ZoneAdvise(mem_base, total_size, option_.node_numa_policy,
+		   option_.node_numa_mask);
+	for (uint32_t i = 0; i < class_num_; i++)
+		ZoneAdvise(mem_base + ClassOffset(i),
+			   (size_t)classes_[i].stride * classes_[i].count,
+			   option_.block_numa_policy, option_.block_numa_mask);
+
+	//NUMA策略设置之后再预取，页按策略分配
+	if (option_.prefault == PREFAULT_PARALLEL)
+		Prefault(mem_base, total_size);
 
-	//head
-	head_ = (struct mem_head *)p;	
-	memset(head_, 0, sizeof(struct mem_head));
-	head_->head_info_.bucket_time = bucket_time;
-	head_->head_info_.bucket_len  = bucket_len;
-	head_->head_info_.max_block   = max_block;
-	//计算crc32用于下次使用时效验
-	head_->crc32_head_info = Crc32Compute((char *)(&head_->head_info_),
-					      sizeof(head_->head_info_));
-	head_->free_block_pos   = 0;
-	head_->node_used        = 0;
-	head_->block_used       = 0;
+	int ret = 0;
+	if (mlock_open_flag == OPEN_MLOCK)
+		ret = mlock(mem_base, total_size);
+	else if (mlock_open_flag == NODE_MLOCK)
+		ret = MlockNodeZone();
+	if (ret == -1) {
+		printf("MemHash::MapSetup mlock error[%d]. %s\n",
+				errno, strerror(errno));
+		exit(-1);
+	}
 
-	//barrier
-	p += sizeof(struct mem_head);
-	memcpy(p, &tmp_barrier, sizeof(struct mem_barrier));
-	p += sizeof(struct mem_barrier);
+	return ;
+}
 
-	//node zone
-	node_ = (struct mem_node *)p;
-	struct mem_node *tmp_node = node_;
-	for (uint32_t i = 0; i < max_node; i++) {
-		memset(tmp_node, 0, sizeof(struct mem_node));
-		tmp_node->pos = -1;
-		tmp_node++;
-	}		
+size_t MemHash::ClassOffset(uint32_t cls)
+{
+	if (classes_[cls].offset != 0)
+		return classes_[cls].offset;
+
+	//未扩容时BLOCK区域在文件末尾，没有单独偏移量的级别依次排列
+	size_t offset = layout_info_.grow_count != 0 ?
+			layout_info_.class_offset[0] :
+			total_size - sizeof(struct mem_barrier) - block_zone_size;
+	for (uint32_t i = 0; i < cls; i++) {
+		if (classes_[i].offset == 0)
+			offset += (size_t)classes_[i].stride * classes_[i].count;
+	}
 
-	//barrier
-	p += sizeof(struct mem_node) * max_node;
-	memcpy(p, &tmp_barrier, sizeof(struct mem_barrier));
-	p += sizeof(struct mem_barrier);
+	return offset;
+}
 
-	//block zone
-	block_ = (struct mem_block *)p;
-	struct mem_block *tmp_block = block_;
-	for (uint32_t i = 0; i < max_block; i++) {
-		memset(tmp_block, 0, sizeof(struct mem_block));
-		tmp_block->pos = i + 1;
-		tmp_block++;
+int MemHash::MlockNodeZone()
+{
+	//各级BLOCK按位置排序，向内取整到页，锁定它们之间的部分（头部、NODE区域、
+	//指纹数组），与NODE区域共用的页也被锁定
+	size_t page = sysconf(_SC_PAGESIZE);
+	size_t begin[MAX_BLOCK_CLASS], end[MAX_BLOCK_CLASS];
+	for (uint32_t i = 0; i < class_num_; i++) {
+		size_t b = ClassOffset(i);
+		size_t e = b + (size_t)classes_[i].stride * classes_[i].count;
+		b = (b + page - 1) & ~(page - 1);
+		e = e & ~(page - 1);
+		uint32_t j = i;
+		for (; j > 0 && begin[j - 1] > b; j--) {
+			begin[j] = begin[j - 1];
+			end[j]   = end[j - 1];
+		}
+		begin[j] = b;
+		end[j]   = e > b ? e : b;
 	}
 
-	//barrier
-	p += sizeof(struct mem_block) * max_block;
-	memcpy(p, &tmp_barrier, sizeof(struct mem_barrier));
+	size_t pos = 0;
+	for (uint32_t i = 0; i <= class_num_; i++) {
+		size_t lock_end = i < class_num_ ? begin[i] : total_size;
+		if (lock_end > pos && mlock(mem_base + pos, lock_end - pos) == -1)
+			return -1;
+		if (i < class_num_ && end[i] > pos)
+			pos = end[i];
+	}
 
-	return ;
+	return 0;
 }
 
-void MemHash::MemInitOld()
+void MemHash::ZoneAdvise(char* p, size_t len, int numa_policy,
+			 uint64_t numa_mask)
 {
-	char *p = mem_base;
+	//madvise、mbind要求页对齐
+	size_t page = sysconf(_SC_PAGESIZE);
+	char *begin = (char *)((uintptr_t)p & ~(uintptr_t)(page - 1));
+	len = (p + len - begin + page - 1) & ~(page - 1);
+	if (len == 0)
+		return ;
 
-	//效验barrier
-	CheckBarrier(p);
-	p += sizeof(struct mem_barrier);
+	//大页、访问方式、NUMA策略只是提示，失败时继续使用普通页及默认策略
+	if (option_.huge_page && madvise(begin, len, MADV_HUGEPAGE) == -1)
+		LOG_WARN("MemHash::ZoneAdvise madvise error[%d]. %s",
+		    errno, strerror(errno));
+	if (option_.random_access && madvise(begin, len, MADV_RANDOM) == -1)
+		LOG_WARN("MemHash::ZoneAdvise madvise error[%d]. %s",
+		    errno, strerror(errno));
 
-	//效验head
-	head_ = (struct mem_head *)p;	
-	CheckHead();
-	p += sizeof(struct mem_head);
+	if (numa_policy == NUMA_POLICY_DEFAULT)
+		return ;
 
-	//效验barrier
-	CheckBarrier(p);
-	p += sizeof(struct mem_barrier);
+	unsigned long mask = numa_mask;
+	if (mask == 0 && syscall(SYS_get_mempolicy, NULL, &mask,
+				 sizeof(mask) * 8 + 1, NULL,
+				 MPOL_F_MEMS_ALLOWED_) == -1) {
+		LOG_WARN("MemHash::ZoneAdvise get_mempolicy error[%d]. %s",
+		    errno, strerror(errno));
+		return ;
+	}
+	//已经在其他节点上的页（MAP_POPULATE、旧文件的页缓存）按策略迁移
+	int mode = numa_policy == NUMA_POLICY_BIND ? MPOL_BIND_ : MPOL_INTERLEAVE_;
+	if (syscall(SYS_mbind, begin, len, mode, &mask, sizeof(mask) * 8 + 1,
+		    MPOL_MF_MOVE_) == -1)
+		LOG_WARN("MemHash::ZoneAdvise mbind error[%d]. %s",
+		    errno, strerror(errno));
 
-	node_ = (struct mem_node *)p;
-	p += sizeof(struct mem_node) * max_node;
+	return ;
+}
 
-	//效验barrier
-	CheckBarrier(p);
-	p += sizeof(struct mem_barrier);
+void MemHash::Prefault(char* p, size_t len)
+{
+	uint32_t thread_num = option_.prefault_threads;
+	if (thread_num == 0)
+		thread_num = sysconf(_SC_NPROCESSORS_ONLN);
+	if (thread_num == 0)
+		thread_num = 1;
+	if (thread_num > MAX_RECOVER_THREADS)
+		thread_num = MAX_RECOVER_THREADS;
+
+	//按大页大小切分，每个线程处理连续的一段，第0段在当前线程执行
+	size_t step = (len / thread_num + PREFAULT_ALIGN - 1) & ~(PREFAULT_ALIGN - 1);
+	struct prefault_task tasks[MAX_RECOVER_THREADS];
+	uint32_t task_num = 0;
+	for (size_t off = 0; off < len && task_num < thread_num; off += step) {
+		tasks[task_num].begin = p + off;
+		tasks[task_num].len   = len - off < step ? len - off : step;
+		task_num++;
+	}
 
-	block_ = (struct mem_block *)p;
-	p += sizeof(struct mem_block) * max_block;
+	for (uint32_t i = 1; i < task_num; i++) {
+		int ret = pthread_create(&tasks[i].tid, NULL, PrefaultWorker,
+					 &tasks[i]);
+		if (ret != 0) {
+			//线程创建失败时在当前线程处理
+			LOG_WARN("MemHash::Prefault pthread_create error[%d]. %s",
+			    ret, strerror(ret));
+			tasks[i].tid = 0;
+			PrefaultWorker(&tasks[i]);
+		}
+	}
 
-	//效验barrier
-	CheckBarrier(p);
+	PrefaultWorker(&tasks[0]);
 
-	//清除所有BLOCK使用标志位
-	ClearBlockUsedFlag();
-	//效验NODE和BLOCK节点
-	CheckNodeBlock();
-	//恢复BLOCK节点
-	RecoverBlock();
+	for (uint32_t i = 1; i < task_num; i++) {
+		if (tasks[i].tid != 0)
+			pthread_join(tasks[i].tid, NULL);
+	}
 
 	return ;
 }
 
-void MemHash::CheckBarrier(char* barrier)
+void MemHash::NodeInit(const struct node_info& info) 
 {
-	int ret = strncmp(barrier, "MEMHASHZ", 8);
-	if (ret != 0) {
-		printf("MemHash::CheckBarrier  error.\n"); 
-		exit(-1);
+	int node_count = 0;
+	
+	for (uint32_t i = 0; i < bucket_time; i++) {
+		node_count += bucket[i];
 	}
+
+	this->max_node = node_count;	
+	this->node_total_ = node_count;
+	this->inline_size = info.inline_size;
+	this->node_size   = sizeof(struct mem_node) + info.inline_size;
+
+	return ;
 }
 
-void MemHash::CheckHead()
+void MemHash::NodeInfoNew(struct node_info& info)
 {
-	uint32_t crc32_check = 0;
+	memset(&info, 0, sizeof(info));
 
-	//crc32头部效验
-	crc32_check = Crc32Compute((char *)&head_->head_info_,
-				   sizeof(head_->head_info_));
-	if (crc32_check != head_->crc32_head_info) {
-		printf("MemHash::CheckHead  error.\n"); 
+	if (option_.inline_size > MAX_INLINE_SIZE) {
+		printf("MemHash::NodeInfoNew error. "
+		       "inline_size > MAX_INLINE_SIZE[%u]\n", MAX_INLINE_SIZE);
 		exit(-1);
 	}
+
+	//保持NODE节点8字节对齐
+	info.inline_size = (option_.inline_size + 7) & ~7U;
+
+	return ;
 }
 
-void MemHash::ClearBlockUsedFlag()
+void MemHash::NodeInfoOld(int fd, uint32_t version, struct node_info& info)
 {
-	//初始化head中BLOCK节点使用情况
-	head_->free_block_pos = -1;
-	head_->node_used      =  0;
-	head_->block_used     =  0;
+	memset(&info, 0, sizeof(info));
 
-	//重置BLOCK节点使用标志位
-	struct mem_block *tmp_block = block_;
-	for (uint32_t i = 0; i < max_block; i++) {
-		tmp_block = GetBlock(i);
-		CLR_BLOCK_USED_FLAG(tmp_block->flag);
+	if (version < 4)
+		return ;
+
+	//NODE节点布局决定文件布局，mmap之前读取并效验
+	struct {
+		uint32_t crc32_node_info;
+		struct   node_info node_info_;
+	} tmp;
+	int ret = pread(fd, &tmp, sizeof(tmp),
+			sizeof(struct mem_barrier) + sizeof(struct mem_head) +
+			offsetof(struct mem_head_ext, crc32_node_info));
+	if (ret != (int)sizeof(tmp)) {
+		printf("MemHash::NodeInfoOld pread error[%d]. %s\n",
+				errno, strerror(errno));
+		exit(-1);
 	}
-	
+
+	uint32_t crc32_check = Crc32Head((char *)&tmp.node_info_,
+					 sizeof(tmp.node_info_));
+	if (crc32_check != tmp.crc32_node_info ||
+	    tmp.node_info_.inline_size > MAX_INLINE_SIZE ||
+	    tmp.node_info_.inline_size % 8 != 0) {
+		printf("MemHash::NodeInfoOld  error.\n"); 
+		exit(-1);
+	}
+
+	info = tmp.node_info_;
 	return ;
 }
 
-void MemHash::CheckNodeBlock()
+//指纹区域大小：AVX2 gather按4字节读取，最后一个指纹之后多读2字节
+static size_t FpZoneSize(uint32_t fp_num)
 {
-	struct mem_node *tmp_node = node_;
-	struct mem_block *tmp_block = block_;
+	if (fp_num == 0)
+		return 0;
 
-	for (uint32_t i = 0; i < max_node; i++) {
-		tmp_node = node_ + i;
-		//遍历所有的非空NODE节点
-		if (tmp_node->key != 0) {
-			//该节点使用的BLOCK节点的个数
-			uint32_t nbu = GetNodeBlockUsed(tmp_node->size);
-			//该节点使用的最后一个BLOCK节点的偏移量
-			uint32_t lbu = GetLastBlockUsed(tmp_node->size);
-
-			if (nbu > MAX_BLOCK_NUM) {
-				tmp_node-> key = 0;
-				tmp_node->crc32 = 0;
-				tmp_node->tval = 0;
-				tmp_node->size = 0;
-				tmp_node->pos = -1;
-				LOG("MemHash::CheckNode error. "
-				    "node block_used > MAX_BLOCK_NUM[%lu]",
-				    MAX_BLOCK_NUM);
-				continue;
-			}
-			
-			tmp_block = GetBlock(tmp_node->pos); 
-			if (tmp_block == NULL) {
-				tmp_node-> key = 0;
-				tmp_node->crc32 = 0;
-				tmp_node->tval = 0;
-				tmp_node->size = 0;
-				tmp_node->pos = -1;
-				LOG("MemHash::CheckNode error. " 
-				    "node.pos < 0 or " 
-				    "node.pos >= max_block[%lu]",
-				    max_block);
-				continue;
-			}
+	return ((size_t)fp_num * sizeof(uint16_t) + 2 + CACHE_LINE_SIZE - 1) &
+	       ~(size_t)(CACHE_LINE_SIZE - 1);
+}
 
-			uint32_t crc32buf = 0;
-			//前n-1个BLOCK节点crc32叠加
-			for (uint32_t j = 0; j < nbu - 1; j++) {
-				crc32buf = Crc32Append(crc32buf,
-						tmp_block->data,
-						BLOCK_DATA_SIZE);
-				tmp_block = GetBlock(tmp_block->pos);
-				if (tmp_block == NULL) {
-					tmp_node-> key = 0;
-					tmp_node->crc32 = 0;
-					tmp_node->tval = 0;
-					tmp_node->size = 0;
-					tmp_node->pos = -1;
-					LOG("MemHash::CheckNode error. " 
-					    "node.pos < 0 or " 
-					    "node.pos >= max_block[%lu]",
-					    max_block);
-					break;
-				}
-			} 
+void MemHash::FpInit(const struct fp_info& info)
+{
+	fp_zone_size = FpZoneSize(info.fp_num);
 
-			if (tmp_block == NULL)
-				continue;
-			
-			if (tmp_block->pos != -1) {
-				tmp_node-> key = 0;
-				tmp_node->crc32 = 0;
-				tmp_node->tval = 0;
-				tmp_node->size = 0;
-				tmp_node->pos = -1;
-				LOG("MemHash::CheckNode error. "
-				    "last block pos != -1");
-				continue;
-			}
+	fp_avx2_ = 0;
+#ifdef MEM_HASH_X86
+	if (info.fp_num != 0 && __builtin_cpu_supports("avx2"))
+		fp_avx2_ = 1;
+#endif
 
-			//最后一个BLOCK节点crc32叠加
-			crc32buf = Crc32Append(crc32buf,
-					tmp_block->data,
-					lbu);
-			
-			//效验crc32
-			if (crc32buf != tmp_node->crc32) {
-				tmp_node-> key = 0;
-				tmp_node->crc32 = 0;
-				tmp_node->tval = 0;
-				tmp_node->size = 0;
-				tmp_node->pos = -1;
-				LOG("MemHash::CheckNode error. " 
-				    "node.crc32 check error.");
+	return ;
+}
+
+void MemHash::FpInfoNew(struct fp_info& info)
+{
+	memset(&info, 0, sizeof(info));
+
+	if (option_.fingerprint)
+		info.fp_num = max_node;
+
+	return ;
+}
+
+void MemHash::FpInfoOld(int fd, uint32_t version, struct fp_info& info)
+{
+	memset(&info, 0, sizeof(info));
+
+	if (version < 5)
+		return ;
+
+	//指纹数组决定文件布局，mmap之前读取并效验
+	struct {
+		uint32_t crc32_fp_info;
+		struct   fp_info fp_info_;
+	} tmp;
+	int ret = pread(fd, &tmp, sizeof(tmp),
+			sizeof(struct mem_barrier) + sizeof(struct mem_head) +
+			offsetof(struct mem_head_ext, crc32_fp_info));
+	if (ret != (int)sizeof(tmp)) {
+		printf("MemHash::FpInfoOld pread error[%d]. %s\n",
+				errno, strerror(errno));
+		exit(-1);
+	}
+
+	uint32_t crc32_check = Crc32Head((char *)&tmp.fp_info_,
+					 sizeof(tmp.fp_info_));
+	if (crc32_check != tmp.crc32_fp_info ||
+	    (tmp.fp_info_.fp_num != 0 && tmp.fp_info_.fp_num != max_node)) {
+		printf("MemHash::FpInfoOld  error.\n"); 
+		exit(-1);
+	}
+
+	info = tmp.fp_info_;
+	return ;
+}
+
+void MemHash::BlockInit(const struct class_info& info)
+{
+	max_block       = 0;
+	block_zone_size = 0;
+	class_num_      = info.class_num;
+
+	//各级依次排列在BLOCK区域中
+	for (uint32_t i = 0; i < class_num_; i++) {
+		struct block_class *cls = &classes_[i];
+		cls->data_size = info.data_size[i];
+		cls->stride    = offsetof(struct mem_block, data) + cls->data_size;
+		cls->count     = info.count[i];
+		cls->first     = max_block;
+		cls->offset    = 0;
+		cls->base      = NULL;
+		cls->free_pos  = NULL;
+		cls->used      = NULL;
+		max_block       += cls->count;
+		block_zone_size += (size_t)cls->stride * cls->count;
+	}
+
+	return ;
+}
+
+void MemHash::BlockClassNew(uint32_t max_block, struct class_info& info)
+{
+	memset(&info, 0, sizeof(info));
+
+	//默认只有一级，与旧格式文件相同
+	if (option_.block_classes == 0) {
+		info.class_num    = 1;
+		info.data_size[0] = BLOCK_DATA_SIZE;
+		info.count[0]     = max_block;
+		return ;
+	}
+
+	if (option_.block_classes > MAX_BLOCK_CLASS) {
+		printf("MemHash::BlockClassNew error. "
+		       "block_classes > MAX_BLOCK_CLASS[%u]\n", MAX_BLOCK_CLASS);
+		exit(-1);
+	}
+
+	info.class_num = option_.block_classes;
+	for (uint32_t i = 0; i < info.class_num; i++) {
+		uint32_t size  = option_.block_class_size[i];
+		uint32_t count = option_.block_class_count[i];
+		if (size == 0 || size % 8 != 0 || size > BLOCK_INDEX_MASK ||
+		    count == 0 || count > BLOCK_INDEX_MASK) {
+			printf("MemHash::BlockClassNew error. "
+			       "class[%u] size[%u] count[%u]\n", i, size, count);
+			exit(-1);
+		}
+		info.data_size[i] = size;
+		info.count[i]     = count;
+	}
+
+	return ;
+}
+
+void MemHash::BlockClassOld(int fd, uint32_t version, uint32_t max_block,
+			    struct class_info& info)
+{
+	memset(&info, 0, sizeof(info));
+
+	if (version < 3) {
+		info.class_num    = 1;
+		info.data_size[0] = BLOCK_DATA_SIZE;
+		info.count[0]     = max_block;
+		return ;
+	}
+
+	//BLOCK分级决定文件布局，mmap之前读取并效验
+	struct {
+		uint32_t crc32_class_info;
+		struct   class_info class_info_;
+	} tmp;
+	int ret = pread(fd, &tmp, sizeof(tmp),
+			sizeof(struct mem_barrier) + sizeof(struct mem_head) +
+			offsetof(struct mem_head_ext, crc32_class_info));
+	if (ret != (int)sizeof(tmp)) {
+		printf("MemHash::BlockClassOld pread error[%d]. %s\n",
+				errno, strerror(errno));
+		exit(-1);
+	}
+
+	uint32_t crc32_check = Crc32Head((char *)&tmp.class_info_,
+					 sizeof(tmp.class_info_));
+	if (crc32_check != tmp.crc32_class_info ||
+	    tmp.class_info_.class_num == 0 ||
+	    tmp.class_info_.class_num > MAX_BLOCK_CLASS) {
+		printf("MemHash::BlockClassOld  error.\n"); 
+		exit(-1);
+	}
+
+	info = tmp.class_info_;
+	return ;
+}
+
+void MemHash::BlockClassBind()
+{
+	char *p = (char *)block_;
+	for (uint32_t i = 0; i < class_num_; i++) {
+		struct block_class *cls = &classes_[i];
+		if (cls->offset != 0) {
+			cls->base = mem_base + cls->offset;
+		} else {
+			cls->base = p;
+			p += (size_t)cls->stride * cls->count;
+		}
+
+		//版本3之前只有一级，使用mem_head中的空闲队列
+		if (head_ext_ == &legacy_ext_ || head_ext_->ext_info_.version < 3) {
+			cls->free_pos = &head_->free_block_pos;
+			cls->used     = &head_->block_used;
+		} else {
+			cls->free_pos = &head_ext_->class_free_pos[i];
+			cls->used     = &head_ext_->class_block_used[i];
+		}
+	}
+
+	return ;
+}
+
+void MemHash::HeadExtInit(uint32_t version)
+{
+	if (version == 0) {
+		head_ext_size = 0;
+		return ;
+	}
+
+	//版本1的扩展头部到clean_shutdown为止，版本2到进程间锁为止，版本3到BLOCK分级为止
+	//版本4到NODE内联信息为止，版本5到指纹信息为止，版本6到迁移进度为止
+	size_t ext_len = sizeof(struct mem_head_ext);
+	if (version == 1)
+		ext_len = offsetof(struct mem_head_ext, lock_stripes);
+	else if (version == 2)
+		ext_len = offsetof(struct mem_head_ext, crc32_class_info);
+	else if (version == 3)
+		ext_len = offsetof(struct mem_head_ext, crc32_node_info);
+	else if (version == 4)
+		ext_len = offsetof(struct mem_head_ext, crc32_fp_info);
+	else if (version == 5)
+		ext_len = offsetof(struct mem_head_ext, layout_slot);
+	else if (version == 6)
+		ext_len = offsetof(struct mem_head_ext, tval_ms);
+
+	//扩展头部补齐，使NODE区域按cache line对齐
+	size_t head_len = sizeof(struct mem_barrier) * 2 +
+			  sizeof(struct mem_head)        +
+			  ext_len;
+	head_ext_size = ext_len +
+			(CACHE_LINE_SIZE - head_len % CACHE_LINE_SIZE) %
+			CACHE_LINE_SIZE;
+
+	return ;
+}
+
+void MemHash::TotalSizeInit()
+{
+	//---|barrier|head|head ext|barrier|node zone|fp zone|barrier|block zone|barrier|---
+	total_size = sizeof(struct mem_barrier) * 1         +
+		     sizeof(struct mem_head)    * 1         +
+		     head_ext_size                          +
+		     sizeof(struct mem_barrier) * 1         +
+		     node_size                  * max_node  +
+		     fp_zone_size                           +
+		     sizeof(struct mem_barrier) * 1         +
+		     block_zone_size                        + 
+		     sizeof(struct mem_barrier) * 1;         
+
+	return ;
+}
+
+void MemHash::MemInitNew()
+{
+	//---|barrier|head|barrier|node zone|barrier|block zone|barrier|---
+	char *p = mem_base;
+
+	struct mem_barrier tmp_barrier;
+	memcpy(tmp_barrier.barrier, "MEMHASHZ", 8);
+
+	//barrier
+	memcpy(p, &tmp_barrier, sizeof(struct mem_barrier));
+	p += sizeof(struct mem_barrier);
+
+	//head
+	head_ = (struct mem_head *)p;	
+	memset(head_, 0, sizeof(struct mem_head));
+	head_->head_info_.bucket_time = bucket_time;
+	head_->head_info_.bucket_len  = bucket_len;
+	head_->head_info_.max_block   = max_block;
+	//计算crc32用于下次使用时效验
+	head_->crc32_head_info = Crc32Head((char *)(&head_->head_info_),
+					   sizeof(head_->head_info_));
+	head_->free_block_pos   = 0;
+	head_->node_used        = 0;
+	head_->block_used       = 0;
+	p += sizeof(struct mem_head);
+
+	//head ext，新文件使用crc32c校验数据
+	head_ext_ = (struct mem_head_ext *)p;
+	memset(head_ext_, 0, head_ext_size);
+	memcpy(head_ext_->magic, "MEMHASHX", 8);
+	head_ext_->ext_info_.version  = MEM_HASH_VERSION;
+	head_ext_->ext_info_.crc_type = CRC_TYPE_CRC32C;
+	head_ext_->crc32_ext_info = Crc32Head((char *)(&head_ext_->ext_info_),
+					      sizeof(head_ext_->ext_info_));
+	crc_engine_ = Crc32GetEngine(CRC_TYPE_CRC32C);
+	head_ext_->lock_stripes = option_.lock_stripes;
+	SharedLockInit();
+	for (uint32_t i = 0; i < class_num_; i++) {
+		head_ext_->class_info_.data_size[i] = classes_[i].data_size;
+		head_ext_->class_info_.count[i]     = classes_[i].count;
+	}
+	head_ext_->class_info_.class_num = class_num_;
+	head_ext_->crc32_class_info = Crc32Head((char *)(&head_ext_->class_info_),
+						sizeof(head_ext_->class_info_));
+	//各级的空闲队列在扩展头部，mem_head中的不再使用
+	head_->free_block_pos = -1;
+	head_ext_->node_info_.inline_size = inline_size;
+	head_ext_->crc32_node_info = Crc32Head((char *)(&head_ext_->node_info_),
+					       sizeof(head_ext_->node_info_));
+	head_ext_->fp_info_.fp_num = fp_zone_size != 0 ? max_node : 0;
+	head_ext_->crc32_fp_info = Crc32Head((char *)(&head_ext_->fp_info_),
+					     sizeof(head_ext_->fp_info_));
+	head_ext_->tval_ms = 1;
+	tval_ms_ = 1;
+	p += head_ext_size;
+
+	//barrier
+	memcpy(p, &tmp_barrier, sizeof(struct mem_barrier));
+	p += sizeof(struct mem_barrier);
+
+	//node zone
+	node_ = (struct mem_node *)p;
+	struct mem_node *tmp_node = node_;
+	for (uint32_t i = 0; i < max_node; i++) {
+		tmp_node = NodeAt(i);
+		memset(tmp_node, 0, node_size);
+		tmp_node->pos = -1;
+	}		
+
+	p += node_size * max_node;
+
+	//fp zone，空节点的指纹为0
+	if (fp_zone_size != 0) {
+		fp_ = (uint16_t *)p;
+		memset(fp_, 0, fp_zone_size);
+		p += fp_zone_size;
+	}
+
+	//barrier
+	memcpy(p, &tmp_barrier, sizeof(struct mem_barrier));
+	p += sizeof(struct mem_barrier);
+
+	//block zone，每一级串成一个空闲队列
+	block_ = (struct mem_block *)p;
+	BlockClassBind();
+	for (uint32_t i = 0; i < class_num_; i++) {
+		struct block_class *cls = &classes_[i];
+		memset(cls->base, 0, (size_t)cls->stride * cls->count);
+		for (uint32_t j = 0; j < cls->count; j++) {
+			struct mem_block *tmp_block = GetBlock(
+					(i << BLOCK_CLASS_SHIFT) | j);
+			if (j == cls->count - 1)
+				tmp_block->pos = -1;
+			else
+				tmp_block->pos = (i << BLOCK_CLASS_SHIFT) | (j + 1);
+		}
+		*cls->free_pos = i << BLOCK_CLASS_SHIFT;
+		*cls->used     = 0;
+	}
+
+	//barrier
+	p += block_zone_size;
+	memcpy(p, &tmp_barrier, sizeof(struct mem_barrier));
+
+	//记录当前布局，扩容时在此基础上修改
+	LayoutFill(head_ext_->layout_[0]);
+	head_ext_->crc32_layout[0] = Crc32Head((char *)(&head_ext_->layout_[0]),
+					       sizeof(head_ext_->layout_[0]));
+	head_ext_->layout_slot    = 0;
+	head_ext_->migrate_cursor = 0;
+	layout_info_ = head_ext_->layout_[0];
+
+	return ;
+}
+
+void MemHash::MemInitOld()
+{
+	char *p = mem_base;
+
+	//效验barrier
+	CheckBarrier(p);
+	p += sizeof(struct mem_barrier);
+
+	//效验head
+	head_ = (struct mem_head *)p;	
+	p += sizeof(struct mem_head);
+	if (head_ext_size != 0)
+		head_ext_ = (struct mem_head_ext *)p;
+	else
+		head_ext_ = &legacy_ext_;
+	CheckHead();
+	p += head_ext_size;
+	//版本7之前的文件NODE时间为秒
+	tval_ms_ = head_ext_ != &legacy_ext_ &&
+		   head_ext_->ext_info_.version >= 7 && head_ext_->tval_ms != 0;
+
+	//效验barrier
+	CheckBarrier(p);
+	p += sizeof(struct mem_barrier);
+
+	if (layout_info_.grow_count != 0) {
+		//扩容过的文件NODE区域及各级BLOCK的位置由布局决定，NODE区域之前是barrier
+		node_ = (struct mem_node *)(mem_base + layout_info_.node_offset);
+		CheckBarrier((char *)node_ - sizeof(struct mem_barrier));
+		if (fp_zone_size != 0)
+			fp_ = (uint16_t *)((char *)node_ + node_size * max_node);
+		if (layout_info_.old_node_offset != 0)
+			old_node_ = (struct mem_node *)(mem_base +
+							layout_info_.old_node_offset);
+		block_ = (struct mem_block *)(mem_base + layout_info_.class_offset[0]);
+		BlockClassBind();
+		CheckBarrier(mem_base + total_size - sizeof(struct mem_barrier));
+	} else {
+		node_ = (struct mem_node *)p;
+		p += node_size * max_node;
+
+		if (fp_zone_size != 0)
+			fp_ = (uint16_t *)p;
+		p += fp_zone_size;
+
+		//效验barrier
+		CheckBarrier(p);
+		p += sizeof(struct mem_barrier);
+
+		block_ = (struct mem_block *)p;
+		BlockClassBind();
+		p += block_zone_size;
+
+		//效验barrier
+		CheckBarrier(p);
+	}
+
+	//共享模式下其他进程正在使用，直接挂接
+	if (option_.shared && !shared_first_) {
+		open_stat_.path = OPEN_PATH_ATTACH;
+		return ;
+	}
+
+	//第一个打开的进程重新初始化进程间锁，之前崩溃进程留下的状态不再有效
+	if (option_.shared)
+		SharedLockInit();
+
+	//上次正常关闭，head中的空闲队列和使用统计可以直接使用
+	if (head_ext_->clean_shutdown == CLEAN_SHUTDOWN) {
+		open_stat_.path = OPEN_PATH_CLEAN;
+	} else if (option_.recover_mode == RECOVER_MODE_LAZY) {
+		//NODE节点在第一次访问时效验，其余交给后台线程
+		LazyInit();
+		open_stat_.path = OPEN_PATH_LAZY;
+	} else {
+		//恢复NODE和BLOCK节点
+		Recover();
+		open_stat_.path = OPEN_PATH_FULL;
+		open_stat_.recover_threads = option_.recover_threads;
+	}
+
+	//清除标记并落地，之后崩溃的话下次打开需要完整恢复
+	//恢复后崩溃进程遗留的BLOCK已回收
+	if (head_ext_ != &legacy_ext_) {
+		if (head_ext_->ext_info_.version >= 2)
+			head_ext_->owner_dead = 0;
+		head_ext_->clean_shutdown = 0;
+		MemSyncHead();
+	}
+
+	return ;
+}
+
+void MemHash::CheckBarrier(char* barrier)
+{
+	int ret = strncmp(barrier, "MEMHASHZ", 8);
+	if (ret != 0) {
+		printf("MemHash::CheckBarrier  error.\n"); 
+		exit(-1);
+	}
+}
+
+void MemHash::CheckHead()
+{
+	uint32_t crc32_check = 0;
+
+	//crc32头部效验
+	crc32_check = Crc32Head((char *)&head_->head_info_,
+				sizeof(head_->head_info_));
+	if (crc32_check != head_->crc32_head_info) {
+		printf("MemHash::CheckHead  error.\n"); 
+		exit(-1);
+	}
+
+	//旧格式文件没有扩展头部，沿用旧的crc32算法
+	if (head_ext_ == &legacy_ext_) {
+		if (option_.shared) {
+			printf("MemHash::CheckHead  error. "
+			       "file does not support shared mode\n"); 
+			exit(-1);
+		}
+		crc_engine_ = Crc32GetEngine(CRC_TYPE_LEGACY);
+		return ;
+	}
+
+	crc32_check = Crc32Head((char *)&head_ext_->ext_info_,
+				sizeof(head_ext_->ext_info_));
+	if (crc32_check != head_ext_->crc32_ext_info) {
+		printf("MemHash::CheckHead  ext error.\n"); 
+		exit(-1);
+	}
+
+	if (head_ext_->ext_info_.version > MEM_HASH_VERSION) {
+		printf("MemHash::CheckHead  error. version[%u] > [%u]\n",
+				head_ext_->ext_info_.version, MEM_HASH_VERSION); 
+		exit(-1);
+	}
+
+	crc_engine_ = Crc32GetEngine(head_ext_->ext_info_.crc_type);
+	if (crc_engine_ == NULL) {
+		printf("MemHash::CheckHead  error. unknown crc_type[%u]\n",
+				head_ext_->ext_info_.crc_type); 
+		exit(-1);
+	}
+
+	if (!option_.shared)
+		return ;
+
+	//共享模式需要版本2以上的扩展头部中的进程间锁
+	if (head_ext_->ext_info_.version < 2 ||
+	    head_ext_->lock_stripes == 0 ||
+	    head_ext_->lock_stripes > MAX_LOCK_STRIPES) {
+		printf("MemHash::CheckHead  error. "
+		       "file does not support shared mode\n"); 
+		exit(-1);
+	}
+}
+
+int MemHash::HeadExtVersion(int fd, uint32_t& version)
+{
+	//旧格式文件mem_head之后紧跟barrier，新格式文件为扩展头部
+	size_t len = offsetof(struct mem_head_ext, clean_shutdown);
+	struct mem_head_ext tmp_ext;
+	int ret = pread(fd, &tmp_ext, len,
+			sizeof(struct mem_barrier) + sizeof(struct mem_head));
+	if (ret != (int)len)
+		return -1;
+
+	if (strncmp(tmp_ext.magic, "MEMHASHZ", 8) == 0) {
+		version = 0;
+		return 0;
+	}
+
+	//版本的合法性在CheckHead中效验
+	if (strncmp(tmp_ext.magic, "MEMHASHX", 8) == 0) {
+		version = tmp_ext.ext_info_.version;
+		return 0;
+	}
+
+	return -1;
+}
+
+int MemHash::SharedOpen(const char* name)
+{
+	lock_fd_ = open(name, O_RDWR | O_CREAT, 0666);
+	if (lock_fd_ == -1) {
+		printf("MemHash::SharedOpen open error[%d]. %s\n",
+				errno, strerror(errno));
+		exit(-1);
+	}
+
+	//初始化锁保证同一时间只有一个进程在创建、恢复或者关闭文件
+	int ret = FileLock(lock_fd_, FILE_LOCK_INIT, F_WRLCK, 1);
+	if (ret == -1) {
+		printf("MemHash::SharedOpen fcntl error[%d]. %s\n",
+				errno, strerror(errno));
+		exit(-1);
+	}
+
+	//能加上挂接写锁说明没有其他进程在使用
+	shared_first_ = FileLock(lock_fd_, FILE_LOCK_ATTACH, F_WRLCK, 0) == 0;
+
+	struct stat tmp_stat;
+	ret = fstat(lock_fd_, &tmp_stat);
+	if (ret == -1) {
+		printf("MemHash::SharedOpen fstat error[%d]. %s\n",
+				errno, strerror(errno));
+		exit(-1);
+	}
+
+	//刚创建的空文件
+	if (tmp_stat.st_size == 0)
+		return -1;
+
+	return dup(lock_fd_);
+}
+
+void MemHash::SharedOpenDone()
+{
+	//挂接写锁转为读锁，之后其他进程可以挂接
+	int ret = FileLock(lock_fd_, FILE_LOCK_ATTACH, F_RDLCK, 1);
+	if (ret == -1) {
+		printf("MemHash::SharedOpenDone fcntl error[%d]. %s\n",
+				errno, strerror(errno));
+		exit(-1);
+	}
+	FileLock(lock_fd_, FILE_LOCK_INIT, F_UNLCK, 0);
+}
+
+void MemHash::SharedLockInit()
+{
+	//持锁进程崩溃时其他进程得到EOWNERDEAD；同一进程内可重入（Append调用Set）
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+	pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+
+	pthread_mutex_init(&head_ext_->free_lock, &attr);
+	for (uint32_t i = 0; i < MAX_LOCK_STRIPES; i++)
+		pthread_mutex_init(&head_ext_->stripe_lock[i], &attr);
+
+	pthread_mutexattr_destroy(&attr);
+}
+
+void MemHash::LockMutex(pthread_mutex_t* mutex)
+{
+	if (pthread_mutex_lock(mutex) == EOWNERDEAD)
+		RepairMutex(mutex);
+}
+
+int MemHash::TryLockMutex(pthread_mutex_t* mutex)
+{
+	int ret = pthread_mutex_trylock(mutex);
+	if (ret == EOWNERDEAD)
+		RepairMutex(mutex);
+	else if (ret != 0)
+		return -1;
+
+	return 0;
+}
+
+void MemHash::RepairMutex(pthread_mutex_t* mutex)
+{
+	//先修复再标记一致，修复过程中崩溃的话下一个进程会重新修复
+	head_ext_->owner_dead = 1;
+	if (mutex == &head_ext_->free_lock)
+		RepairFreeList();
+	else
+		RepairStripe(mutex - head_ext_->stripe_lock);
+
+	pthread_mutex_consistent(mutex);
+}
+
+void MemHash::RepairStripe(uint32_t stripe)
+{
+	uint32_t repair = 0;
+	uint32_t clear  = 0;
+	MarkAllDirty();
+
+	//崩溃进程正在写的NODE节点seq为奇数，key不为0的节点属于持有该锁的进程；
+	//key为0的（占用或者删除的中途）在持空闲队列锁时产生，由RepairFreeList处理
+	for (uint32_t i = 0; i < max_node; i++) {
+		struct mem_node *tmp_node = NodeAt(i);
+		uint32_t seq = __atomic_load_n(&tmp_node->seq, __ATOMIC_ACQUIRE);
+		uint64_t key = tmp_node->key;
+		if (!(seq & 1) || key == 0 ||
+		    key % head_ext_->lock_stripes != stripe)
+			continue;
+
+		//效验失败的节点被清空，其BLOCK链在下次完整恢复时回收
+		repair++;
+		if (CheckNode(tmp_node) < 0) {
+			__sync_fetch_and_sub(&head_->node_used, 1);
+			clear++;
+		}
+		//崩溃时指纹可能还没有写入
+		SetFingerprint(tmp_node);
+		NodeWriteEnd(tmp_node);
+	}
+
+	LOG("[RepairStripe][%u][repair(%u)][clear(%u)]", stripe, repair, clear);
+}
+
+void MemHash::RepairFreeList()
+{
+	//BLOCK标记位在持空闲队列锁时修改，据此重建空闲队列
+	//崩溃时已标记但没有挂到NODE节点上的BLOCK在下次完整恢复时回收
+	struct recover_task tasks[MAX_RECOVER_THREADS];
+	RebuildFreeList(tasks, option_.recover_threads);
+
+	//崩溃进程占用或者删除到一半的NODE节点：seq为奇数且key为0，清空后结束写，
+	//否则该节点不能再被占用
+	uint32_t clear = 0;
+	for (uint32_t i = 0; i < max_node; i++) {
+		struct mem_node *tmp_node = NodeAt(i);
+		uint32_t seq = __atomic_load_n(&tmp_node->seq, __ATOMIC_ACQUIRE);
+		if (!(seq & 1) || tmp_node->key != 0)
+			continue;
+
+		tmp_node->crc32 = 0;
+		tmp_node->tval  = 0;
+		tmp_node->size  = 0;
+		tmp_node->pos   = -1;
+		SetFingerprint(tmp_node);
+		NodeWriteEnd(tmp_node);
+		clear++;
+	}
+
+	LOG("[RepairFreeList][block_used(%u)][clear(%u)]", BlockUsedNum(), clear);
+}
+
+pthread_mutex_t* MemHash::FreeLock()
+{
+	if (option_.shared)
+		return &head_ext_->free_lock;
+	if (import_active_)
+		return &import_lock_;
+
+	return NULL;
+}
+
+void MemHash::Recover()
+{
+	uint32_t task_num = option_.recover_threads;
+	struct recover_task tasks[MAX_RECOVER_THREADS];
+
+	//初始化head中NODE节点使用情况，BLOCK的使用情况在重建空闲队列时统计
+	head_->node_used = 0;
+
+	//清除所有BLOCK使用标志位
+	for (uint32_t i = 0; i < class_num_; i++)
+		RunRecoverTasks(RECOVER_CLEAR_FLAG, i, classes_[i].count,
+				tasks, task_num);
+
+	//效验NODE和BLOCK节点，合并各区间的统计
+	RunRecoverTasks(RECOVER_CHECK_NODE, 0, node_total_, tasks, task_num);
+	for (uint32_t i = 0; i < task_num; i++)
+		head_->node_used += tasks[i].node_used;
+
+	LOG("[CheckNodeBlock][finish][threads(%u)]", task_num);
+
+	RebuildFreeList(tasks, task_num);
+
+	LOG("[STAT][node_used(%u)]"
+			"[block_used(%u)]", 
+			head_->node_used,
+			BlockUsedNum());
+	return ;
+}
+
+void MemHash::RebuildFreeList(struct recover_task* tasks, uint32_t task_num)
+{
+	MarkAllDirty();
+	for (uint32_t c = 0; c < class_num_; c++) {
+		struct block_class *cls = &classes_[c];
+
+		//各区间分别重建空闲队列，再按区间顺序首尾相连
+		RunRecoverTasks(RECOVER_FREE_BLOCK, c, cls->count, tasks, task_num);
+		uint32_t free_num = 0;
+		*cls->free_pos = -1;
+		struct mem_block *pre_block = NULL;
+		for (uint32_t i = 0; i < task_num; i++) {
+			if (tasks[i].free_head == -1)
+				continue;
+
+			if (pre_block == NULL)
+				*cls->free_pos = tasks[i].free_head;
+			else
+				pre_block->pos = tasks[i].free_head;
+			pre_block = GetBlock(tasks[i].free_tail);
+			free_num += tasks[i].free_num;
+		}
+
+		//最后一个空闲BLOCK节点指向POS置为-1
+		if (pre_block != NULL)
+			pre_block->pos = -1;
+
+		*cls->used = cls->count - free_num;
+	}
+
+	return ;
+}
+
+void MemHash::RunRecoverTasks(int phase, uint32_t cls, uint32_t total,
+			      struct recover_task* tasks, uint32_t task_num)
+{
+	//按区间平均切分，第0个区间在当前线程执行
+	uint32_t step = total / task_num;
+	for (uint32_t i = 0; i < task_num; i++) {
+		memset(&tasks[i], 0, sizeof(struct recover_task));
+		tasks[i].mem   = this;
+		tasks[i].phase = phase;
+		tasks[i].cls   = cls;
+		tasks[i].begin = step * i;
+		tasks[i].end   = (i == task_num - 1) ? total : step * (i + 1);
+	}
+
+	for (uint32_t i = 1; i < task_num; i++) {
+		int ret = pthread_create(&tasks[i].tid, NULL,
+					 RecoverWorker, &tasks[i]);
+		if (ret != 0) {
+			printf("MemHash::RunRecoverTasks pthread_create "
+			       "error[%d]. %s\n", ret, strerror(ret));
+			exit(-1);
+		}
+	}
+
+	RecoverWorker(&tasks[0]);
+
+	for (uint32_t i = 1; i < task_num; i++)
+		pthread_join(tasks[i].tid, NULL);
+
+	return ;
+}
+
+void* MemHash::RecoverWorker(void* arg)
+{
+	struct recover_task *task = (struct recover_task *)arg;
+	MemHash *mem = task->mem;
+
+	switch (task->phase) {
+	case RECOVER_CLEAR_FLAG:
+		mem->ClearBlockUsedFlag(task->cls, task->begin, task->end);
+		break;
+	case RECOVER_CHECK_NODE:
+		mem->CheckNodeBlock(task);
+		break;
+	case RECOVER_FREE_BLOCK:
+		mem->RecoverBlock(task);
+		break;
+	case RECOVER_EXTENT_MAP:
+		mem->ExtentMapBuild(task);
+		break;
+	}
+
+	return NULL;
+}
+
+void MemHash::ClearBlockUsedFlag(uint32_t cls, uint32_t begin, uint32_t end)
+{
+	//重置BLOCK节点使用标志位
+	struct mem_block *tmp_block = block_;
+	for (uint32_t i = begin; i < end; i++) {
+		tmp_block = GetBlock((cls << BLOCK_CLASS_SHIFT) | i);
+		CLR_BLOCK_USED_FLAG(tmp_block->flag);
+	}
+	
+	return ;
+}
+
+void MemHash::CheckNodeBlock(struct recover_task* task)
+{
+	struct mem_node *tmp_node = node_;
+	struct mem_block *tmp_block = block_;
+
+	for (uint32_t i = task->begin; i < task->end; i++) {
+		tmp_node = NodeAt(i);
+		//写到一半崩溃的节点seq为奇数，恢复为偶数
+		tmp_node->seq &= ~1U;
+		//遍历所有的非空NODE节点
+		if (tmp_node->key == 0) {
+			SetFingerprint(tmp_node);
+			continue;
+		}
+
+		int nbu = CheckNode(tmp_node);
+		if (nbu < 0)
+			continue;
+		SetFingerprint(tmp_node);
+
+		//效验成功，将该NODE节点下的所有BLOCK节点标记为已使用
+		tmp_block = GetBlock(tmp_node->pos); 
+		for (int j = 0; j < nbu; j++) {
+			SET_BLOCK_USED_FLAG_ATOMIC(tmp_block->flag);
+			tmp_block = GetBlock(tmp_block->pos);
+		}
+		
+		task->node_used++;
+	}
+	
+	return ;
+}
+
+int MemHash::CheckNode(struct mem_node* node)
+{
+	//内联数据不使用BLOCK节点
+	if (node->pos == INLINE_POS) {
+		if (node->size == 0 || node->size > inline_size ||
+		    Crc32Compute(NodeInline(node), node->size) != node->crc32) {
+			ClearNode(node);
+			LOG_ERROR("MemHash::CheckNode error. inline node check error.");
+			return -1;
+		}
+		return 0;
+	}
+
+	//BLOCK链所在级别的数据区大小
+	uint32_t data_size = BlockDataSize(node->pos);
+	if (data_size == 0) {
+		ClearNode(node);
+		LOG_ERROR("MemHash::CheckNode error. node.pos[%d] invalid", node->pos);
+		return -1;
+	}
+
+	//该节点使用的BLOCK节点的个数
+	uint32_t nbu = GetNodeBlockUsed(node->size, data_size);
+	//该节点使用的最后一个BLOCK节点的偏移量
+	uint32_t lbu = GetLastBlockUsed(node->size, data_size);
+
+	if (nbu == 0 || nbu > MAX_BLOCK_NUM) {
+		ClearNode(node);
+		LOG_ERROR("MemHash::CheckNode error. "
+		    "node block_used > MAX_BLOCK_NUM[%lu]",
+		    MAX_BLOCK_NUM);
+		return -1;
+	}
+	
+	struct mem_block *tmp_block  = GetBlock(node->pos); 
+	struct mem_block *head_block = tmp_block;
+	//BLOCK链是否确实地址连续
+	int contiguous = 1;
+	uint32_t crc32buf = 0;
+	//前n-1个BLOCK节点crc32叠加
+	for (uint32_t j = 0; j < nbu - 1 && tmp_block != NULL; j++) {
+		crc32buf = Crc32Append(crc32buf,
+				tmp_block->data,
+				data_size);
+		if (tmp_block->pos != node->pos + (int32_t)j + 1)
+			contiguous = 0;
+		tmp_block = GetBlock(tmp_block->pos);
+	} 
+
+	if (tmp_block == NULL) {
+		ClearNode(node);
+		LOG_ERROR("MemHash::CheckNode error. " 
+		    "block.pos < 0 or " 
+		    "block.pos out of class");
+		return -1;
+	}
+	
+	if (tmp_block->pos != -1) {
+		ClearNode(node);
+		LOG_ERROR("MemHash::CheckNode error. "
+		    "last block pos != -1");
+		return -1;
+	}
+
+	//最后一个BLOCK节点crc32叠加
+	crc32buf = Crc32Append(crc32buf,
+			tmp_block->data,
+			lbu);
+	
+	//效验crc32
+	if (crc32buf != node->crc32) {
+		ClearNode(node);
+		LOG_ERROR("MemHash::CheckNode error. " 
+		    "node.crc32 check error.");
+		return -1;
+	}
+
+	//连续区段标志与BLOCK链不一致时清除，之后按BLOCK链读取
+	if (!contiguous && GET_BLOCK_EXTENT_FLAG(head_block->flag))
+		CLR_BLOCK_EXTENT_FLAG(head_block->flag);
+
+	return nbu;
+}
+
+void MemHash::ClearNode(struct mem_node* node)
+{
+	node->key   = 0;
+	SetFingerprint(node);
+	node->crc32 = 0;
+	node->tval  = 0;
+	node->size  = 0;
+	node->pos   = -1;
+}
+
+void MemHash::LazyInit()
+{
+	head_->node_used = 0;
+	for (uint32_t i = 0; i < class_num_; i++) {
+		*classes_[i].free_pos = -1;
+		*classes_[i].used     =  0;
+		lazy_free_num_[i]     =  0;
+	}
+
+	node_verified_ = (uint8_t *)calloc(node_total_ / 8 + 1, 1);
+	block_marked_  = (uint8_t *)calloc(max_block / 8 + 1, 1);
+	block_freed_   = (uint8_t *)calloc(max_block / 8 + 1, 1);
+	if (node_verified_ == NULL || block_marked_ == NULL ||
+	    block_freed_ == NULL) {
+		printf("MemHash::LazyInit calloc error.\n");
+		exit(-1);
+	}
+
+	lazy_node_cursor_  = 0;
+	lazy_block_cursor_ = 0;
+	memset(lazy_scan_cursor_, 0, sizeof(lazy_scan_cursor_));
+	lazy_begin_us_     = NowUs();
+	lazy_active_       = 1;
+
+	int ret = pthread_create(&lazy_tid_, NULL, LazyWorker, this);
+	if (ret != 0) {
+		printf("MemHash::LazyInit pthread_create error[%d]. %s\n",
+				ret, strerror(ret));
+		exit(-1);
+	}
+	lazy_started_ = 1;
+
+	return ;
+}
+
+void* MemHash::LazyWorker(void* arg)
+{
+	MemHash *mem = (MemHash *)arg;
+
+	//后台线程使用最低的调度优先级
+	struct sched_param param;
+	memset(&param, 0, sizeof(param));
+	pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+
+	int more = 1;
+	while (more && !__atomic_load_n(&mem->lazy_stop_, __ATOMIC_ACQUIRE)) {
+		pthread_mutex_lock(&mem->op_lock_);
+		more = mem->lazy_active_ ? mem->LazyStep() : 0;
+		pthread_mutex_unlock(&mem->op_lock_);
+	}
+
+	return NULL;
+}
+
+int MemHash::LazyStep()
+{
+	MarkAllDirty();
+	//第一阶段：效验还没有被访问过的NODE节点
+	if (lazy_node_cursor_ < node_total_) {
+		uint32_t end = lazy_node_cursor_ + LAZY_STEP_SIZE;
+		if (end > node_total_)
+			end = node_total_;
+		for (uint32_t i = lazy_node_cursor_; i < end; i++) {
+			if (NodeAt(i)->key != 0)
+				LazyVerify(i);
+		}
+		lazy_node_cursor_ = end;
+		return 1;
+	}
+
+	//第二阶段：根据标记逐段重建BLOCK空闲队列
+	if (lazy_block_cursor_ < max_block) {
+		uint32_t end = lazy_block_cursor_ + LAZY_STEP_SIZE;
+		if (end > max_block)
+			end = max_block;
+		for (uint32_t i = lazy_block_cursor_; i < end; i++) {
+			//第一阶段已放入空闲队列的BLOCK（可能已被分配）已经计数
+			if (BITMAP_GET(block_freed_, i))
+				continue;
+			int32_t pos = BlockPos(i);
+			uint32_t cls = (uint32_t)pos >> BLOCK_CLASS_SHIFT;
+			struct mem_block *tmp_block = GetBlock(pos);
+			if (BITMAP_GET(block_marked_, i)) {
+				SET_BLOCK_USED_FLAG(tmp_block->flag);
+				(*classes_[cls].used)++;
+			} else {
+				CLR_BLOCK_USED_FLAG(tmp_block->flag);
+				tmp_block->pos = *classes_[cls].free_pos;
+				*classes_[cls].free_pos = pos;
+				lazy_free_num_[cls]++;
+			}
+		}
+		lazy_block_cursor_ = end;
+		return 1;
+	}
+
+	free(node_verified_);
+	free(block_marked_);
+	free(block_freed_);
+	node_verified_ = NULL;
+	block_marked_  = NULL;
+	block_freed_   = NULL;
+	if (option_.extent_alloc)
+		ExtentInit();
+	open_stat_.lazy_cost_us = NowUs() - lazy_begin_us_;
+	__atomic_store_n(&lazy_active_, 0, __ATOMIC_RELEASE);
+
+	LOG("[LazyVerify][finish][cost(%luus)]", open_stat_.lazy_cost_us);
+	LOG("[STAT][node_used(%u)]"
+			"[block_used(%u)]", 
+			head_->node_used,
+			BlockUsedNum());
+	return 0;
+}
+
+int MemHash::LazyScavenge(uint32_t len, int cls)
+{
+	//没有指定级别时，按ChooseBlockClass的代价选还没有扫描完的级别
+	if (cls < 0 && lazy_node_cursor_ < node_total_) {
+		uint64_t best_cost = 0;
+		for (uint32_t i = 0; i < class_num_; i++) {
+			uint32_t nbu = GetNodeBlockUsed(len, classes_[i].data_size);
+			if (nbu > MAX_BLOCK_NUM ||
+			    lazy_scan_cursor_[i] >= classes_[i].count)
+				continue;
+
+			uint64_t cost = (uint64_t)nbu * classes_[i].stride +
+					(uint64_t)(nbu - 1) * CACHE_LINE_SIZE;
+			if (cls == -1 || cost < best_cost) {
+				cls       = i;
+				best_cost = cost;
+			}
+		}
+	}
+
+	//NODE节点效验完之后按正常顺序重建空闲队列
+	if (cls < 0 || lazy_node_cursor_ >= node_total_ ||
+	    lazy_scan_cursor_[cls] >= classes_[cls].count)
+		return LazyStep();
+
+	//文件中使用标志位已清除、且没有被已效验节点引用的BLOCK不属于任何有效节点
+	//（分配时先置位，回收时节点先不再引用），不必等NODE节点效验完
+	MarkAllDirty();
+	struct block_class *tmp_class = &classes_[cls];
+	uint32_t end = lazy_scan_cursor_[cls] + LAZY_STEP_SIZE;
+	if (end > tmp_class->count)
+		end = tmp_class->count;
+	for (uint32_t i = lazy_scan_cursor_[cls]; i < end; i++) {
+		int32_t pos = (cls << BLOCK_CLASS_SHIFT) | i;
+		uint32_t index = tmp_class->first + i;
+		struct mem_block *tmp_block = GetBlock(pos);
+		if (GET_BLOCK_USED_FLAG(tmp_block->flag) ||
+		    BITMAP_GET(block_marked_, index))
+			continue;
+
+		BITMAP_SET(block_freed_, index);
+		tmp_block->pos = *tmp_class->free_pos;
+		*tmp_class->free_pos = pos;
+		lazy_free_num_[cls]++;
+	}
+	lazy_scan_cursor_[cls] = end;
+
+	return 1;
+}
+
+void MemHash::LazyVerify(uint32_t node_pos)
+{
+	if (BITMAP_GET(node_verified_, node_pos))
+		return ;
+	BITMAP_SET(node_verified_, node_pos);
+	MarkAllDirty();
+
+	struct mem_node *tmp_node = NodeAt(node_pos);
+	//写到一半崩溃的节点seq为奇数，恢复为偶数
+	tmp_node->seq &= ~1U;
+	int nbu = CheckNode(tmp_node);
+	if (nbu < 0)
+		return ;
+
+	//BLOCK链中有提前放入空闲队列的BLOCK（使用标志位没有落地），可能已被重用
+	int32_t pos = tmp_node->pos;
+	for (int j = 0; j < nbu; j++) {
+		if (BITMAP_GET(block_freed_, BlockIndex(pos))) {
+			ClearNode(tmp_node);
+			LOG_ERROR("MemHash::LazyVerify error. block[%d] already freed", pos);
+			return ;
+		}
+		pos = GetBlock(pos)->pos;
+	}
+	SetFingerprint(tmp_node);
+
+	//效验成功的BLOCK先记在位图上，扫描到时再设置使用标志位
+	pos = tmp_node->pos;
+	for (int j = 0; j < nbu; j++) {
+		BITMAP_SET(block_marked_, BlockIndex(pos));
+		pos = GetBlock(pos)->pos;
+	}
+
+	head_->node_used++;
+}
+
+pthread_mutex_t* MemHash::OpLock(uint64_t key)
+{
+	if (option_.shared) {
+		if (key == 0)
+			return NULL;
+		return &head_ext_->stripe_lock[key % head_ext_->lock_stripes];
+	}
+
+	if (option_.concurrent ||
+	    __atomic_load_n(&lazy_active_, __ATOMIC_ACQUIRE) ||
+	    __atomic_load_n(&compact_started_, __ATOMIC_ACQUIRE) ||
+	    __atomic_load_n(&sweep_started_, __ATOMIC_ACQUIRE))
+		return &op_lock_;
+
+	return NULL;
+}
+
+void MemHash::RecoverBlock(struct recover_task* task)
+{
+	//根据BLOCK的标记位重建区间内的BLOCK空闲队列
+	struct mem_block *pre_block = NULL;
+	struct mem_block *tmp_block = block_;
+
+	task->free_head = -1;
+	task->free_tail = -1;
+
+	for (uint32_t i = task->begin; i < task->end; i++) {
+		int32_t pos = (task->cls << BLOCK_CLASS_SHIFT) | i;
+		tmp_block = GetBlock(pos);		
+		if (GET_BLOCK_USED_FLAG(tmp_block->flag) == 1)
+			continue;
+
+		if (pre_block == NULL)
+			task->free_head = pos;
+		else
+			pre_block->pos = pos;
+		pre_block = tmp_block;
+		task->free_tail = pos;
+		task->free_num++;
+	}
+
+	return ;
+}
+
+uint32_t MemHash::LevelIndex(uint64_t key, uint32_t level)
+{
+	return bucket_base[level] + FastMod(key, bucket_m[level], bucket[level]);
+}
+
+struct mem_node* MemHash::GetNode(uint64_t key)
+{
+	//迁移时先写新节点再清除旧节点，先查旧区域再查新区域，无锁读不会漏掉正在迁移的key
+	struct mem_node *old_node = __atomic_load_n(&old_node_, __ATOMIC_ACQUIRE);
+	if (old_node != NULL) {
+		struct mem_node *tmp_node = GetNodeOld(old_node, key);
+		if (tmp_node != NULL)
+			return tmp_node;
+	}
+
+	return GetNodeNew(key);
+}
+
+struct mem_node* MemHash::HintNode(uint64_t key, const struct node_hint* hint)
+{
+	//预取到的节点仍是该key，或者预取之后布局没有变化、确实没有找到
+	if (hint != NULL && hint->valid) {
+		struct mem_node *tmp_node = hint->node;
+		if (tmp_node == NULL && !LayoutChanged(hint->layout_seq))
+			return NULL;
+		if (tmp_node != NULL &&
+		    __atomic_load_n(&tmp_node->key, __ATOMIC_RELAXED) == key)
+			return tmp_node;
+	}
+
+	return GetNode(key);
+}
+
+struct mem_node* MemHash::GetNodeOld(struct mem_node* old_node, uint64_t key)
+{
+	for (uint32_t i = 0; i < old_bucket_time_; i++) {
+		uint32_t index = old_bucket_base_[i] +
+				 FastMod(key, old_bucket_m_[i], old_bucket_[i]);
+		struct mem_node *tmp_node = (struct mem_node *)((char *)old_node +
+					    (size_t)index * node_size);
+		if (lazy_active_ && tmp_node->key != 0)
+			LazyVerify(NodeIndex(tmp_node));
+		if (tmp_node->key == key)
+			return tmp_node;
+	}
+
+	return NULL;
+}
+
+struct mem_node* MemHash::GetNodeNew(uint64_t key)
+{
+	//lazy效验期间指纹可能和未效验的节点不一致，逐个访问节点
+	if (fp_ != NULL && !lazy_active_)
+		return fp_avx2_ ? GetNodeFpAvx2(key) : GetNodeFp(key);
+
+	struct mem_node *tmp_node = node_;
+
+	for (uint32_t i = 0; i < bucket_time; i++) {
+		tmp_node = NodeAt(LevelIndex(key, i));
+		//lazy效验期间，第一次访问的节点先效验
+		if (lazy_active_ && tmp_node->key != 0)
+			LazyVerify(NodeIndex(tmp_node));
+		if (tmp_node->key == key) {
+			return tmp_node;
+		}
+	}
+
+	return NULL;
+}
+
+uint16_t MemHash::Fingerprint(uint64_t key)
+{
+	//取乘法散列的高位，与key % bucket使用的低位无关
+	uint16_t fp = (uint16_t)((key * 0x9E3779B97F4A7C15ULL) >> 48);
+	return fp == 0 ? 1 : fp;
+}
+
+void MemHash::SetFingerprint(struct mem_node* node)
+{
+	if (fp_ == NULL)
+		return ;
+
+	//旧NODE区域的指纹不再使用
+	uint32_t index = NodeIndex(node);
+	if (index >= max_node)
+		return ;
+
+	fp_[index] = node->key == 0 ? 0 : Fingerprint(node->key);
+	MarkDirty(&fp_[index], sizeof(fp_[index]));
+}
+
+struct mem_node* MemHash::GetNodeFp(uint64_t key)
+{
+	uint16_t fp = Fingerprint(key);
+
+	for (uint32_t i = 0; i < bucket_time; i++) {
+		//指纹相同才访问NODE节点
+		uint32_t index = LevelIndex(key, i);
+		if (fp_[index] != fp)
+			continue;
+		struct mem_node *tmp_node = NodeAt(index);
+		if (tmp_node->key == key)
+			return tmp_node;
+	}
+
+	return NULL;
+}
+
+#ifdef MEM_HASH_X86
+__attribute__((target("avx2")))
+struct mem_node* MemHash::GetNodeFpAvx2(uint64_t key)
+{
+	uint16_t fp = Fingerprint(key);
+	const __m256i target = _mm256_set1_epi32(fp);
+	const __m256i low    = _mm256_set1_epi32(0xFFFF);
+	int32_t index[FP_BATCH] __attribute__((aligned(32)));
+
+	//第一阶单独比较，命中的key大多在前几阶，不必为其计算整批位置
+	uint32_t first = LevelIndex(key, 0);
+	if (fp_[first] == fp && NodeAt(first)->key == key)
+		return NodeAt(first);
+
+	for (uint32_t i = 1; i < bucket_time; i += FP_BATCH) {
+		uint32_t n = bucket_time - i < FP_BATCH ? bucket_time - i : FP_BATCH;
+		for (uint32_t j = 0; j < n; j++)
+			index[j] = LevelIndex(key, i + j);
+		//不足一批时重复第一个位置，比较结果被屏蔽
+		for (uint32_t j = n; j < FP_BATCH; j++)
+			index[j] = index[0];
+
+		//一次取出FP_BATCH阶的指纹（按4字节读取，只保留低16位）
+		__m256i fps = _mm256_i32gather_epi32((const int *)fp_,
+				_mm256_load_si256((const __m256i *)index), 2);
+		fps = _mm256_and_si256(fps, low);
+		uint32_t mask = _mm256_movemask_ps(_mm256_castsi256_ps(
+					_mm256_cmpeq_epi32(fps, target)));
+		mask &= (1U << n) - 1;
+
+		//按阶的顺序访问指纹相同的NODE节点
+		while (mask != 0) {
+			struct mem_node *tmp_node = NodeAt(index[__builtin_ctz(mask)]);
+			if (tmp_node->key == key)
+				return tmp_node;
+			mask &= mask - 1;
+		}
+	}
+
+	return NULL;
+}
+#else
+struct mem_node* MemHash::GetNodeFpAvx2(uint64_t key)
+{
+	return GetNodeFp(key);
+}
+#endif
+
+struct mem_block* MemHash::GetBlock(int32_t pos)
+{
+	if (pos < 0)
+		return NULL;
+
+	//高位为级别，低位为级别内的编号
+	uint32_t cls   = (uint32_t)pos >> BLOCK_CLASS_SHIFT;
+	uint32_t index = (uint32_t)pos &  BLOCK_INDEX_MASK;
+	if (cls >= class_num_ || index >= classes_[cls].count)
+		return NULL;
+
+	return (struct mem_block *)(classes_[cls].base +
+				    (size_t)index * classes_[cls].stride);
+}
+
+uint32_t MemHash::BlockIndex(int32_t pos)
+{
+	return classes_[(uint32_t)pos >> BLOCK_CLASS_SHIFT].first +
+	       ((uint32_t)pos & BLOCK_INDEX_MASK);
+}
+
+int32_t MemHash::BlockPos(uint32_t index)
+{
+	uint32_t cls = 0;
+	while (cls < class_num_ - 1 && index >= classes_[cls + 1].first)
+		cls++;
+
+	return (cls << BLOCK_CLASS_SHIFT) | (index - classes_[cls].first);
+}
+
+uint32_t MemHash::BlockDataSize(int32_t pos)
+{
+	if (pos < 0 || ((uint32_t)pos >> BLOCK_CLASS_SHIFT) >= class_num_)
+		return 0;
+
+	return classes_[(uint32_t)pos >> BLOCK_CLASS_SHIFT].data_size;
+}
+
+struct mem_node* MemHash::NodeAt(uint32_t index)
+{
+	if (index >= max_node)
+		return (struct mem_node *)((char *)old_node_ +
+					   (size_t)(index - max_node) * node_size);
+
+	return (struct mem_node *)((char *)node_ + (size_t)index * node_size);
+}
+
+uint32_t MemHash::NodeIndex(struct mem_node* node)
+{
+	if (old_node_ != NULL &&
+	    ((char *)node < (char *)node_ ||
+	     (char *)node >= (char *)node_ + node_size * max_node))
+		return max_node + ((char *)node - (char *)old_node_) / node_size;
+
+	return ((char *)node - (char *)node_) / node_size;
+}
+
+char* MemHash::NodeInline(struct mem_node* node)
+{
+	//内联区域紧跟在节点头之后
+	return (char *)(node + 1);
+}
+
+void MemHash::SetInline(struct mem_node* node, const char* data, int len,
+			uint32_t crc32)
+{
+	memcpy(NodeInline(node), data, len);
+	node->pos   = INLINE_POS;
+	node->crc32 = crc32;
+	node->size  = len;
+}
+
+void MemHash::CopyValue(struct mem_node* node, char* data)
+{
+	if (node->pos == INLINE_POS) {
+		memcpy(data, NodeInline(node), node->size);
+		return;
+	}
+
+	uint32_t data_size = BlockDataSize(node->pos);
+	//该节点使用的BLOCK节点的个数
+	uint32_t nbu = GetNodeBlockUsed(node->size, data_size);
+	//该节点使用的最后一个BLOCK节点的偏移量
+	uint32_t lbu = GetLastBlockUsed(node->size, data_size);
+
+	//连续区段按地址顺序拷贝，不依赖上一个BLOCK的pos
+	struct mem_block *tmp_block = GetBlock(node->pos);
+	uint32_t stride = ExtentStride(node->pos, tmp_block);
+	char *tmp_buf = data;
+	//处理前n-1个BLOCK节点
+	for (uint32_t j = 0; j < nbu - 1; j++) {
+		memcpy(tmp_buf, tmp_block->data, data_size);
+		tmp_buf += data_size;
+		tmp_block = NextBlock(tmp_block, stride);
+	}	
+
+	//处理最后一个BLOCK节点
+	memcpy(tmp_buf, tmp_block->data, lbu);
+}
+
+int MemHash::Del(uint64_t key)
+{
+	LockGuard guard(this, OpLock(key));
+
+	struct mem_node *tmp_node = GetNode(key);
+	if (tmp_node == NULL) { 
+		LOG_DEBUG("[Del][%lu][failed] not find the key.", key);
+		return -1;
+	}
+
+	DelNode(tmp_node);
+
+	DataChange(node_size);
+
+	/*LOG("[Del][%lu][success]", key);
+	LOG("[STAT][free_block_pos(%d)]"
+			"[node_used(%u)]"
+			"[block_used(%u)]", 
+			head_->free_block_pos,
+			head_->node_used,
+			head_->block_used);*/
+
+	return 0;
+}
+
+void MemHash::DelForInner(uint64_t key)
+{
+	struct mem_node *tmp_node = GetNode(key);
+	if (tmp_node == NULL) { 
+		return ;
+	}
+
+	DelNode(tmp_node);
+}
+
+void MemHash::DelNode(struct mem_node* node)
+{
+	//共享模式下与ClaimNode相同，key为0的奇数seq状态只在持空闲队列锁时出现
+	LockGuard guard(this, option_.shared ? FreeLock() : NULL);
+	NodeWriteBegin(node);
+	node->key = 0;
+	SetFingerprint(node);
+	__sync_fetch_and_sub(&head_->node_used, 1);
+
+	//内联数据没有BLOCK链
+	if (node->pos != INLINE_POS) {
+		//该节点使用的BLOCK节点的个数
+		uint32_t nbu = GetNodeBlockUsed(node->size,
+						BlockDataSize(node->pos));
+		FreeBlockChain(node->pos, nbu);
+	}
+	
+	//处理NODE节点
+	node->crc32 = 0;
+	node->tval = 0;
+	node->size = 0;
+	node->pos = -1;
+	NodeWriteEnd(node);
+}
+
+void MemHash::FreeBlockChain(int32_t pos, uint32_t nbu)
+{
+	//GetView引用的链保持使用标志，引用释放时再回收
+	if (__atomic_load_n(&pin_num_, __ATOMIC_ACQUIRE) != 0 &&
+	    DeferFree(pos, nbu))
+		return ;
+
+	LockGuard guard(this, FreeLock());
+	if (extent_active_) {
+		FreeBlockExtent(pos, nbu);
+		return ;
+	}
+
+	struct mem_block *tmp_block = GetBlock(pos);
+	//BLOCK链在同一级别中
+	struct block_class *cls = &classes_[(uint32_t)pos >> BLOCK_CLASS_SHIFT];
+
+	//lazy效验期间，未扫描区间的BLOCK由后台线程统一回收，提前放入空闲队列的除外
+	if (lazy_active_) {
+		for (uint32_t i = 0; i < nbu; i++) {
+			int32_t next_pos = tmp_block->pos;
+			uint32_t index = BlockIndex(pos);
+			CLR_BLOCK_USED_FLAG(tmp_block->flag);	
+			BITMAP_CLR(block_marked_, index);
+			if (index < lazy_block_cursor_ ||
+			    BITMAP_GET(block_freed_, index)) {
+				tmp_block->pos = *cls->free_pos;
+				*cls->free_pos = pos;
+				(*cls->used)--;
+				lazy_free_num_[cls - classes_]++;
+			}
+			MarkDirty(tmp_block, offsetof(struct mem_block, data));
+			pos = next_pos;
+			tmp_block = GetBlock(pos);
+		}
+		return ;
+	}
+
+	//处理前n-1个BLOCK节点
+	for (uint32_t i = 0; i < nbu - 1; i++) {
+		CLR_BLOCK_USED_FLAG(tmp_block->flag);	
+		MarkDirty(tmp_block, offsetof(struct mem_block, data));
+		tmp_block = GetBlock(tmp_block->pos);
+	}
+	
+	//处理最后一个BLOCK节点
+	CLR_BLOCK_USED_FLAG(tmp_block->flag);	
+	//增加BLOCK空闲队列
+	tmp_block->pos = *cls->free_pos;
+	*cls->free_pos = pos;
+	*cls->used -= nbu;
+	MarkDirty(tmp_block, offsetof(struct mem_block, data));
+}
+
+int MemHash::PinChain(int32_t pos)
+{
+	LockGuard guard(this, &pin_lock_);
+	for (uint32_t i = 0; i < pin_num_; i++) {
+		if (pins_[i].pos == pos) {
+			pins_[i].ref++;
+			return 0;
+		}
+	}
+
+	if (pin_num_ == pin_cap_) {
+		uint32_t cap = pin_cap_ != 0 ? pin_cap_ * 2 : 16;
+		struct view_pin *pins = (struct view_pin *)realloc(pins_,
+					cap * sizeof(struct view_pin));
+		if (pins == NULL)
+			return -1;
+		pins_    = pins;
+		pin_cap_ = cap;
+	}
+
+	pins_[pin_num_].pos   = pos;
+	pins_[pin_num_].nbu   = 0;
+	pins_[pin_num_].ref   = 1;
+	pins_[pin_num_].freed = 0;
+	__atomic_store_n(&pin_num_, pin_num_ + 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+void MemHash::UnpinChain(int32_t pos)
+{
+	uint32_t nbu   = 0;
+	int      freed = 0;
+	{
+		LockGuard guard(this, &pin_lock_);
+		for (uint32_t i = 0; i < pin_num_; i++) {
+			if (pins_[i].pos != pos)
+				continue;
+			if (--pins_[i].ref == 0) {
+				freed = pins_[i].freed;
+				nbu   = pins_[i].nbu;
+				pins_[i] = pins_[pin_num_ - 1];
+				__atomic_store_n(&pin_num_, pin_num_ - 1,
+						 __ATOMIC_RELEASE);
+			}
+			break;
+		}
+	}
+
+	//链已不被任何节点引用，不会再被引用，解锁后回收
+	if (freed) {
+		LockGuard guard(this, OpLock(0));
+		FreeBlockChain(pos, nbu);
+	}
+}
+
+int MemHash::DeferFree(int32_t pos, uint32_t nbu)
+{
+	LockGuard guard(this, &pin_lock_);
+	for (uint32_t i = 0; i < pin_num_; i++) {
+		if (pins_[i].pos == pos) {
+			pins_[i].nbu   = nbu;
+			pins_[i].freed = 1;
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+int MemHash::ChainPinned(int32_t pos)
+{
+	LockGuard guard(this, &pin_lock_);
+	for (uint32_t i = 0; i < pin_num_; i++) {
+		if (pins_[i].pos == pos)
+			return 1;
+	}
+
+	return 0;
+}
+
+uint32_t MemHash::FreeBlockNum(uint32_t cls)
+{
+	if (lazy_active_)
+		return lazy_free_num_[cls];
+
+	return classes_[cls].count - *classes_[cls].used;
+}
+
+uint32_t MemHash::BlockUsedNum()
+{
+	uint32_t used = 0;
+	for (uint32_t i = 0; i < class_num_; i++)
+		used += *classes_[i].used;
+
+	return used;
+}
+
+int MemHash::ReplaceChain(struct mem_node* node, const char* data, int len,
+			 time_t tval)
+{
+	int32_t  old_pos = node->pos;
+	uint32_t cls     = (uint32_t)old_pos >> BLOCK_CLASS_SHIFT;
+	uint32_t old_nbu = GetNodeBlockUsed(node->size, classes_[cls].data_size);
+	uint32_t nbu     = GetNodeBlockUsed(len, classes_[cls].data_size);
+
+	//旧链被GetView引用时推迟回收，不能算作可用
+	if (ChainPinned(old_pos))
+		return -1;
+
+	//共享模式下持空闲队列锁，回收的BLOCK不会被其他进程取走
+	LockGuard guard(this, option_.shared ? FreeLock() : NULL);
+	if (nbu > MAX_BLOCK_NUM || nbu > FreeBlockNum(cls) + old_nbu)
+		return -1;
+
+	//并发读在seq为奇数期间重读，不会读到回收后被重用的BLOCK；
+	//先使节点不再引用旧链，崩溃时效验失败被清空
+	uint32_t crc32 = Crc32Compute(data, len);
+	NodeWriteBegin(node);
+	node->pos  = -1;
+	node->size = 0;
+	FreeBlockChain(old_pos, old_nbu);
+	node->pos   = AllocBlockChain(cls, data, len);
+	node->crc32 = crc32;
+	node->size  = len;
+	node->tval  = tval;
+	NodeWriteEnd(node);
+	if (hot_ != NULL)
+		Touch(node);
+
+	DataChange(len);
+	return 0;
+}
+
+int MemHash::ChooseBlockClass(uint32_t len)
+{
+	int      best      = -1;
+	uint64_t best_cost = 0;
+
+	//占用的内存加上每一跳的cache miss代价，取最小的级别
+	for (uint32_t i = 0; i < class_num_; i++) {
+		uint32_t nbu = GetNodeBlockUsed(len, classes_[i].data_size);
+		if (nbu > MAX_BLOCK_NUM || nbu > FreeBlockNum(i))
+			continue;
+
+		uint64_t cost = (uint64_t)nbu * classes_[i].stride +
+				(uint64_t)(nbu - 1) * CACHE_LINE_SIZE;
+		if (best == -1 || cost < best_cost) {
+			best      = i;
+			best_cost = cost;
+		}
+	}
+
+	return best;
+}
+
+uint32_t MemHash::MaxValueLen()
+{
+	uint32_t data_size = 0;
+	for (uint32_t i = 0; i < class_num_; i++) {
+		if (classes_[i].data_size > data_size)
+			data_size = classes_[i].data_size;
+	}
+
+	return data_size * MAX_BLOCK_NUM;
+}
+
+int MemHash::Set(uint64_t key, const char* data, int len)
+{
+	time_t now = NodeTime();
+	return SetNode(key, data, len, now, now);
+}
+
+int MemHash::SetWithTTL(uint64_t key, const char* data, int len,
+			uint64_t ttl_ms)
+{
+	time_t now = NodeTime();
+	return SetNode(key, data, len, ttl_ms == 0 ? now : Deadline(ttl_ms, now),
+		       now);
+}
+
+int MemHash::SetNode(uint64_t key, const char* data, int len, time_t tval,
+		     time_t now, const struct node_hint* hint)
+{
+	//防止key为0的情况
+	if (key == 0)
+		return -100;
+
+	LockGuard guard(this, OpLock(key));
+
+	if (len <= 0 || (uint32_t)len > MaxValueLen()) { 	
+		LOG_WARN("[Set][%lu][failed] len[%d] > max value len[%u]",
+		     key, len, MaxValueLen());
+		return -1;
+	}
+
+	//key已存在时原地替换，BLOCK不够时旧值的BLOCK链也可以使用
+	struct mem_node *tmp_node = HintNode(key, hint);
+
+	//小value内联在NODE节点中，不分配BLOCK
+	int      is_inline = (uint32_t)len <= inline_size;
+	int32_t  pos       = INLINE_POS;
+	uint32_t nbu       = 0;
+	if (!is_inline) {
+		//lazy效验期间空闲BLOCK不够时，先回收文件中未使用的BLOCK，仍不够时替后台
+		//线程完成一部分
+		int cls = ChooseBlockClass(len);
+		while (cls < 0 && lazy_active_) {
+			LazyScavenge(len, -1);
+			cls = ChooseBlockClass(len);
+		}
+
+		//加上旧值的BLOCK链够用时先回收旧链，不淘汰其他key
+		if (cls < 0 && tmp_node != NULL && tmp_node->pos != INLINE_POS &&
+		    ReplaceChain(tmp_node, data, len, tval) == 0)
+			return 0;
+
+		//淘汰模式下BLOCK不够时淘汰冷数据
+		if (cls < 0 && hot_ != NULL)
+			cls = EvictBlocks(key, len);
+
+		//先分配BLOCK链写入数据，共享模式下空闲BLOCK可能同时被其他进程取走
+		pos = cls < 0 ? -1 : AllocBlockChain(cls, data, len);
+		if (pos < 0) { 	
+			LOG_WARN("[Set][%lu][failed] no class has enough free blocks", key);
+			return -2;
+		}
+		nbu = GetNodeBlockUsed(len, classes_[cls].data_size);
+	}
+	uint32_t crc32 = Crc32Compute(data, len);
+	
+	//key已存在时原地替换，并发读始终能读到旧值或者新值
+	if (tmp_node != NULL) {
+		int32_t  old_pos  = tmp_node->pos;
+		uint32_t old_size = tmp_node->size;
+
+		NodeWriteBegin(tmp_node);
+		if (is_inline) {
+			SetInline(tmp_node, data, len, crc32);
+		} else {
+			tmp_node->pos   = pos;
+			tmp_node->crc32 = crc32;
+			tmp_node->size  = len;
+		}
+		tmp_node->tval  = tval;
+		if (old_pos != INLINE_POS)
+			FreeBlockChain(old_pos, GetNodeBlockUsed(old_size,
+						BlockDataSize(old_pos)));
+		NodeWriteEnd(tmp_node);
+		if (hot_ != NULL)
+			Touch(tmp_node);
+
+		DataChange(len);
+		return 0;
+	}
+
+	//淘汰模式下记下访问计数最小的节点，所有阶都被占用时淘汰它
+	struct mem_node *victim     = NULL;
+	uint64_t         victim_key = 0;
+	for (uint32_t i = 0; i <= bucket_time; i++) {
+		if (i == bucket_time) {
+			pthread_mutex_t *lock = NULL;
+			if (victim == NULL || EvictLock(victim_key, key, lock) < 0)
+				break;
+			if (victim->key == victim_key)
+				EvictNode(victim, evict_probe_);
+			if (lock != NULL)
+				pthread_mutex_unlock(lock);
+			tmp_node = victim;
+		} else {
+			tmp_node = NodeAt(LevelIndex(key, i));
+			if (lazy_active_ && tmp_node->key != 0)
+				LazyVerify(NodeIndex(tmp_node));
+
+			//数据超时，共享模式下只能删除同一个锁下的节点
+			uint64_t tmp_key = tmp_node->key;
+			if (tmp_key != 0 && Expired(tmp_node->tval, now) &&
+			    OpLock(tmp_key) == OpLock(key)) {
+				DelNode(tmp_node);
+			} else if (tmp_key != 0 && hot_ != NULL &&
+				   (victim == NULL ||
+				    *NodeHot(tmp_node) < *NodeHot(victim))) {
+				victim     = tmp_node;
+				victim_key = tmp_key;
+			}
+		}
+
+		//查找空闲的NODE节点，占用时写入key，崩溃时可据此找到所属的锁
+		if (tmp_node->key == 0 && ClaimNode(tmp_node, key)) {
+			SetFingerprint(tmp_node);
+			__sync_fetch_and_add(&head_->node_used, 1);
+			if (lazy_active_)
+				BITMAP_SET(node_verified_, NodeIndex(tmp_node));
+
+			if (is_inline) {
+				SetInline(tmp_node, data, len, crc32);
+			} else {
+				tmp_node->pos   = pos;
+				tmp_node->crc32 = crc32;
+				tmp_node->size  = len;
+			}
+			tmp_node->tval  = tval;
+			NodeWriteEnd(tmp_node);
+			if (hot_ != NULL)
+				*NodeHot(tmp_node) = 1;
+
+			DataChange(len);
+
+			/*LOG("[Set][%lu][success]", key);
+			LOG("[STAT][free_block_pos(%d)]"
+					"[node_used(%u)]"
+					"[block_used(%u)]", 
+					head_->free_block_pos,
+					head_->node_used,
+					head_->block_used);*/
+		
+			return 0;
+		} 
+	}
+
+	if (!is_inline)
+		FreeBlockChain(pos, nbu);
+	LOG_WARN("[Set][%lu][failed] no empty node", key);
+
+	return -3;
+}
+
+int32_t MemHash::AllocBlockChain(uint32_t cls, const char* data, uint32_t len)
+{
+	uint32_t data_size = classes_[cls].data_size;
+	//该数据要使用的BLOCK节点的个数
+	uint32_t nbu = GetNodeBlockUsed(len, data_size);
+	//该数据要使用的最后一个BLOCK节点的偏移量
+	uint32_t lbu = GetLastBlockUsed(len, data_size);
+
+	//拷贝数据不持空闲队列锁
+	int32_t pre_free_pos = PopBlockChain(cls, nbu);
+	if (pre_free_pos < 0)
+		return -1;
+
+	struct mem_block *tmp_block = GetBlock(pre_free_pos);
+	//处理前n-1个BLOCK节点
+	uint32_t stride = classes_[cls].stride;
+	for (uint32_t j = 0; j < nbu - 1; j++) {
+		memcpy(tmp_block->data, data, data_size);
+		MarkDirty(tmp_block, stride);
+		data += data_size;
+		tmp_block = GetBlock(tmp_block->pos);
+	}
+	
+	//处理最后一个BLOCK节点
+	memcpy(tmp_block->data, data, lbu);
+	MarkDirty(tmp_block, stride);
+
+	return pre_free_pos;
+}
+
+int32_t MemHash::PopBlockChain(uint32_t cls, uint32_t nbu)
+{
+	LockGuard guard(this, FreeLock());
+
+	if (nbu > FreeBlockNum(cls))
+		return -1;
+
+	if (extent_active_)
+		return PopBlockExtent(cls, nbu);
+
+	//空闲队列中的BLOCK链不保证连续，清除连续区段标志
+	struct block_class *tmp_class = &classes_[cls];
+	int32_t pre_free_pos = *tmp_class->free_pos;
+	struct mem_block *tmp_block = GetBlock(pre_free_pos);
+	//处理前n-1个BLOCK节点
+	for (uint32_t j = 0; j < nbu - 1; j++) {
+		SET_BLOCK_USED_FLAG(tmp_block->flag);
+		CLR_BLOCK_EXTENT_FLAG(tmp_block->flag);
+		MarkDirty(tmp_block, offsetof(struct mem_block, data));
+		tmp_block = GetBlock(tmp_block->pos);
+	}
+	
+	//处理最后一个BLOCK节点
+	SET_BLOCK_USED_FLAG(tmp_block->flag);
+	CLR_BLOCK_EXTENT_FLAG(tmp_block->flag);
+	*tmp_class->free_pos = tmp_block->pos;
+	tmp_block->pos  = -1;
+	MarkDirty(tmp_block, offsetof(struct mem_block, data));
+	*tmp_class->used += nbu;
+
+	if (lazy_active_)
+		lazy_free_num_[cls] -= nbu;
+
+	return pre_free_pos;
+}
+
+//在[begin, end)中查找连续nbu个空闲位，返回起点，找不到时返回-1
+//每次处理一个字：与下一个字拼成128位，移位相与后剩下的位即连续nbu个空闲位的起点
+static int64_t FindFreeRun(const uint64_t* map, uint32_t begin, uint32_t end,
+			   uint32_t nbu)
+{
+	if (begin >= end || nbu == 0 || nbu > 64)
+		return -1;
+
+	uint32_t last = (end - 1) >> 6;
+	for (uint32_t w = begin >> 6; w <= last; w++) {
+		uint64_t low = map[w];
+		if (w == begin >> 6)
+			low &= ~0ULL << (begin & 63);
+		if (low == 0)
+			continue;
+
+		__uint128_t run = low | (__uint128_t)(w < last ? map[w + 1] : 0) << 64;
+		uint32_t k = 1;
+		while (k * 2 <= nbu) {
+			run &= run >> k;
+			k *= 2;
+		}
+		run &= run >> (nbu - k);
+
+		uint64_t start = (uint64_t)run;
+		if (start != 0) {
+			int64_t pos = (int64_t)w * 64 + __builtin_ctzll(start);
+			return pos + nbu <= end ? pos : -1;
+		}
+	}
+
+	return -1;
+}
+
+void MemHash::ExtentInit()
+{
+	struct recover_task tasks[MAX_RECOVER_THREADS];
+
+	for (uint32_t c = 0; c < class_num_; c++) {
+		struct block_class *cls = &classes_[c];
+		cls->free_map = (uint64_t *)calloc(cls->count / 64 + 1,
+						   sizeof(uint64_t));
+		if (cls->free_map == NULL) {
+			printf("MemHash::ExtentInit calloc error.\n");
+			exit(-1);
+		}
+		cls->map_hint = 0;
+
+		//根据BLOCK标记位建立空闲位图，文件中的空闲队列关闭时再重建
+		RunRecoverTasks(RECOVER_EXTENT_MAP, c, cls->count,
+				tasks, option_.recover_threads);
+		*cls->free_pos = -1;
+	}
+
+	extent_active_ = 1;
+	return ;
+}
+
+void MemHash::ExtentFini()
+{
+	if (!extent_active_)
+		return ;
+
+	struct recover_task tasks[MAX_RECOVER_THREADS];
+	RebuildFreeList(tasks, option_.recover_threads);
+
+	for (uint32_t c = 0; c < class_num_; c++) {
+		free(classes_[c].free_map);
+		classes_[c].free_map = NULL;
+	}
+	extent_active_ = 0;
+
+	return ;
+}
+
+void MemHash::ExtentMapBuild(struct recover_task* task)
+{
+	//区间边界上的字可能被两个线程同时修改
+	uint64_t *map = classes_[task->cls].free_map;
+	for (uint32_t i = task->begin; i < task->end; i++) {
+		struct mem_block *tmp_block = GetBlock(
+				(task->cls << BLOCK_CLASS_SHIFT) | i);
+		if (GET_BLOCK_USED_FLAG(tmp_block->flag) == 0)
+			__sync_fetch_and_or(&map[i >> 6], 1ULL << (i & 63));
+	}
+
+	return ;
+}
+
+int32_t MemHash::PopBlockExtent(uint32_t cls, uint32_t nbu)
+{
+	struct block_class *tmp_class = &classes_[cls];
+	uint64_t *map = tmp_class->free_map;
+	uint32_t index[MAX_BLOCK_NUM] = {0};
+
+	//从上次分配的位置向后找连续的空闲BLOCK，找不到再从头找
+	int64_t start = FindFreeRun(map, tmp_class->map_hint,
+				    tmp_class->count, nbu);
+	if (start < 0)
+		start = FindFreeRun(map, 0, tmp_class->count, nbu);
+
+	if (start >= 0) {
+		for (uint32_t j = 0; j < nbu; j++)
+			index[j] = start + j;
+	} else {
+		//没有足够长的连续区段，退化为分散的BLOCK链
+		uint32_t words = tmp_class->count / 64 + 1;
+		uint32_t w = tmp_class->map_hint >> 6;
+		uint32_t n = 0;
+		while (n < nbu) {
+			uint64_t word = map[w];
+			while (word != 0 && n < nbu) {
+				index[n++] = w * 64 + __builtin_ctzll(word);
+				word &= word - 1;
+			}
+			w = w + 1 == words ? 0 : w + 1;
+		}
+	}
+
+	tmp_class->map_hint = index[nbu - 1] + 1 < tmp_class->count ?
+			      index[nbu - 1] + 1 : 0;
+
+	return LinkBlockRun(cls, index, nbu, start >= 0);
+}
+
+int32_t MemHash::LinkBlockRun(uint32_t cls, const uint32_t* index,
+			      uint32_t nbu, int contiguous)
+{
+	struct block_class *tmp_class = &classes_[cls];
+	uint64_t *map = tmp_class->free_map;
+
+	//按分配顺序串成BLOCK链
+	for (uint32_t j = 0; j < nbu; j++) {
+		struct mem_block *tmp_block = GetBlock(
+				(cls << BLOCK_CLASS_SHIFT) | index[j]);
+		map[index[j] >> 6] &= ~(1ULL << (index[j] & 63));
+		SET_BLOCK_USED_FLAG(tmp_block->flag);
+		CLR_BLOCK_EXTENT_FLAG(tmp_block->flag);
+		tmp_block->pos = j == nbu - 1 ? -1 :
+				 (int32_t)((cls << BLOCK_CLASS_SHIFT) | index[j + 1]);
+		MarkDirty(tmp_block, offsetof(struct mem_block, data));
+	}
+	if (contiguous)
+		SET_BLOCK_EXTENT_FLAG(GetBlock((cls << BLOCK_CLASS_SHIFT) |
+					       index[0])->flag);
+
+	*tmp_class->used += nbu;
+
+	return (cls << BLOCK_CLASS_SHIFT) | index[0];
+}
+
+void MemHash::FreeBlockExtent(int32_t pos, uint32_t nbu)
+{
+	struct block_class *cls = &classes_[(uint32_t)pos >> BLOCK_CLASS_SHIFT];
+
+	for (uint32_t j = 0; j < nbu; j++) {
+		struct mem_block *tmp_block = GetBlock(pos);
+		uint32_t index = (uint32_t)pos & BLOCK_INDEX_MASK;
+		CLR_BLOCK_USED_FLAG(tmp_block->flag);
+		CLR_BLOCK_EXTENT_FLAG(tmp_block->flag);
+		MarkDirty(tmp_block, offsetof(struct mem_block, data));
+		cls->free_map[index >> 6] |= 1ULL << (index & 63);
+		pos = tmp_block->pos;
+	}
+	*cls->used -= nbu;
+
+	return ;
+}
+
+int MemHash::CompactStep(uint32_t budget_us)
+{
+	//空闲位图只在进程内，其他进程仍按空闲队列分配
+	if (mem_base == NULL || option_.shared) {
+		LOG_ERROR("MemHash::CompactStep error. "
+		    "not supported in shared mode.");
+		return -1;
+	}
+
+	//后台效验完成之前空闲队列不完整
+	if (__atomic_load_n(&lazy_active_, __ATOMIC_ACQUIRE))
+		return 1;
+
+	uint64_t begin = NowUs();
+	do {
+		LockGuard guard(this, OpLock(0));
+		//本轮开始时没有空闲位图则临时建立，本轮结束时重建空闲队列
+		if (compact_cursor_ == 0 && !extent_active_) {
+			ExtentInit();
+			compact_own_map_ = 1;
+		}
+
+		uint32_t end = compact_cursor_ + COMPACT_STEP_SIZE;
+		if (end > node_total_)
+			end = node_total_;
+		for (uint32_t i = compact_cursor_; i < end; i++) {
+			uint32_t moved = CompactNode(NodeAt(i));
+			if (moved != 0) {
+				compact_chains_++;
+				compact_bytes_ += moved;
+			}
+		}
+		compact_cursor_ = end;
+
+		if (compact_cursor_ >= node_total_) {
+			if (compact_own_map_) {
+				ExtentFini();
+				compact_own_map_ = 0;
+			}
+			compact_cursor_ = 0;
+			compact_passes_++;
+			LOG("[Compact][pass(%lu)][chains(%lu)][bytes(%lu)]",
+			    compact_passes_, compact_chains_, compact_bytes_);
+			return 0;
+		}
+	} while (NowUs() - begin < budget_us);
+
+	return 1;
+}
+
+uint32_t MemHash::CompactNode(struct mem_node* node)
+{
+	if (node->key == 0 || node->pos < 0)
+		return 0;
+
+	int32_t  pos = node->pos;
+	uint32_t cls = (uint32_t)pos >> BLOCK_CLASS_SHIFT;
+	struct block_class *tmp_class = &classes_[cls];
+	uint32_t nbu  = GetNodeBlockUsed(node->size, tmp_class->data_size);
+	uint32_t head = (uint32_t)pos & BLOCK_INDEX_MASK;
+
+	struct mem_block *tmp_block = GetBlock(pos);
+	int contiguous = 1;
+	for (uint32_t j = 0; j < nbu - 1 && contiguous; j++) {
+		if (tmp_block->pos != pos + (int32_t)j + 1)
+			contiguous = 0;
+		tmp_block = GetBlock(tmp_block->pos);
+	}
+
+	//不连续的链搬到最靠前的连续区段；连续但越过前used个BLOCK的链只向前搬，
+	//每次搬移都使链的起点变小，整理最终会停止
+	int64_t start;
+	if (!contiguous)
+		start = FindFreeRun(tmp_class->free_map, 0, tmp_class->count, nbu);
+	else if (head + nbu > *tmp_class->used)
+		start = FindFreeRun(tmp_class->free_map, 0, head, nbu);
+	else
+		return 0;
+	if (start < 0)
+		return 0;
+
+	//先把数据拷贝到新链，旧链保持不变
+	uint32_t index[MAX_BLOCK_NUM];
+	for (uint32_t j = 0; j < nbu; j++)
+		index[j] = start + j;
+	int32_t new_pos = LinkBlockRun(cls, index, nbu, 1);
+
+	struct mem_block *src_block = GetBlock(pos);
+	struct mem_block *dst_block = GetBlock(new_pos);
+	uint32_t stride = ExtentStride(pos, src_block);
+	for (uint32_t j = 0; j < nbu; j++) {
+		memcpy(dst_block->data, src_block->data, tmp_class->data_size);
+		MarkDirty(dst_block, tmp_class->stride);
+		if (j < nbu - 1) {
+			src_block = NextBlock(src_block, stride);
+			dst_block = NextBlock(dst_block, tmp_class->stride);
+		}
+	}
+
+	//新旧两条链的数据相同，崩溃时无论pos是哪一个crc32都能效验通过，
+	//没有被引用的链在恢复时回收
+	NodeWriteBegin(node);
+	node->pos = new_pos;
+	NodeWriteEnd(node);
+	FreeBlockChain(pos, nbu);
+	DataChange(node->size);
+
+	return node->size;
+}
+
+void* MemHash::CompactWorker(void* arg)
+{
+	MemHash *mem = (MemHash *)arg;
+
+	//后台线程使用最低的调度优先级
+	struct sched_param param;
+	memset(&param, 0, sizeof(param));
+	pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+
+	while (!__atomic_load_n(&mem->compact_stop_, __ATOMIC_ACQUIRE)) {
+		if (mem->CompactStep(mem->compact_budget_us_) < 0)
+			break;
+		usleep(mem->compact_interval_ms_ * 1000);
+	}
+
+	return NULL;
+}
+
+int MemHash::CompactStart(uint32_t budget_us, uint32_t interval_ms)
+{
+	if (mem_base == NULL || option_.shared) {
+		LOG_ERROR("MemHash::CompactStart error. "
+		    "not supported in shared mode.");
+		return -1;
+	}
+	if (compact_started_)
+		return 0;
+
+	compact_budget_us_   = budget_us;
+	compact_interval_ms_ = interval_ms;
+	compact_stop_        = 0;
+	__atomic_store_n(&compact_started_, 1, __ATOMIC_RELEASE);
+
+	int ret = pthread_create(&compact_tid_, NULL, CompactWorker, this);
+	if (ret != 0) {
+		__atomic_store_n(&compact_started_, 0, __ATOMIC_RELEASE);
+		LOG_ERROR("MemHash::CompactStart pthread_create error[%d]. %s",
+		    ret, strerror(ret));
+		return -1;
+	}
+
+	return 0;
+}
+
+void MemHash::CompactStop()
+{
+	if (!compact_started_)
+		return ;
+
+	__atomic_store_n(&compact_stop_, 1, __ATOMIC_RELEASE);
+	pthread_join(compact_tid_, NULL);
+	__atomic_store_n(&compact_started_, 0, __ATOMIC_RELEASE);
+
+	return ;
+}
+
+void MemHash::CompactStat(struct compact_stat& stat)
+{
+	LockGuard guard(this, OpLock(0));
+
+	stat.running      = compact_started_;
+	stat.node_cursor  = compact_cursor_;
+	stat.passes       = compact_passes_;
+	stat.chains_moved = compact_chains_;
+	stat.bytes_moved  = compact_bytes_;
+
+	//BLOCK链中的跳转
+	uint64_t links = 0, broken = 0;
+	for (uint32_t i = 0; i < node_total_; i++) {
+		struct mem_node *tmp_node = NodeAt(i);
+		if (tmp_node->key == 0 || tmp_node->pos < 0)
+			continue;
+		uint32_t data_size = BlockDataSize(tmp_node->pos);
+		if (data_size == 0)
+			continue;
+		uint32_t nbu = GetNodeBlockUsed(tmp_node->size, data_size);
+		struct mem_block *tmp_block = GetBlock(tmp_node->pos);
+		for (uint32_t j = 0; j < nbu - 1 && tmp_block != NULL; j++) {
+			if (tmp_block->pos != tmp_node->pos + (int32_t)j + 1)
+				broken++;
+			links++;
+			tmp_block = GetBlock(tmp_block->pos);
+		}
+	}
+
+	//已使用的BLOCK中位于各级前used个之外的
+	uint64_t used = 0, spread = 0;
+	for (uint32_t c = 0; c < class_num_; c++) {
+		uint32_t limit = *classes_[c].used;
+		for (uint32_t i = limit; i < classes_[c].count; i++) {
+			struct mem_block *tmp_block = GetBlock(
+					(c << BLOCK_CLASS_SHIFT) | i);
+			if (GET_BLOCK_USED_FLAG(tmp_block->flag))
+				spread++;
+		}
+		used += limit;
+	}
+
+	stat.link_frag   = links == 0 ? 0 : broken * 100 / links;
+	stat.spread_frag = used  == 0 ? 0 : spread * 100 / used;
+
+	return ;
+}
+
+int MemHash::SweepStep(uint32_t budget_us)
+{
+	if (mem_base == NULL) {
+		LOG_ERROR("MemHash::SweepStep error. not initialized.");
+		return -1;
+	}
+
+	//后台效验完成之前节点可能还没有效验
+	if (__atomic_load_n(&lazy_active_, __ATOMIC_ACQUIRE))
+		return 1;
+
+	uint64_t begin = NowUs();
+	do {
+		LockGuard guard(this, OpLock(0));
+		//每段只取一次时间
+		time_t now = NodeTime();
+		uint32_t end = sweep_cursor_ + SWEEP_STEP_SIZE;
+		if (end > node_total_)
+			end = node_total_;
+		for (uint32_t i = sweep_cursor_; i < end; i++) {
+			int blocks = SweepNode(NodeAt(i), now);
+			if (blocks >= 0) {
+				sweep_nodes_++;
+				sweep_blocks_ += blocks;
+			}
+		}
+		sweep_cursor_ = end;
+
+		if (sweep_cursor_ >= node_total_) {
+			sweep_cursor_ = 0;
+			sweep_passes_++;
+			LOG("[Sweep][pass(%lu)][nodes(%lu)][blocks(%lu)]",
+			    sweep_passes_, sweep_nodes_, sweep_blocks_);
+			return 0;
+		}
+	} while (NowUs() - begin < budget_us);
+
+	return 1;
+}
+
+int MemHash::SweepNode(struct mem_node* node, time_t now)
+{
+	//先不加锁判断，只对超时的节点持key所在的锁再确认
+	uint64_t key = __atomic_load_n(&node->key, __ATOMIC_ACQUIRE);
+	if (key == 0 || !Expired(node->tval, now))
+		return -1;
+
+	LockGuard guard(this, OpLock(key));
+	if (node->key != key || !Expired(node->tval, now))
+		return -1;
+
+	int blocks = 0;
+	if (node->pos != INLINE_POS)
+		blocks = GetNodeBlockUsed(node->size, BlockDataSize(node->pos));
+	DelNode(node);
+	DataChange(node_size);
+
+	return blocks;
+}
+
+void* MemHash::SweepWorker(void* arg)
+{
+	MemHash *mem = (MemHash *)arg;
+
+	//后台线程使用最低的调度优先级
+	struct sched_param param;
+	memset(&param, 0, sizeof(param));
+	pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+
+	while (!__atomic_load_n(&mem->sweep_stop_, __ATOMIC_ACQUIRE)) {
+		if (mem->SweepStep(mem->sweep_budget_us_) < 0)
+			break;
+		usleep(mem->sweep_interval_ms_ * 1000);
+	}
+
+	return NULL;
+}
+
+int MemHash::SweepStart(uint32_t budget_us, uint32_t interval_ms)
+{
+	if (mem_base == NULL) {
+		LOG_ERROR("MemHash::SweepStart error. not initialized.");
+		return -1;
+	}
+	if (sweep_started_)
+		return 0;
+
+	sweep_budget_us_   = budget_us;
+	sweep_interval_ms_ = interval_ms;
+	sweep_stop_        = 0;
+	__atomic_store_n(&sweep_started_, 1, __ATOMIC_RELEASE);
+
+	int ret = pthread_create(&sweep_tid_, NULL, SweepWorker, this);
+	if (ret != 0) {
+		__atomic_store_n(&sweep_started_, 0, __ATOMIC_RELEASE);
+		LOG_ERROR("MemHash::SweepStart pthread_create error[%d]. %s",
+		    ret, strerror(ret));
+		return -1;
+	}
+
+	return 0;
+}
+
+void MemHash::SweepStop()
+{
+	if (!sweep_started_)
+		return ;
+
+	__atomic_store_n(&sweep_stop_, 1, __ATOMIC_RELEASE);
+	pthread_join(sweep_tid_, NULL);
+	__atomic_store_n(&sweep_started_, 0, __ATOMIC_RELEASE);
+
+	return ;
+}
+
+void MemHash::SweepStat(struct sweep_stat& stat)
+{
+	LockGuard guard(this, OpLock(0));
+
+	stat.running          = sweep_started_;
+	stat.node_cursor      = sweep_cursor_;
+	stat.passes           = sweep_passes_;
+	stat.nodes_reclaimed  = sweep_nodes_;
+	stat.blocks_reclaimed = sweep_blocks_;
+
+	return ;
+}
+
+void MemHash::EvictInit()
+{
+	//按预留的地址空间分配，扩容后的NODE区域也在其中，只访问到的部分占用内存
+	size_t map_size = reserve_size_ != 0 ? reserve_size_ : total_size;
+	hot_ = (uint8_t *)calloc(map_size / sizeof(struct mem_node), 1);
+	if (hot_ == NULL) {
+		printf("MemHash::EvictInit calloc error.\n");
+		exit(-1);
+	}
+
+	return ;
+}
+
+uint8_t* MemHash::NodeHot(struct mem_node* node)
+{
+	//NODE节点的间隔不小于sizeof(mem_node)，每个节点的位置不同
+	return &hot_[((char *)node - mem_base) / sizeof(struct mem_node)];
+}
+
+void MemHash::Touch(struct mem_node* node)
+{
+	uint8_t *hot = NodeHot(node);
+	uint8_t  cnt = __atomic_load_n(hot, __ATOMIC_RELAXED);
+	//到上限后只读，避免并发读争用同一个缓存行
+	if (cnt < EVICT_HOT_MAX)
+		__atomic_store_n(hot, cnt + 1, __ATOMIC_RELAXED);
+}
+
+void MemHash::EvictHit(struct mem_node* node)
+{
+	if (hot_ == NULL)
+		return ;
+
+	Touch(node);
+	__atomic_fetch_add(&evict_hits_, 1, __ATOMIC_RELAXED);
+}
+
+void MemHash::EvictMiss()
+{
+	if (hot_ != NULL)
+		__atomic_fetch_add(&evict_misses_, 1, __ATOMIC_RELAXED);
+}
+
+void MemHash::EvictNode(struct mem_node* node, uint64_t& counter)
+{
+	if (node->pos != INLINE_POS)
+		__atomic_fetch_add(&evict_blocks_, GetNodeBlockUsed(node->size,
+				   BlockDataSize(node->pos)), __ATOMIC_RELAXED);
+	DelNode(node);
+	DataChange(node_size);
+	__atomic_fetch_add(&counter, 1, __ATOMIC_RELAXED);
+}
+
+int MemHash::EvictLock(uint64_t victim_key, uint64_t key,
+		       pthread_mutex_t*& lock)
+{
+	lock = OpLock(victim_key);
+	if (lock == OpLock(key)) {
+		lock = NULL;
+		return 0;
+	}
+
+	//共享模式下其他锁只尝试加锁，避免与持有该锁、等待本锁的进程互相等待
+	if (TryLockMutex(lock) < 0) {
+		lock = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+int MemHash::EvictBlocks(uint64_t key, uint32_t len)
+{
+	//没有级别容纳得下len时，淘汰多少节点都没有用
+	uint32_t i = 0;
+	for (; i < class_num_; i++) {
+		uint32_t nbu = GetNodeBlockUsed(len, classes_[i].data_size);
+		if (nbu <= MAX_BLOCK_NUM && nbu <= classes_[i].count)
+			break;
+	}
+	if (i == class_num_)
+		return -1;
+
+	//每次最多扫过EVICT_SCAN_SIZE个节点，下次从指针处继续，避免一次失败的Set
+	//持锁扫完整个node区域并把所有计数减到0
+	uint32_t hand = evict_hand_;
+	int cls = -1;
+	for (uint32_t n = 0; n < EVICT_SCAN_SIZE && cls < 0; n++) {
+		if (hand >= node_total_)
+			hand = 0;
+		struct mem_node *tmp_node = NodeAt(hand++);
+
+		uint64_t tmp_key = __atomic_load_n(&tmp_node->key, __ATOMIC_ACQUIRE);
+		if (tmp_key == 0 || tmp_key == key)
+			continue;
+		uint8_t *hot = NodeHot(tmp_node);
+		if (*hot > 0) {
+			(*hot)--;
+			continue;
+		}
+
+		pthread_mutex_t *lock = NULL;
+		if (EvictLock(tmp_key, key, lock) < 0)
+			continue;
+		//内联的节点及淘汰后也放不下len的级别不淘汰
+		if (tmp_node->key == tmp_key && tmp_node->pos != INLINE_POS &&
+		    BlockDataSize(tmp_node->pos) * MAX_BLOCK_NUM >= len) {
+			EvictNode(tmp_node, evict_clock_);
+			cls = ChooseBlockClass(len);
+		}
+		if (lock != NULL)
+			pthread_mutex_unlock(lock);
+	}
+	evict_hand_ = hand;
+
+	return cls < 0 ? -2 : cls;
+}
+
+void MemHash::EvictStat(struct evict_stat& stat)
+{
+	stat.probe_evicted = __atomic_load_n(&evict_probe_,  __ATOMIC_RELAXED);
+	stat.clock_evicted = __atomic_load_n(&evict_clock_,  __ATOMIC_RELAXED);
+	stat.blocks_freed  = __atomic_load_n(&evict_blocks_, __ATOMIC_RELAXED);
+	stat.get_hits      = __atomic_load_n(&evict_hits_,   __ATOMIC_RELAXED);
+	stat.get_misses    = __atomic_load_n(&evict_misses_, __ATOMIC_RELAXED);
+	uint64_t total = stat.get_hits + stat.get_misses;
+	stat.hit_ratio = total == 0 ? 0 : stat.get_hits * 100 / total;
+
+	return ;
+}
+
+//写入全部数据，被信号中断时继续
+static int WriteFull(int fd, const char* p, size_t len)
+{
+	while (len > 0) {
+		ssize_t n = write(fd, p, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		p   += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+int MemHash::Dump(int fd)
+{
+	if (mem_base == NULL || option_.shared) {
+		LOG_ERROR("MemHash::Dump error. "
+		    "not initialized or not supported in shared mode.");
+		return -1;
+	}
+
+	uint64_t begin = NowUs();
+	{
+		LockGuard guard(this, OpLock(0));
+		if (snap_done_ != NULL) {
+			LOG_ERROR("MemHash::Dump error. snapshot in progress.");
+			return -1;
+		}
+
+		//后台效验完成之前节点可能还没有效验，先替后台线程完成
+		while (lazy_active_)
+			LazyStep();
+
+		snap_done_ = (uint8_t *)calloc(node_total_ / 8 + 1, 1);
+		if (snap_done_ == NULL) {
+			LOG_ERROR("MemHash::Dump calloc error.");
+			return -1;
+		}
+		snap_total_ = node_total_;
+		snap_now_   = NodeTime();
+		snap_len_   = 0;
+		snap_error_ = 0;
+		memset(&snap_stat_, 0, sizeof(snap_stat_));
+	}
+
+	struct snap_head head;
+	memset(&head, 0, sizeof(head));
+	memcpy(head.magic, "MEMSNAPH", 8);
+	head.snap_time = snap_now_;
+	head.version   = SNAPSHOT_VERSION;
+	head.crc_type  = crc_engine_->type;
+	head.tval_ms   = tval_ms_;
+	head.crc32     = Crc32Head((const char *)&head, offsetof(struct snap_head, crc32));
+
+	struct snap_tail tail;
+	memset(&tail, 0, sizeof(tail));
+
+	int ret = WriteFull(fd, (const char *)&head, sizeof(head));
+	if (ret < 0)
+		LOG_ERROR("MemHash::Dump write error[%d]. %s", errno, strerror(errno));
+
+	//两个缓冲区交替使用：持锁时记录追加到snap_buf_，解锁后写入换出的那一个
+	char  *out_buf = NULL;
+	size_t out_len = 0, out_cap = 0;
+	uint32_t cursor = 0;
+	int done = 0;
+	while (!done) {
+		{
+			LockGuard guard(this, OpLock(0));
+			//迁移完成后旧区域不再使用，其中的节点已在迁移时保存
+			uint32_t total = snap_total_ < node_total_ ? snap_total_ : node_total_;
+			uint32_t end   = cursor + SNAPSHOT_STEP_SIZE;
+			if (end > total)
+				end = total;
+			for (uint32_t i = cursor; i < end && ret == 0; i++) {
+				if (BITMAP_GET(snap_done_, i))
+					continue;
+				BITMAP_SET(snap_done_, i);
+				SnapshotNode(NodeAt(i));
+			}
+			cursor = end;
+
+			if (ret < 0 || snap_error_ || cursor >= total) {
+				free(snap_done_);
+				snap_done_ = NULL;
+				done = 1;
+				if (snap_error_)
+					ret = -1;
+			}
+
+			char  *tmp_buf = snap_buf_;
+			size_t tmp_cap = snap_cap_;
+			out_len   = snap_len_;
+			snap_buf_ = out_buf;
+			snap_cap_ = out_cap;
+			snap_len_ = 0;
+			out_buf   = tmp_buf;
+			out_cap   = tmp_cap;
+			//解锁后下一次快照可能已经开始使用snap_buf_，换入的缓冲区在锁内释放
+			if (done) {
+				free(snap_buf_);
+				snap_buf_ = NULL;
+				snap_cap_ = 0;
+			}
+		}
+
+		if (ret == 0 && SnapshotFlush(fd, out_buf, out_len, tail) < 0) {
+			LOG_ERROR("MemHash::Dump write error[%d]. %s",
+			    errno, strerror(errno));
+			ret = -1;
+		}
+	}
+	free(out_buf);
+
+	if (ret == 0) {
+		memcpy(tail.magic, "MEMSNAPT", 8);
+		tail.crc32 = Crc32Head((const char *)&tail, offsetof(struct snap_tail, crc32));
+		if (WriteFull(fd, (const char *)&tail, sizeof(tail)) < 0) {
+			LOG_ERROR("MemHash::Dump write error[%d]. %s",
+			    errno, strerror(errno));
+			ret = -1;
+		}
+	}
+	if (ret < 0)
+		return -1;
+
+	snap_stat_.records = tail.records;
+	snap_stat_.bytes   = tail.bytes;
+	snap_stat_.cost_us = NowUs() - begin;
+	LOG("[Dump][records(%lu)][bytes(%lu)][captured(%lu)][cost(%luus)]",
+	    snap_stat_.records, snap_stat_.bytes, snap_stat_.captured,
+	    snap_stat_.cost_us);
+
+	return 0;
+}
+
+int MemHash::Snapshot(const char* path)
+{
+	char tmp_path[PATH_MAX];
+	if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path) >=
+	    (int)sizeof(tmp_path)) {
+		LOG_ERROR("MemHash::Snapshot error. path too long.");
+		return -1;
+	}
+
+	int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (fd == -1) {
+		LOG_ERROR("MemHash::Snapshot open error[%d]. %s", errno, strerror(errno));
+		return -1;
+	}
+
+	//写完并落地之后再改名，path总是完整的快照
+	int ret = Dump(fd);
+	if (ret == 0 && (fsync(fd) == -1 || rename(tmp_path, path) == -1)) {
+		LOG_ERROR("MemHash::Snapshot error[%d]. %s", errno, strerror(errno));
+		ret = -1;
+	}
+	close(fd);
+	if (ret < 0)
+		unlink(tmp_path);
+
+	return ret;
+}
+
+void MemHash::SnapshotNode(struct mem_node* node)
+{
+	if (node->key == 0 || Expired(node->tval, snap_now_))
+		return ;
+
+	size_t len = sizeof(struct snap_record) + node->size;
+	if (snap_len_ + len > snap_cap_) {
+		size_t cap = snap_cap_ != 0 ? snap_cap_ : (1UL << 20);
+		while (cap < snap_len_ + len)
+			cap *= 2;
+		char *buf = (char *)realloc(snap_buf_, cap);
+		if (buf == NULL) {
+			if (!snap_error_)
+				LOG_ERROR("MemHash::SnapshotNode realloc error. size[%lu]", cap);
+			snap_error_ = 1;
+			return ;
+		}
+		snap_buf_ = buf;
+		snap_cap_ = cap;
+	}
+
+	struct snap_record record;
+	record.key   = node->key;
+	record.tval  = node->tval;
+	record.size  = node->size;
+	record.crc32 = node->crc32;
+	memcpy(snap_buf_ + snap_len_, &record, sizeof(record));
+	CopyValue(node, snap_buf_ + snap_len_ + sizeof(record));
+	snap_len_ += len;
+}
+
+void MemHash::SnapshotCapture(struct mem_node* node)
+{
+	//写操作与快照扫描持同一个锁，节点的旧值只保存一次
+	uint32_t index = NodeIndex(node);
+	if (index >= snap_total_ || BITMAP_GET(snap_done_, index))
+		return ;
+
+	BITMAP_SET(snap_done_, index);
+	if (node->key != 0)
+		snap_stat_.captured++;
+	SnapshotNode(node);
+}
+
+int MemHash::SnapshotFlush(int fd, const char* buf, size_t len,
+			   struct snap_tail& tail)
+{
+	//尾部的crc32只覆盖记录头，value由各自的crc32效验
+	for (size_t off = 0; off < len; ) {
+		struct snap_record record;
+		memcpy(&record, buf + off, sizeof(record));
+		tail.crc32_records = crc_head_engine_->append(tail.crc32_records,
+				(const char *)&record, sizeof(record));
+		tail.records++;
+		tail.bytes += record.size;
+		off += sizeof(record) + record.size;
+	}
+
+	return WriteFull(fd, buf, len);
+}
+
+time_t MemHash::SnapshotTime(time_t tval, uint32_t tval_ms)
+{
+	if ((tval_ms != 0) == (tval_ms_ != 0))
+		return tval;
+
+	time_t deadline = tval & (time_t)TVAL_DEADLINE;
+	tval &= ~(time_t)TVAL_DEADLINE;
+	//毫秒换算为秒时超时时刻向上取整
+	if (tval_ms_)
+		tval *= 1000;
+	else
+		tval = deadline ? (tval + 999) / 1000 : tval / 1000;
+
+	return tval | deadline;
+}
+
+int MemHash::LoadSnapshot(const char* path, uint32_t threads)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		LOG_ERROR("MemHash::LoadSnapshot open error[%d]. %s",
+		    errno, strerror(errno));
+		return -1;
+	}
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	int ret = Restore(fd, threads);
+	close(fd);
+
+	return ret;
+}
+
+//读取最多len字节，被信号中断时继续，返回读到的字节数（0为结束）
+static ssize_t ReadSome(int fd, char* p, size_t len)
+{
+	ssize_t n;
+	do {
+		n = read(fd, p, len);
+	} while (n < 0 && errno == EINTR);
+
+	return n;
+}
+
+//把读取线程填充的批次放入导入线程的队列，队列满时等待
+static void ImportPush(struct import_task* task)
+{
+	pthread_mutex_lock(&task->lock);
+	while (task->tail - task->head == IMPORT_QUEUE_DEPTH)
+		pthread_cond_wait(&task->cond, &task->lock);
+	task->batch[task->tail % IMPORT_QUEUE_DEPTH]     = task->fill;
+	task->batch_len[task->tail % IMPORT_QUEUE_DEPTH] = task->fill_len;
+	task->tail++;
+	pthread_cond_signal(&task->cond);
+	pthread_mutex_unlock(&task->lock);
+
+	task->fill     = NULL;
+	task->fill_len = 0;
+	task->fill_cap = 0;
+}
+
+int MemHash::Restore(int fd, uint32_t threads)
+{
+	if (mem_base == NULL) {
+		LOG_ERROR("MemHash::Restore error. not initialized.");
+		return -1;
+	}
+
+	uint64_t begin = NowUs();
+	struct snap_head head;
+	const struct crc32_engine *engine = NULL;
+	size_t len = 0;
+	while (len < sizeof(head)) {
+		ssize_t n = ReadSome(fd, (char *)&head + len, sizeof(head) - len);
+		if (n <= 0)
+			break;
+		len += n;
+	}
+	if (len != sizeof(head) || memcmp(head.magic, "MEMSNAPH", 8) != 0 ||
+	    head.version != SNAPSHOT_VERSION ||
+	    head.crc32 != Crc32Head((const char *)&head,
+				    offsetof(struct snap_head, crc32)) ||
+	    (engine = Crc32GetEngine(head.crc_type)) == NULL) {
+		LOG_ERROR("MemHash::Restore error. head check error.");
+		return -1;
+	}
+
+	//导入期间其他操作等待（并发模式下）
+	LockGuard guard(this, OpLock(0));
+	if (snap_done_ != NULL) {
+		LOG_ERROR("MemHash::Restore error. snapshot in progress.");
+		return -1;
+	}
+	while (lazy_active_)
+		LazyStep();
+
+	//只有空的MemHash才并行导入，否则逐条Set
+	if (threads > MAX_RECOVER_THREADS)
+		threads = MAX_RECOVER_THREADS;
+	int parallel = threads > 1 && head_->node_used == 0 && old_node_ == NULL &&
+		       !option_.shared;
+	if (!parallel)
+		threads = 1;
+
+	int failed = 0;
+	struct import_task tasks[MAX_RECOVER_THREADS];
+	memset(tasks, 0, sizeof(tasks[0]) * threads);
+	time_t now = NodeTime();
+	for (uint32_t i = 0; i < threads; i++) {
+		tasks[i].mem     = this;
+		tasks[i].engine  = engine;
+		tasks[i].tval_ms = head.tval_ms;
+		tasks[i].now     = now;
+		tasks[i].fresh   = parallel;
+		tasks[i].failed  = &failed;
+		pthread_mutex_init(&tasks[i].lock, NULL);
+		pthread_cond_init(&tasks[i].cond, NULL);
+	}
+
+	uint32_t started = 0;
+	if (parallel) {
+		import_active_ = 1;
+		for (; started < threads; started++) {
+			int ret = pthread_create(&tasks[started].tid, NULL, ImportWorker,
+						 &tasks[started]);
+			if (ret != 0) {
+				LOG_ERROR("MemHash::Restore pthread_create error[%d]. %s",
+				    ret, strerror(ret));
+				failed = 1;
+				break;
+			}
+		}
+	}
+
+	//记录可能跨越两次读取；流的最后sizeof(snap_tail)字节是尾部，只解析在此之前
+	//结束的记录，读到结尾时剩下的正好是尾部
+	size_t cap  = IMPORT_BATCH_SIZE;
+	size_t off  = 0;
+	size_t want = 0;
+	char  *buf  = (char *)malloc(cap);
+	uint32_t crc32_records = 0;
+	uint64_t records = 0;
+	int eof = 0;
+	int ret = buf == NULL ? -1 : 0;
+	len = 0;
+	while (ret == 0 && !__atomic_load_n(&failed, __ATOMIC_ACQUIRE)) {
+		struct snap_record record;
+		if (len - off >= sizeof(record) + sizeof(struct snap_tail)) {
+			memcpy(&record, buf + off, sizeof(record));
+			if (record.key == 0 || record.size == 0 ||
+			    record.size > MaxValueLen()) {
+				LOG_ERROR("MemHash::Restore error. invalid record. "
+				    "key[%lu] size[%u]", record.key, record.size);
+				ret = -1;
+				break;
+			}
+
+			size_t need = sizeof(record) + record.size;
+			if (len - off >= need + sizeof(struct snap_tail)) {
+				crc32_records = crc_head_engine_->append(crc32_records,
+						(const char *)&record, sizeof(record));
+				records++;
+				if (!parallel) {
+					ret = ImportRecord(&tasks[0], buf + off) < 0 ? -1 : 0;
+				} else {
+					//同一个key总是由同一个线程导入
+					struct import_task *task = &tasks[record.key % threads];
+					if (task->fill_len + need > task->fill_cap) {
+						if (task->fill_len != 0)
+							ImportPush(task);
+						task->fill_cap = need > IMPORT_BATCH_SIZE ?
+								 need : IMPORT_BATCH_SIZE;
+						task->fill = (char *)malloc(task->fill_cap);
+						if (task->fill == NULL) {
+							LOG_ERROR("MemHash::Restore malloc error.");
+							task->fill_cap = 0;
+							ret = -1;
+							break;
+						}
+					}
+					memcpy(task->fill + task->fill_len, buf + off, need);
+					task->fill_len += need;
+				}
+				off += need;
 				continue;
 			}
+			want = need + sizeof(struct snap_tail);
+		}
+		if (eof)
+			break;
+
+		//未解析的部分移到开头，放不下一整条记录时扩大缓冲区
+		memmove(buf, buf + off, len - off);
+		len -= off;
+		off  = 0;
+		if (want > cap) {
+			char *tmp_buf = (char *)realloc(buf, want);
+			if (tmp_buf == NULL) {
+				LOG_ERROR("MemHash::Restore realloc error.");
+				ret = -1;
+				break;
+			}
+			buf = tmp_buf;
+			cap = want;
+		}
+
+		ssize_t n = ReadSome(fd, buf + len, cap - len);
+		if (n < 0) {
+			LOG_ERROR("MemHash::Restore read error[%d]. %s",
+			    errno, strerror(errno));
+			ret = -1;
+			break;
+		}
+		eof  = n == 0;
+		len += n;
+	}
+
+	if (ret == 0 && !failed) {
+		struct snap_tail tail;
+		if (len - off == sizeof(tail))
+			memcpy(&tail, buf + off, sizeof(tail));
+		if (len - off != sizeof(tail) || memcmp(tail.magic, "MEMSNAPT", 8) != 0 ||
+		    tail.crc32 != Crc32Head((const char *)&tail,
+					    offsetof(struct snap_tail, crc32)) ||
+		    tail.records != records || tail.crc32_records != crc32_records) {
+			LOG_ERROR("MemHash::Restore error. tail check error. "
+			    "records[%lu]", records);
+			ret = -1;
+		}
+	}
+	free(buf);
+
+	//剩余的批次交给导入线程，等待全部完成
+	for (uint32_t i = 0; i < started; i++) {
+		if (tasks[i].fill_len != 0)
+			ImportPush(&tasks[i]);
+		free(tasks[i].fill);
+		pthread_mutex_lock(&tasks[i].lock);
+		tasks[i].eof = 1;
+		pthread_cond_signal(&tasks[i].cond);
+		pthread_mutex_unlock(&tasks[i].lock);
+	}
+	memset(&snap_stat_, 0, sizeof(snap_stat_));
+	for (uint32_t i = 0; i < threads; i++) {
+		if (i < started)
+			pthread_join(tasks[i].tid, NULL);
+		if (tasks[i].ret < 0)
+			ret = -1;
+		snap_stat_.records += tasks[i].records;
+		snap_stat_.bytes   += tasks[i].bytes;
+		snap_stat_.expired += tasks[i].expired;
+		pthread_mutex_destroy(&tasks[i].lock);
+		pthread_cond_destroy(&tasks[i].cond);
+	}
+
+	//并行导入没有逐页记录，也没有按msync_freq落地
+	if (parallel) {
+		import_active_ = 0;
+		MarkAllDirty();
+		DataChange(snap_stat_.bytes > UINT32_MAX ? UINT32_MAX : snap_stat_.bytes);
+	}
+	if (ret < 0 || failed)
+		return -1;
+
+	snap_stat_.cost_us = NowUs() - begin;
+	LOG("[Restore][threads(%u)][records(%lu)][expired(%lu)][bytes(%lu)][cost(%luus)]",
+	    threads, snap_stat_.records, snap_stat_.expired, snap_stat_.bytes,
+	    snap_stat_.cost_us);
+
+	return 0;
+}
+
+void* MemHash::ImportWorker(void* arg)
+{
+	struct import_task *task = (struct import_task *)arg;
+	MemHash *mem = task->mem;
+
+	pthread_mutex_lock(&task->lock);
+	while (1) {
+		while (task->head == task->tail && !task->eof)
+			pthread_cond_wait(&task->cond, &task->lock);
+		if (task->head == task->tail)
+			break;
+		char  *buf = task->batch[task->head % IMPORT_QUEUE_DEPTH];
+		size_t len = task->batch_len[task->head % IMPORT_QUEUE_DEPTH];
+		pthread_mutex_unlock(&task->lock);
+
+		//有线程失败后只取出批次不再写入，读取线程不会阻塞
+		for (size_t off = 0; off < len; ) {
+			struct snap_record record;
+			memcpy(&record, buf + off, sizeof(record));
+			if (task->ret == 0 && !__atomic_load_n(task->failed, __ATOMIC_ACQUIRE)) {
+				task->ret = mem->ImportRecord(task, buf + off);
+				if (task->ret < 0)
+					__atomic_store_n(task->failed, 1, __ATOMIC_RELEASE);
+			}
+			off += sizeof(record) + record.size;
+		}
+		free(buf);
+
+		pthread_mutex_lock(&task->lock);
+		task->head++;
+		pthread_cond_signal(&task->cond);
+	}
+	pthread_mutex_unlock(&task->lock);
+
+	return NULL;
+}
+
+int MemHash::ImportRecord(struct import_task* task, const char* p)
+{
+	struct snap_record record;
+	memcpy(&record, p, sizeof(record));
+	const char *value = p + sizeof(record);
+	if (task->engine->append(0, value, record.size) != record.crc32) {
+		LOG_ERROR("MemHash::Restore error. key[%lu] value check error.",
+		    record.key);
+		return -1;
+	}
+
+	time_t tval = SnapshotTime(record.tval, task->tval_ms);
+	if (Expired(tval, task->now)) {
+		task->expired++;
+		return 0;
+	}
+
+	int ret;
+	if (task->fresh) {
+		//crc32算法相同时直接使用记录中的crc32
+		uint32_t crc32 = task->engine->type == crc_engine_->type ?
+				 record.crc32 : Crc32Compute(value, record.size);
+		ret = ImportNode(record.key, value, record.size, tval, crc32);
+	} else {
+		ret = SetNode(record.key, value, record.size, tval, task->now);
+	}
+	if (ret != 0) {
+		LOG_ERROR("MemHash::Restore error. set key[%lu] failed[%d].",
+		    record.key, ret);
+		return -2;
+	}
+
+	task->records++;
+	task->bytes += record.size;
+	return 0;
+}
+
+int MemHash::ImportNode(uint64_t key, const char* data, uint32_t len,
+			time_t tval, uint32_t crc32)
+{
+	//小value内联在NODE节点中，不分配BLOCK
+	int      is_inline = len <= inline_size;
+	int32_t  pos       = INLINE_POS;
+	uint32_t nbu       = 0;
+	if (!is_inline) {
+		//空闲BLOCK可能被其他导入线程同时取走，分配失败时重新选择级别
+		int cls = -1;
+		pos = -1;
+		while (pos < 0 && (cls = ChooseBlockClass(len)) >= 0)
+			pos = AllocBlockChain(cls, data, len);
+		if (pos < 0)
+			return -2;
+		nbu = GetNodeBlockUsed(len, classes_[cls].data_size);
+	}
+
+	//不查找已有的key，与其他导入线程竞争空闲节点
+	for (uint32_t i = 0; i < bucket_time; i++) {
+		struct mem_node *tmp_node = NodeAt(LevelIndex(key, i));
+		if (tmp_node->key != 0 || !ClaimNode(tmp_node, key))
+			continue;
+
+		SetFingerprint(tmp_node);
+		__sync_fetch_and_add(&head_->node_used, 1);
+		if (is_inline) {
+			SetInline(tmp_node, data, len, crc32);
+		} else {
+			tmp_node->pos   = pos;
+			tmp_node->crc32 = crc32;
+			tmp_node->size  = len;
+		}
+		tmp_node->tval = tval;
+		NodeWriteEnd(tmp_node);
+		if (hot_ != NULL)
+			*NodeHot(tmp_node) = 1;
+
+		return 0;
+	}
+
+	if (!is_inline)
+		FreeBlockChain(pos, nbu);
+
+	return -3;
+}
+
+void MemHash::SnapshotStat(struct snapshot_stat& stat)
+{
+	LockGuard guard(this, OpLock(0));
+
+	stat = snap_stat_;
+
+	return ;
+}
+
+int MemHash::Grow(uint32_t bucket_time, uint32_t bucket_len,
+		  uint32_t block_cls,   uint32_t block_count)
+{
+	LockGuard guard(this, OpLock(0));
+
+	if (mem_base == NULL || option_.shared || reserve_size_ == 0 ||
+	    grow_fd_ == -1 || head_ext_ == &legacy_ext_ ||
+	    head_ext_->ext_info_.version < 6) {
+		LOG_ERROR("MemHash::Grow error. need a version 6 file opened "
+		    "with grow_reserve, not in shared mode.");
+		return -1;
+	}
+	//快照按开始时的节点个数扫描，期间不能增加NODE区域
+	if (lazy_active_ || old_node_ != NULL ||
+	    (bucket_time != 0 && snap_done_ != NULL)) {
+		LOG_ERROR("MemHash::Grow error. lazy verify, migration or snapshot "
+		    "in progress.");
+		return -2;
+	}
+	if (bucket_time == 0 && block_count == 0)
+		return 0;
+
+	//新NODE区域的阶数、阶长度都不小于当前的，切换布局期间无锁读混用新旧bucket
+	//数组算出的编号不会超出新区域
+	uint32_t new_bucket[MAX_BUCKET_SIZE];
+	uint32_t new_max_node = 0;
+	if (bucket_time != 0) {
+		if (bucket_time > MAX_BUCKET_SIZE ||
+		    bucket_time < this->bucket_time || bucket_len < this->bucket_len ||
+		    GeneratePrimes(new_bucket, bucket_len, bucket_time) !=
+		    (int)bucket_time) {
+			LOG_ERROR("MemHash::Grow error. bucket_time[%u] bucket_len[%u]",
+			    bucket_time, bucket_len);
+			return -3;
+		}
+		for (uint32_t i = 0; i < bucket_time; i++)
+			new_max_node += new_bucket[i];
+		if (new_max_node <= max_node) {
+			LOG_ERROR("MemHash::Grow error. new node zone is not larger.");
+			return -3;
+		}
+	}
+	if (block_count != 0 &&
+	    (block_cls >= class_num_ || class_num_ >= MAX_BLOCK_CLASS ||
+	     block_count > BLOCK_INDEX_MASK)) {
+		LOG_ERROR("MemHash::Grow error. block_cls[%u] block_count[%u]",
+		    block_cls, block_count);
+		return -4;
+	}
+
+	//---|barrier|node zone|fp zone|barrier|block class|barrier|---，从页边界开始追加
+	size_t page  = sysconf(_SC_PAGESIZE);
+	size_t start = (total_size + page - 1) / page * page;
+	size_t end   = start;
+	size_t node_offset  = 0;
+	size_t fp_size      = 0;
+	size_t class_offset = 0;
+	if (bucket_time != 0) {
+		node_offset = start + CACHE_LINE_SIZE;
+		fp_size     = fp_ != NULL ? FpZoneSize(new_max_node) : 0;
+		end = node_offset + node_size * new_max_node + fp_size;
+	}
+	struct block_class *src_class = &classes_[block_cls];
+	if (block_count != 0) {
+		class_offset = (end + sizeof(struct mem_barrier) + CACHE_LINE_SIZE - 1) &
+			       ~(size_t)(CACHE_LINE_SIZE - 1);
+		end = class_offset + (size_t)src_class->stride * block_count;
+	}
+	size_t new_total = end + sizeof(struct mem_barrier);
+	if (new_total > reserve_size_) {
+		LOG_ERROR("MemHash::Grow error. size[%lu] > grow_reserve[%lu]",
+		    (uint64_t)new_total, (uint64_t)reserve_size_);
+		return -5;
+	}
+
+	//扩展文件并在原映射之后就地映射
+	if (ftruncate(grow_fd_, new_total) == -1) {
+		LOG_ERROR("MemHash::Grow ftruncate error[%d]. %s", errno, strerror(errno));
+		return -6;
+	}
+	int populate = option_.prefault == PREFAULT_POPULATE ? MAP_POPULATE : 0;
+	char *p = (char *)mmap(mem_base + start, new_total - start,
+			       PROT_READ | PROT_WRITE,
+			       MAP_SHARED | MAP_FIXED | populate, grow_fd_, start);
+	if (p == MAP_FAILED) {
+		LOG_ERROR("MemHash::Grow mmap error[%d]. %s", errno, strerror(errno));
+		if (ftruncate(grow_fd_, total_size) == -1)
+			LOG_ERROR("MemHash::Grow ftruncate error[%d]. %s",
+			    errno, strerror(errno));
+		return -6;
+	}
+	//新区域与打开时一样设置大页、NUMA策略并预取
+	if (bucket_time != 0)
+		ZoneAdvise(mem_base + node_offset, node_size * new_max_node + fp_size,
+			   option_.node_numa_policy, option_.node_numa_mask);
+	if (block_count != 0)
+		ZoneAdvise(mem_base + class_offset, end - class_offset,
+			   option_.block_numa_policy, option_.block_numa_mask);
+	if (option_.prefault == PREFAULT_PARALLEL)
+		Prefault(p, new_total - start);
+	if (mlock_open_flag == OPEN_MLOCK && mlock(p, new_total - start) == -1)
+		LOG_ERROR("MemHash::Grow mlock error[%d]. %s", errno, strerror(errno));
+	if (mlock_open_flag == NODE_MLOCK && bucket_time != 0 &&
+	    mlock(p, node_offset + node_size * new_max_node + fp_size - start) == -1)
+		LOG_ERROR("MemHash::Grow mlock error[%d]. %s", errno, strerror(errno));
+
+	//初始化新区域，切换布局之前不会被访问
+	struct mem_barrier tmp_barrier;
+	memcpy(tmp_barrier.barrier, "MEMHASHZ", 8);
+	struct mem_node *new_node = NULL;
+	if (bucket_time != 0) {
+		memcpy(mem_base + node_offset - sizeof(struct mem_barrier),
+		       &tmp_barrier, sizeof(struct mem_barrier));
+		new_node = (struct mem_node *)(mem_base + node_offset);
+		memset(new_node, 0, node_size * new_max_node + fp_size);
+		for (uint32_t i = 0; i < new_max_node; i++)
+			((struct mem_node *)((char *)new_node + i * node_size))->pos = -1;
+	}
+	uint32_t new_cls = class_num_;
+	if (block_count != 0) {
+		memcpy(mem_base + class_offset - sizeof(struct mem_barrier),
+		       &tmp_barrier, sizeof(struct mem_barrier));
+		memset(mem_base + class_offset, 0,
+		       (size_t)src_class->stride * block_count);
+		for (uint32_t j = 0; j < block_count; j++) {
+			struct mem_block *tmp_block = (struct mem_block *)(mem_base +
+					class_offset + (size_t)j * src_class->stride);
+			tmp_block->pos = j == block_count - 1 ? -1 :
+					 (int32_t)((new_cls << BLOCK_CLASS_SHIFT) | (j + 1));
+		}
+		head_ext_->class_free_pos[new_cls]   = new_cls << BLOCK_CLASS_SHIFT;
+		head_ext_->class_block_used[new_cls] = 0;
+	}
+	memcpy(mem_base + new_total - sizeof(struct mem_barrier),
+	       &tmp_barrier, sizeof(struct mem_barrier));
+	msync(p, new_total - start, MS_SYNC);
+
+	//写入新布局，之后崩溃时按新布局打开并继续迁移
+	struct layout_info layout;
+	LayoutFill(layout);
+	layout.grow_count++;
+	layout.total_size = new_total;
+	if (bucket_time != 0) {
+		layout.old_bucket_time = this->bucket_time;
+		layout.old_bucket_len  = this->bucket_len;
+		layout.old_node_offset = (char *)node_ - mem_base;
+		layout.bucket_time     = bucket_time;
+		layout.bucket_len      = bucket_len;
+		layout.node_offset     = node_offset;
+		layout.fp_num          = fp_ != NULL ? new_max_node : 0;
+	}
+	if (block_count != 0) {
+		layout.class_info_.class_num = new_cls + 1;
+		layout.class_info_.data_size[new_cls] = src_class->data_size;
+		layout.class_info_.count[new_cls]     = block_count;
+		layout.class_offset[new_cls]          = class_offset;
+	}
+	head_ext_->migrate_cursor = 0;
+	LayoutWrite(layout);
+
+	//切换内存中的布局，期间无锁读没有找到key时重查
+	__atomic_store_n(&layout_seq_, layout_seq_ + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	if (bucket_time != 0) {
+		struct mem_node *old_node = node_;
+		memcpy(old_bucket_, bucket, sizeof(old_bucket_));
+		memcpy(old_bucket_base_, bucket_base, sizeof(old_bucket_base_));
+		memcpy(old_bucket_m_, bucket_m, sizeof(old_bucket_m_));
+		old_bucket_time_ = this->bucket_time;
+		old_bucket_len_  = this->bucket_len;
+		old_max_node_    = max_node;
+
+		BucketInit(bucket_time, bucket_len);
+		fp_          = fp_ != NULL ? (uint16_t *)((char *)new_node +
+						node_size * new_max_node) : NULL;
+		fp_zone_size = fp_size;
+		node_        = new_node;
+		max_node     = new_max_node;
+		node_total_  = max_node + old_max_node_;
+		__atomic_store_n(&old_node_, old_node, __ATOMIC_RELEASE);
+	}
+	if (block_count != 0) {
+		struct block_class *cls = &classes_[new_cls];
+		cls->data_size = src_class->data_size;
+		cls->stride    = src_class->stride;
+		cls->count     = block_count;
+		cls->first     = max_block;
+		cls->offset    = class_offset;
+		cls->base      = mem_base + class_offset;
+		cls->free_pos  = &head_ext_->class_free_pos[new_cls];
+		cls->used      = &head_ext_->class_block_used[new_cls];
+		cls->map_hint  = 0;
+		//连续分配时新的一级全部空闲
+		if (extent_active_) {
+			cls->free_map = (uint64_t *)calloc(block_count / 64 + 1,
+							   sizeof(uint64_t));
+			if (cls->free_map == NULL) {
+				printf("MemHash::Grow calloc error.\n");
+				exit(-1);
+			}
+			for (uint32_t j = 0; j < block_count; j++)
+				cls->free_map[j >> 6] |= 1ULL << (j & 63);
+			*cls->free_pos = -1;
+		}
+		max_block       += block_count;
+		block_zone_size += (size_t)cls->stride * block_count;
+		__atomic_store_n(&class_num_, new_cls + 1, __ATOMIC_RELEASE);
+	}
+	total_size = new_total;
+	__atomic_store_n(&layout_seq_, layout_seq_ + 1, __ATOMIC_RELEASE);
+
+	LOG("[Grow][%u][bucket_time(%u)][bucket_len(%u)][max_node(%u)]"
+	    "[class(%u)][count(%u)][total_size(%lu)]",
+	    layout_info_.grow_count, this->bucket_time, this->bucket_len,
+	    max_node, block_count != 0 ? new_cls : 0, block_count,
+	    (uint64_t)total_size);
+	return 0;
+}
+
+int MemHash::MigrateStep(uint32_t budget_us)
+{
+	if (__atomic_load_n(&old_node_, __ATOMIC_ACQUIRE) == NULL)
+		return 0;
+
+	//后台效验完成之前旧区域的节点可能还没有效验
+	if (__atomic_load_n(&lazy_active_, __ATOMIC_ACQUIRE))
+		return 1;
+
+	uint64_t begin = NowUs();
+	do {
+		LockGuard guard(this, OpLock(0));
+		if (old_node_ == NULL)
+			return 0;
+
+		uint32_t end = head_ext_->migrate_cursor + MIGRATE_STEP_SIZE;
+		if (end > old_max_node_)
+			end = old_max_node_;
+		for (uint32_t i = head_ext_->migrate_cursor; i < end; i++) {
+			if (MigrateNode(NodeAt(max_node + i)) < 0) {
+				LOG_WARN("[Migrate][failed] no empty node for old node(%u)", i);
+				return -1;
+			}
+			//每个节点迁移完成后记录进度，崩溃后从该节点继续
+			head_ext_->migrate_cursor = i + 1;
+		}
+
+		if (end == old_max_node_) {
+			MigrateFinish();
+			return 0;
+		}
+	} while (NowUs() - begin < budget_us);
+
+	return 1;
+}
 
-			//效验成功，将该NODE节点下的所有BLOCK节点标记为已使用
-			tmp_block = GetBlock(tmp_node->pos); 
-			for (uint32_t j = 0; j < nbu; j++) {
-				SET_BLOCK_USED_FLAG(tmp_block->flag);
-				head_->block_used++;
-				tmp_block = GetBlock(tmp_block->pos);
-			}
-			
-			head_->node_used++;
+int MemHash::MigrateNode(struct mem_node* node)
+{
+	uint64_t key = node->key;
+	if (key == 0)
+		return 0;
+
+	struct mem_node *tmp_node = GetNodeNew(key);
+	if (tmp_node == NULL) {
+		for (uint32_t i = 0; i < bucket_time; i++) {
+			tmp_node = NodeAt(LevelIndex(key, i));
+			if (tmp_node->key == 0)
+				break;
+			tmp_node = NULL;
 		}
-		
+		if (tmp_node == NULL)
+			return -1;
+
+		//先写新节点，旧节点保持不变
+		ClaimNode(tmp_node, key);
+		SetFingerprint(tmp_node);
+		tmp_node->tval  = node->tval;
+		tmp_node->size  = node->size;
+		tmp_node->crc32 = node->crc32;
+		tmp_node->pos   = node->pos;
+		if (node->pos == INLINE_POS)
+			memcpy(NodeInline(tmp_node), NodeInline(node), inline_size);
+		NodeWriteEnd(tmp_node);
+		if (hot_ != NULL)
+			*NodeHot(tmp_node) = *NodeHot(node);
+	} else {
+		//新区域已有同样的节点，只清除旧节点
+		head_->node_used--;
 	}
-	
-	LOG("[CheckNodeBlock][finish]");
-	LOG("[STAT][free_block_pos(%d)]"
-			"[node_used(%u)]"
-			"[block_used(%u)]", 
-			head_->free_block_pos,
-			head_->node_used,
-			head_->block_used);
-	return ;
+
+	NodeWriteBegin(node);
+	ClearNode(node);
+	NodeWriteEnd(node);
+	DataChange(node_size);
+
+	return 0;
 }
 
-void MemHash::RecoverBlock()
+void MemHash::MigrateFinish()
 {
-	//根据BLOCK的标记位重建BLOCK空闲队列
-	struct mem_block *pre_block = block_;
-	struct mem_block *tmp_block = block_;
+	struct layout_info layout;
+	LayoutFill(layout);
+	layout.old_bucket_time = 0;
+	layout.old_bucket_len  = 0;
+	layout.old_node_offset = 0;
+	LayoutWrite(layout);
+	head_ext_->migrate_cursor = 0;
+
+	//旧区域仍然映射，还在访问旧区域的无锁读不受影响
+	__atomic_store_n(&layout_seq_, layout_seq_ + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	__atomic_store_n(&old_node_, (struct mem_node *)NULL, __ATOMIC_RELEASE);
+	old_max_node_ = 0;
+	node_total_   = max_node;
+	__atomic_store_n(&layout_seq_, layout_seq_ + 1, __ATOMIC_RELEASE);
+
+	LOG("[Migrate][finish][max_node(%u)][node_used(%u)]",
+	    max_node, head_->node_used);
+}
 
-	//查找第一个空闲的BLOCK节点
-	for (uint32_t i = 0; i < max_block; i++) {
-		pre_block = GetBlock(i);		
-		if (GET_BLOCK_USED_FLAG(pre_block->flag) != 1) {
-			head_->free_block_pos = i;
-			break;
+struct mem_block* MemHash::NextBlock(struct mem_block* block, uint32_t stride)
+{
+	if (stride != 0)
+		return (struct mem_block *)((char *)block + stride);
+
+	return GetBlock(block->pos);
+}
+
+uint32_t MemHash::ExtentStride(int32_t pos, struct mem_block* block)
+{
+	if (!GET_BLOCK_EXTENT_FLAG(block->flag))
+		return 0;
+
+	return classes_[(uint32_t)pos >> BLOCK_CLASS_SHIFT].stride;
+}
+
+void MemHash::DataChange(uint32_t bytes)
+{
+	//写入量越过阈值的那一次唤醒后台落地线程
+	if (flush_started_) {
+		__atomic_add_fetch(&write_gen_, 1, __ATOMIC_RELEASE);
+		uint64_t limit = option_.flush_dirty_bytes;
+		uint64_t dirty = __atomic_add_fetch(&flush_dirty_, bytes, __ATOMIC_RELAXED);
+		if (limit != 0 && dirty >= limit && dirty - bytes < limit) {
+			pthread_mutex_lock(&flush_lock_);
+			flush_request_ = 1;
+			pthread_cond_signal(&flush_cond_);
+			pthread_mutex_unlock(&flush_lock_);
 		}
+		return ;
 	}
-	
-	//重建空闲BLOCK队列
-	for (uint32_t i = head_->free_block_pos + 1; i < max_block; i++) {
-		tmp_block = GetBlock(i);		
-		if (GET_BLOCK_USED_FLAG(tmp_block->flag) != 1) {
-			pre_block->pos = i;
-			pre_block = tmp_block;
+
+	//共享模式下不同key的写操作可以同时进行
+	int change = __sync_add_and_fetch(&data_change, 1);
+	if ((msync_freq != 0) && (change > msync_freq)) {
+		data_change = 0;
+		MemSync(msync_flag);
+	}
+}
+
+//CLOCK_MONOTONIC下ms毫秒之后的时刻
+static void DeadlineAfter(struct timespec& ts, uint32_t ms)
+{
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	ts.tv_sec  += ms / 1000;
+	ts.tv_nsec += (long)(ms % 1000) * 1000000;
+	if (ts.tv_nsec >= 1000000000) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000;
+	}
+}
+
+void* MemHash::FlushWorker(void* arg)
+{
+	MemHash *mem = (MemHash *)arg;
+
+	pthread_mutex_lock(&mem->flush_lock_);
+	while (!mem->flush_stop_) {
+		//等到间隔时间、写入量达到阈值或者WaitDurable请求
+		if (!mem->flush_request_) {
+			if (mem->option_.flush_interval_ms != 0) {
+				struct timespec ts;
+				DeadlineAfter(ts, mem->option_.flush_interval_ms);
+				pthread_cond_timedwait(&mem->flush_cond_,
+						       &mem->flush_lock_, &ts);
+			} else {
+				pthread_cond_wait(&mem->flush_cond_, &mem->flush_lock_);
+			}
 		}
+		if (mem->flush_stop_)
+			break;
+		mem->flush_request_ = 0;
+
+		//先取写操作个数再落地，之前完成的写操作都已经在映射中
+		uint64_t gen = __atomic_load_n(&mem->write_gen_, __ATOMIC_ACQUIRE);
+		if (gen == mem->durable_gen_)
+			continue;
+		__atomic_store_n(&mem->flush_dirty_, 0, __ATOMIC_RELAXED);
+
+		pthread_mutex_unlock(&mem->flush_lock_);
+		mem->MemSync(MS_SYNC);
+		pthread_mutex_lock(&mem->flush_lock_);
+
+		mem->durable_gen_ = gen;
+		pthread_cond_broadcast(&mem->durable_cond_);
 	}
+	pthread_mutex_unlock(&mem->flush_lock_);
+
+	return NULL;
+}
 
-	//最后一个空闲BLOCK节点指向POS置为-1
-	pre_block->pos = -1;
+void MemHash::FlushStart()
+{
+	flush_stop_ = 0;
+	__atomic_store_n(&flush_started_, 1, __ATOMIC_RELEASE);
 
-	return ;
+	int ret = pthread_create(&flush_tid_, NULL, FlushWorker, this);
+	if (ret != 0) {
+		printf("MemHash::FlushStart pthread_create error[%d]. %s\n",
+		       ret, strerror(ret));
+		exit(-1);
+	}
 }
 
-struct mem_node* MemHash::GetNode(uint64_t key)
+void MemHash::FlushStop()
 {
-	struct mem_node *tmp_node = node_;
-	uint32_t base_pos = 0;
+	if (!flush_started_)
+		return ;
 
-	for (uint32_t i = 0; i < bucket_time; i++) {
-		if (i > 0) base_pos += bucket[i-1];
+	pthread_mutex_lock(&flush_lock_);
+	flush_stop_ = 1;
+	pthread_cond_signal(&flush_cond_);
+	pthread_mutex_unlock(&flush_lock_);
+	pthread_join(flush_tid_, NULL);
+	__atomic_store_n(&flush_started_, 0, __ATOMIC_RELEASE);
+
+	//最后落地一次，唤醒还在等待的WaitDurable
+	uint64_t gen = __atomic_load_n(&write_gen_, __ATOMIC_ACQUIRE);
+	MemSync(MS_SYNC);
+	pthread_mutex_lock(&flush_lock_);
+	durable_gen_ = gen;
+	pthread_cond_broadcast(&durable_cond_);
+	pthread_mutex_unlock(&flush_lock_);
+}
 
-		tmp_node = node_ + base_pos + (key % bucket[i]);
-		if (tmp_node->key == key) {
-			return tmp_node;
+int MemHash::WaitDurable(uint32_t timeout_ms)
+{
+	if (mem_base == NULL)
+		return -1;
+
+	if (!__atomic_load_n(&flush_started_, __ATOMIC_ACQUIRE)) {
+		MemSync(MS_SYNC);
+		return 0;
+	}
+
+	uint64_t gen = __atomic_load_n(&write_gen_, __ATOMIC_ACQUIRE);
+	struct timespec ts;
+	if (timeout_ms != 0)
+		DeadlineAfter(ts, timeout_ms);
+
+	int ret = 0;
+	pthread_mutex_lock(&flush_lock_);
+	if (durable_gen_ < gen) {
+		flush_request_ = 1;
+		pthread_cond_signal(&flush_cond_);
+	}
+	while (durable_gen_ < gen) {
+		if (timeout_ms == 0) {
+			pthread_cond_wait(&durable_cond_, &flush_lock_);
+		} else if (pthread_cond_timedwait(&durable_cond_, &flush_lock_,
+						  &ts) == ETIMEDOUT) {
+			ret = durable_gen_ < gen ? -1 : 0;
+			break;
 		}
 	}
+	pthread_mutex_unlock(&flush_lock_);
 
-	return NULL;
+	return ret;
 }
 
-struct mem_block* MemHash::GetBlock(int32_t pos)
+int MemHash::IsExist(uint64_t key)
 {
-	if (pos >= 0 && pos < (int32_t)max_block)
-		return block_ + pos;
-	else
-		return NULL;
+	return IsExistHint(key, NULL);
 }
 
-int MemHash::Del(uint64_t key)
+int MemHash::IsExistHint(uint64_t key, const struct node_hint* hint)
 {
-	struct mem_node *tmp_node = GetNode(key);
+	//防止key为0的情况
+	if (key == 0)
+		return -100;
+
+	if (option_.concurrent &&
+	    !__atomic_load_n(&lazy_active_, __ATOMIC_ACQUIRE)) {
+		int ret = IsExistOptimistic(key, hint);
+		if (ret != SEQ_READ_LOCKED)
+			return ret;
+	}
+
+	LockGuard guard(this, OpLock(key));
+
+	struct mem_node *tmp_node = HintNode(key, hint);
+	if (tmp_node == NULL) 
+		return 0;
+
+	//数据超时
+	if (Expired(tmp_node->tval, NodeTime())) {
+		DelForInner(key);
+		return 0;
+	}
+
+	return 1;
+}
+
+int MemHash::Get(uint64_t key, char* data, int max_len, int& data_len)
+{
+	return GetHint(key, data, max_len, data_len, NULL);
+}
+
+int MemHash::GetHint(uint64_t key, char* data, int max_len, int& data_len,
+		     const struct node_hint* hint)
+{
+	//防止key为0的情况
+	if (key == 0)
+		return -100;
+
+	if (option_.concurrent &&
+	    !__atomic_load_n(&lazy_active_, __ATOMIC_ACQUIRE)) {
+		int ret = GetOptimistic(key, data, max_len, data_len, hint);
+		if (ret != SEQ_READ_LOCKED)
+			return ret;
+	}
+
+	LockGuard guard(this, OpLock(key));
+
+	struct mem_node *tmp_node = HintNode(key, hint);
 	if (tmp_node == NULL) { 
-		LOG("[Del][%lu][failed] not find the key.", key);
+		LOG_DEBUG("[Get][%lu][failed] not find the key.", key);
+		EvictMiss();
 		return -1;
 	}
 
-	//该节点使用的BLOCK节点的个数
-	uint32_t nbu = GetNodeBlockUsed(tmp_node->size);
-	struct mem_block *tmp_block = GetBlock(tmp_node->pos);
-	tmp_node->key = 0;
-	head_->node_used--;
-
-	//处理前n-1个BLOCK节点
-	for (uint32_t i = 0; i < nbu - 1; i++) {
-		CLR_BLOCK_USED_FLAG(tmp_block->flag);	
-		tmp_block = GetBlock(tmp_block->pos);
+	if (tmp_node->size > (uint32_t)max_len) {
+		LOG_WARN("[Get][%lu][failed] node.size > buffer len.", key);
+		return -2;
 	}
-	
-	//处理最后一个BLOCK节点
-	CLR_BLOCK_USED_FLAG(tmp_block->flag);	
-	//增加BLOCK空闲队列
-	tmp_block->pos = head_->free_block_pos;
-	head_->free_block_pos = tmp_node->pos;
-	head_->block_used -= nbu;
-	
-	//处理NODE节点
-	tmp_node->crc32 = 0;
-	tmp_node->tval = 0;
-	tmp_node->size = 0;
-	tmp_node->pos = -1;
 
-	data_change++;
-	if ((msync_freq != 0) && (data_change > msync_freq)) {
-		data_change = 0;
-		MemSync(msync_flag);
+	//数据超时
+	time_t now = NodeTime();
+	if (Expired(tmp_node->tval, now)) {
+		LOG_DEBUG("[Get][%lu][failed] expired. tval[%ld] now[%ld]",
+				key, tmp_node->tval, now);
+		EvictMiss();
+		DelForInner(key);
+		return -3;
 	}
 
-	/*LOG("[Del][%lu][success]", key);
+	CopyValue(tmp_node, data);
+	data_len = tmp_node->size;
+	EvictHit(tmp_node);
+
+	/*LOG("[Get][%lu][success]", key);
 	LOG("[STAT][free_block_pos(%d)]"
 			"[node_used(%u)]"
 			"[block_used(%u)]", 
@@ -672,216 +4995,322 @@ int MemHash::Del(uint64_t key)
 			head_->block_used);*/
 
 	return 0;
+
 }
 
-void MemHash::DelForInner(uint64_t key)
+int MemHash::GetView(uint64_t key, MemView& view)
 {
+	view.Release();
+
+	//防止key为0的情况
+	if (key == 0)
+		return -100;
+
+	//BLOCK链由引用保护，查找期间持锁即可；共享模式下其他进程看不到引用，
+	//持key所在的锁直到view释放
+	pthread_mutex_t *lock = OpLock(key);
+	LockGuard guard(this, option_.shared ? NULL : lock);
+	if (option_.shared) {
+		LockMutex(lock);
+		view.lock_ = lock;
+	}
+
 	struct mem_node *tmp_node = GetNode(key);
 	if (tmp_node == NULL) { 
-		return ;
+		view.Release();
+		LOG_DEBUG("[GetView][%lu][failed] not find the key.", key);
+		EvictMiss();
+		return -1;
+	}
+
+	//数据超时
+	time_t now = NodeTime();
+	if (Expired(tmp_node->tval, now)) {
+		LOG_DEBUG("[GetView][%lu][failed] expired. tval[%ld] now[%ld]",
+				key, tmp_node->tval, now);
+		EvictMiss();
+		DelForInner(key);
+		view.Release();
+		return -3;
+	}
+
+	//内联的value只有一段，节点可能被覆盖或重用，复制到view中
+	if (tmp_node->pos == INLINE_POS) {
+		memcpy(view.inline_, NodeInline(tmp_node), tmp_node->size);
+		view.iov[0].iov_base = view.inline_;
+		view.iov[0].iov_len  = tmp_node->size;
+		view.iovcnt = 1;
+		view.size   = tmp_node->size;
+		EvictHit(tmp_node);
+		return 0;
 	}
 
+	uint32_t data_size = BlockDataSize(tmp_node->pos);
 	//该节点使用的BLOCK节点的个数
-	uint32_t nbu = GetNodeBlockUsed(tmp_node->size);
-	struct mem_block *tmp_block = GetBlock(tmp_node->pos);
-	tmp_node->key = 0;
-	head_->node_used--;
+	uint32_t nbu = GetNodeBlockUsed(tmp_node->size, data_size);
+	//该节点使用的最后一个BLOCK节点的偏移量
+	uint32_t lbu = GetLastBlockUsed(tmp_node->size, data_size);
 
-	//处理前n-1个BLOCK节点
-	for (uint32_t i = 0; i < nbu - 1; i++) {
-		CLR_BLOCK_USED_FLAG(tmp_block->flag);	
-		tmp_block = GetBlock(tmp_block->pos);
+	if (PinChain(tmp_node->pos) != 0) {
+		view.Release();
+		LOG_ERROR("[GetView][%lu][failed] pin chain error.", key);
+		return -4;
 	}
-	
-	//处理最后一个BLOCK节点
-	CLR_BLOCK_USED_FLAG(tmp_block->flag);	
-	//增加BLOCK空闲队列
-	tmp_block->pos = head_->free_block_pos;
-	head_->free_block_pos = tmp_node->pos;
-	head_->block_used -= nbu;
-	
-	//处理NODE节点
-	tmp_node->crc32 = 0;
-	tmp_node->tval = 0;
-	tmp_node->size = 0;
-	tmp_node->pos = -1;
+	view.mem_     = this;
+	view.pin_pos_ = tmp_node->pos;
 
-}
+	struct mem_block *tmp_block = GetBlock(tmp_node->pos);
+	uint32_t stride = ExtentStride(tmp_node->pos, tmp_block);
+	for (uint32_t j = 0; j < nbu; j++) {
+		view.iov[j].iov_base = tmp_block->data;
+		view.iov[j].iov_len  = j == nbu - 1 ? lbu : data_size;
+		if (j < nbu - 1)
+			tmp_block = NextBlock(tmp_block, stride);
+	}
+	view.iovcnt = nbu;
+	view.size   = tmp_node->size;
+	EvictHit(tmp_node);
 
+	return 0;
+}
 
-int MemHash::Set(uint64_t key, const char* data, int len)
+int MemHash::GetSize(uint64_t key, uint32_t& size)
 {
 	//防止key为0的情况
 	if (key == 0)
 		return -100;
 
-	const char *start_data = data;
-	//该数据要使用的BLOCK节点的个数
-	uint32_t nbu = GetNodeBlockUsed(len);
-	//该数据要使用的最后一个BLOCK节点的偏移量
-	uint32_t lbu = GetLastBlockUsed(len);
-	
-	if (nbu > MAX_BLOCK_NUM) { 	
-		LOG("[Set][%lu][failed] blocks > MAX_BLOCK_NUM[%u]",
-		     key, MAX_BLOCK_NUM);
-		return -1;
+	if (option_.concurrent &&
+	    !__atomic_load_n(&lazy_active_, __ATOMIC_ACQUIRE)) {
+		int ret = GetSizeOptimistic(key, size);
+		if (ret != SEQ_READ_LOCKED)
+			return ret;
 	}
 
-	if (nbu > max_block - head_->block_used) { 	
-		LOG("[Set][%lu][failed] blocks > free blocks num [%u]",
-		     key, max_block - head_->block_used);
-		return -2;
-	}
-	
-	struct mem_node *tmp_node = NULL;
-	uint32_t base_pos = 0;
+	LockGuard guard(this, OpLock(key));
 
-	//调用Del调用
-	DelForInner(key);
+	struct mem_node *tmp_node = GetNode(key);
+	if (tmp_node == NULL)
+		return -1;
 
-	time_t cur_time = time(0);
-	for (uint32_t i = 0; i < bucket_time; i++) {
-		if (i > 0) base_pos += bucket[i-1];
+	//数据超时
+	if (Expired(tmp_node->tval, NodeTime())) {
+		DelForInner(key);
+		return -3;
+	}
 
-		tmp_node = node_ + base_pos + (key % bucket[i]);
+	size = tmp_node->size;
+	return 0;
+}
 
-		//数据超时
-		if (tmp_node->key != 0 && data_store_time != 0) {
-			time_t interval = cur_time - tmp_node->tval;
-			if (interval > data_store_time) {
-				DelForInner(tmp_node->key);
-			}
+int MemHash::GetSizeOptimistic(uint64_t key, uint32_t& size)
+{
+	for (uint32_t retry = 0; retry < SEQ_READ_RETRY; retry++) {
+		uint32_t layout_seq = __atomic_load_n(&layout_seq_, __ATOMIC_ACQUIRE);
+		struct mem_node *tmp_node = GetNode(key);
+		if (tmp_node == NULL) {
+			if (LayoutChanged(layout_seq))
+				continue;
+			return -1;
 		}
 
-		//查找空闲的NODE节点
-		if (tmp_node->key == 0) {
-			head_->node_used++;
-			int32_t pre_free_pos = head_->free_block_pos;
-			struct mem_block *tmp_block = GetBlock(pre_free_pos);
-			//处理前n-1个BLOCK节点
-			for (uint32_t j = 0; j < nbu - 1; j++) {
-				head_->block_used++;
-				SET_BLOCK_USED_FLAG(tmp_block->flag);
-				memcpy(tmp_block->data, data, BLOCK_DATA_SIZE);
-				data += BLOCK_DATA_SIZE;
-				tmp_block = GetBlock(tmp_block->pos);
-			}
-			
-			//处理最后一个BLOCK节点
-			head_->block_used++;
-			SET_BLOCK_USED_FLAG(tmp_block->flag);
-			memcpy(tmp_block->data, data, lbu);
-			head_->free_block_pos = tmp_block->pos;
-			tmp_block->pos  = -1;
-
-			tmp_node->pos   = pre_free_pos;
-			tmp_node->crc32 = Crc32Compute(start_data, len);
-			tmp_node->tval  = time(0);		
-			tmp_node->size  = len;
-			tmp_node->key   = key;
+		uint32_t seq = __atomic_load_n(&tmp_node->seq, __ATOMIC_ACQUIRE);
+		if ((seq & 1) || tmp_node->key != key)
+			continue;
 
-			data_change++;
-			if ((msync_freq != 0) && (data_change > msync_freq)) {
-				data_change = 0;
-				MemSync(msync_flag);
-			}
+		uint32_t tmp_size = tmp_node->size;
+		time_t   tval     = tmp_node->tval;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&tmp_node->seq, __ATOMIC_RELAXED) != seq)
+			continue;
 
-			/*LOG("[Set][%lu][success]", key);
-			LOG("[STAT][free_block_pos(%d)]"
-					"[node_used(%u)]"
-					"[block_used(%u)]", 
-					head_->free_block_pos,
-					head_->node_used,
-					head_->block_used);*/
-		
-			return 0;
-		} 
-	}
+		//数据超时需要删除，交给加锁路径处理
+		if (Expired(tval, NodeTime()))
+			return SEQ_READ_LOCKED;
 
-	LOG("[Set][%lu][failed] no empty node", key);
+		size = tmp_size;
+		return 0;
+	}
 
-	return -3;
+	return SEQ_READ_LOCKED;
 }
 
-
-int MemHash::IsExist(uint64_t key)
+int MemHash::GetOptimistic(uint64_t key, char* data, int max_len, int& data_len,
+			   const struct node_hint* hint)
 {
-	//防止key为0的情况
-	if (key == 0)
-		return -100;
+	for (uint32_t retry = 0; retry < SEQ_READ_RETRY; retry++) {
+		//第一次使用预取到的节点，重读时重新查找
+		uint32_t layout_seq = __atomic_load_n(&layout_seq_, __ATOMIC_ACQUIRE);
+		struct mem_node *tmp_node = NULL;
+		if (retry == 0 && hint != NULL && hint->valid) {
+			layout_seq = hint->layout_seq;
+			tmp_node   = hint->node;
+		} else {
+			tmp_node   = GetNode(key);
+		}
+		if (tmp_node == NULL) { 
+			if (LayoutChanged(layout_seq))
+				continue;
+			LOG_DEBUG("[Get][%lu][failed] not find the key.", key);
+			EvictMiss();
+			return -1;
+		}
 
-	struct mem_node *tmp_node = GetNode(key);
-	if (tmp_node == NULL) 
-		return 0;
+		uint32_t seq = __atomic_load_n(&tmp_node->seq, __ATOMIC_ACQUIRE);
+		if ((seq & 1) || tmp_node->key != key)
+			continue;
 
-	//数据超时
-	if (data_store_time != 0) { 
-		time_t interval = time(0) - tmp_node->tval;
-		if (interval > data_store_time) {
-			DelForInner(key);
+		uint32_t size = tmp_node->size;
+		time_t   tval = tmp_node->tval;
+		int32_t  pos  = tmp_node->pos;
+
+		//数据超时需要删除，交给加锁路径处理
+		if (Expired(tval, NodeTime()))
+			return SEQ_READ_LOCKED;
+
+		if (size > (uint32_t)max_len) {
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			if (__atomic_load_n(&tmp_node->seq, __ATOMIC_RELAXED) != seq)
+				continue;
+			LOG_WARN("[Get][%lu][failed] node.size > buffer len.", key);
+			return -2;
+		}
+
+		//内联的value直接从NODE节点拷贝
+		if (pos == INLINE_POS) {
+			if (size > inline_size)
+				continue;
+			memcpy(data, NodeInline(tmp_node), size);
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			if (__atomic_load_n(&tmp_node->seq, __ATOMIC_RELAXED) != seq)
+				continue;
+			data_len = size;
+			EvictHit(tmp_node);
 			return 0;
-		}       
-	} 
+		}
 
-	return 1;
+		//偏移量可能正在被修改，级别非法时重读
+		uint32_t data_size = BlockDataSize(pos);
+		if (data_size == 0)
+			continue;
+		//该节点使用的BLOCK节点的个数
+		uint32_t nbu = GetNodeBlockUsed(size, data_size);
+		//该节点使用的最后一个BLOCK节点的偏移量
+		uint32_t lbu = GetLastBlockUsed(size, data_size);
+		if (nbu == 0 || nbu > MAX_BLOCK_NUM)
+			continue;
+
+		//BLOCK链可能正在被修改，每一跳都检查偏移量
+		struct mem_block *tmp_block = GetBlock(pos);
+		if (tmp_block == NULL)
+			continue;
+		//连续区段不能越过所在级别的末尾
+		uint32_t stride = ExtentStride(pos, tmp_block);
+		if (stride != 0 && ((uint32_t)pos & BLOCK_INDEX_MASK) + nbu >
+		    classes_[(uint32_t)pos >> BLOCK_CLASS_SHIFT].count)
+			continue;
+		char *tmp_buf = data;
+		for (uint32_t j = 0; j < nbu - 1 && tmp_block != NULL; j++) {
+			memcpy(tmp_buf, tmp_block->data, data_size);
+			tmp_buf += data_size;
+			tmp_block = NextBlock(tmp_block, stride);
+		}	
+		if (tmp_block == NULL)
+			continue;
+		memcpy(tmp_buf, tmp_block->data, lbu);
+
+		//拷贝期间节点被修改过（包括BLOCK被回收重用），重读
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&tmp_node->seq, __ATOMIC_RELAXED) != seq)
+			continue;
+
+		data_len = size;
+		EvictHit(tmp_node);
+		return 0;
+	}
+
+	return SEQ_READ_LOCKED;
 }
 
-int MemHash::Get(uint64_t key, char* data, int max_len, int& data_len)
+int MemHash::IsExistOptimistic(uint64_t key, const struct node_hint* hint)
 {
-	//防止key为0的情况
-	if (key == 0)
-		return -100;
+	for (uint32_t retry = 0; retry < SEQ_READ_RETRY; retry++) {
+		//第一次使用预取到的节点，重读时重新查找
+		uint32_t layout_seq = __atomic_load_n(&layout_seq_, __ATOMIC_ACQUIRE);
+		struct mem_node *tmp_node = NULL;
+		if (retry == 0 && hint != NULL && hint->valid) {
+			layout_seq = hint->layout_seq;
+			tmp_node   = hint->node;
+		} else {
+			tmp_node   = GetNode(key);
+		}
+		if (tmp_node == NULL) {
+			if (LayoutChanged(layout_seq))
+				continue;
+			return 0;
+		}
 
-	struct mem_node *tmp_node = GetNode(key);
-	if (tmp_node == NULL) { 
-		LOG("[Get][%lu][failed] not find the key.", key);
-		return -1;
-	}
+		uint32_t seq = __atomic_load_n(&tmp_node->seq, __ATOMIC_ACQUIRE);
+		if ((seq & 1) || tmp_node->key != key)
+			continue;
 
-	if (tmp_node->size > (uint32_t)max_len) {
-		LOG("[Get][%lu][failed] node.size > buffer len.", key);
-		return -2;
-	}
+		time_t tval = tmp_node->tval;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&tmp_node->seq, __ATOMIC_RELAXED) != seq)
+			continue;
 
-	//数据超时
-	if (data_store_time != 0) {
-		time_t interval = time(0) - tmp_node->tval;
-		if (interval > data_store_time) {
-			DelForInner(key);
-			LOG("[Get][%lu][failed] interval[%lu] > data_store_time[%lu]",
-					interval, data_store_time, key);
-			return -3;
-		}
+		//数据超时需要删除，交给加锁路径处理
+		if (Expired(tval, NodeTime()))
+			return SEQ_READ_LOCKED;
+
+		return 1;
 	}
 
-	//该节点使用的BLOCK节点的个数
-	uint32_t nbu = GetNodeBlockUsed(tmp_node->size);
-	//该节点使用的最后一个BLOCK节点的偏移量
-	uint32_t lbu = GetLastBlockUsed(tmp_node->size);
+	return SEQ_READ_LOCKED;
+}
 
-	struct mem_block *tmp_block = GetBlock(tmp_node->pos);
-	char *tmp_buf = data;
-	//处理前n-1个BLOCK节点
-	for (uint32_t j = 0; j < nbu - 1; j++) {
-		memcpy(tmp_buf, tmp_block->data, BLOCK_DATA_SIZE);
-		tmp_buf += BLOCK_DATA_SIZE;
-		tmp_block = GetBlock(tmp_block->pos);
-	}	
+void MemHash::NodeWriteBegin(struct mem_node* node)
+{
+	if (snap_done_ != NULL)
+		SnapshotCapture(node);
+	//崩溃遗留的奇数seq保持为奇数
+	__atomic_store_n(&node->seq, node->seq | 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
 
-	//处理最后一个BLOCK节点
-	memcpy(tmp_buf, tmp_block->data, lbu);
-	data_len = tmp_node->size;
+void MemHash::NodeWriteEnd(struct mem_node* node)
+{
+	__atomic_store_n(&node->seq, node->seq + 1, __ATOMIC_RELEASE);
+	MarkDirty(node, node_size);
+}
 
-	/*LOG("[Get][%lu][success]", key);
-	LOG("[STAT][free_block_pos(%d)]"
-			"[node_used(%u)]"
-			"[block_used(%u)]", 
-			head_->free_block_pos,
-			head_->node_used,
-			head_->block_used);*/
+int MemHash::LayoutChanged(uint32_t seq)
+{
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return (seq & 1) || __atomic_load_n(&layout_seq_, __ATOMIC_RELAXED) != seq;
+}
 
-	return 0;
+int MemHash::ClaimNode(struct mem_node* node, uint64_t key)
+{
+	if (!option_.shared && !import_active_) {
+		NodeWriteBegin(node);
+		node->key = key;
+		return 1;
+	}
+
+	//其他进程持有不同的锁（或者并行导入的其他线程），通过seq由偶数变为奇数抢占节点
+	//共享模式下持空闲队列锁抢占并写入key，seq为奇数且key为0的节点只在持该锁时出现
+	LockGuard guard(this, option_.shared ? FreeLock() : NULL);
+	uint32_t seq = __atomic_load_n(&node->seq, __ATOMIC_ACQUIRE);
+	if ((seq & 1) || node->key != 0)
+		return 0;
+
+	if (!__atomic_compare_exchange_n(&node->seq, &seq, seq + 1, 0,
+					 __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+		return 0;
 
+	node->key = key;
+	return 1;
 }
 
 int MemHash::Append(uint64_t key, const char* data, int len)
@@ -890,51 +5319,84 @@ int MemHash::Append(uint64_t key, const char* data, int len)
 	if (key == 0)
 		return -100;
 
+	LockGuard guard(this, OpLock(key));
+
 	const char *start_data = data;
 	struct mem_node *tmp_node = GetNode(key);
 	if (tmp_node == NULL) { 
-		LOG("[Append][%lu] node not exist call [Set]", key);
+		LOG_DEBUG("[Append][%lu] node not exist call [Set]", key);
 		return  Set(key, data, len);
 	}
 
 	//数据超时
-	time_t cur_time = time(0);
-	if (data_store_time != 0) {
-		time_t interval = cur_time - tmp_node->tval;
-		if (interval > data_store_time) {
-			DelForInner(key);
-			return  Set(key, data, len);
-		}
+	if (Expired(tmp_node->tval, NodeTime())) {
+		DelForInner(key);
+		return  Set(key, data, len);
 	}
 
-	//append之后总共使用的BLOCK个数
-	uint32_t total_nbu = GetNodeBlockUsed((tmp_node->size + len));
-	
-	if (total_nbu > MAX_BLOCK_NUM) { 	
-		LOG("[Append][%lu][failed] blocks > MAX_BLOCK_NUM[%u]",
-		     key, MAX_BLOCK_NUM);
+	if (len <= 0 || tmp_node->size + len > MaxValueLen()) { 	
+		LOG_WARN("[Append][%lu][failed] len > max value len[%u]",
+		     key, MaxValueLen());
 		return -1;
 	}
 
+	//内联的value在NODE节点中容纳得下时原地追加，否则转为BLOCK存储
+	if (tmp_node->pos == INLINE_POS) {
+		if (tmp_node->size + len > inline_size)
+			return AppendRelocate(key, tmp_node, data, len);
+
+		//写入的是size之外的区域，并发读不会读到
+		char *tail = NodeInline(tmp_node) + tmp_node->size;
+		memcpy(tail, data, len);
+		NodeWriteBegin(tmp_node);
+		tmp_node->size += len;
+		tmp_node->crc32 = Crc32Append(tmp_node->crc32, tail, len);
+		NodeWriteEnd(tmp_node);
+
+		DataChange(len);
+
+		return 0;
+	}
+
+	//BLOCK链所在的级别
+	uint32_t cls       = (uint32_t)tmp_node->pos >> BLOCK_CLASS_SHIFT;
+	uint32_t data_size = classes_[cls].data_size;
+	//append之后总共使用的BLOCK个数
+	uint32_t total_nbu = GetNodeBlockUsed(tmp_node->size + len, data_size);
+	
+	//超出当前级别的最大长度，按新长度重新选择级别
+	if (total_nbu > MAX_BLOCK_NUM)
+		return AppendRelocate(key, tmp_node, data, len);
+
 	//该节点现在使用的BLOCK个数
-	uint32_t nbu = GetNodeBlockUsed(tmp_node->size);
+	uint32_t nbu = GetNodeBlockUsed(tmp_node->size, data_size);
 	//该节点最后一个BLOCK偏移量
-	uint32_t lbu = GetLastBlockUsed(tmp_node->size);
-
-	//寻找最后一个BLOCK节点
-	struct mem_block *tmp_block = GetBlock(tmp_node->pos);
-	for (uint32_t i = 0; i < nbu - 1; i++) {
-		tmp_block = GetBlock(tmp_block->pos);
+	uint32_t lbu = GetLastBlockUsed(tmp_node->size, data_size);
+
+	//寻找最后一个BLOCK节点，连续区段直接计算地址
+	struct mem_block *head_block = GetBlock(tmp_node->pos);
+	struct mem_block *tmp_block  = head_block;
+	uint32_t stride = ExtentStride(tmp_node->pos, head_block);
+	if (stride != 0) {
+		tmp_block = (struct mem_block *)((char *)head_block +
+						 (size_t)(nbu - 1) * stride);
+	} else {
+		for (uint32_t i = 0; i < nbu - 1; i++)
+			tmp_block = GetBlock(tmp_block->pos);
 	}
 	struct mem_block *last_block = tmp_block;
 
 	//新增数据在最后一个BLOCK节点可以容纳下
-	if ((uint32_t)len <= BLOCK_DATA_SIZE - lbu) {
+	if ((uint32_t)len <= data_size - lbu) {
+		//写入的是size之外的区域，并发读不会读到
 		memcpy(last_block->data + lbu, data, len);
+		MarkDirty(last_block->data + lbu, len);
+		NodeWriteBegin(tmp_node);
 		tmp_node->size += len;
 		tmp_node->crc32 = Crc32Append(tmp_node->crc32,
 					last_block->data + lbu,
 					len);	
+		NodeWriteEnd(tmp_node);
 
 		/*LOG("[Append][%lu][success]", key);
 		LOG("[STAT][free_block_pos(%d)]"
@@ -944,61 +5406,41 @@ int MemHash::Append(uint64_t key, const char* data, int len)
 				head_->node_used,
 				head_->block_used);*/
 
-		data_change++;
-		if ((msync_freq != 0) && (data_change > msync_freq)) {
-			data_change = 0;
-			MemSync(msync_flag);
-		}
+		DataChange(len);
 
 		return 0;
 	} else {
 		//新增数据在最后一个BLOCK节点容纳不下了
 		//需要新增BLOCK的数据量
-		uint32_t left = len - (BLOCK_DATA_SIZE - lbu);
+		uint32_t left = len - (data_size - lbu);
 		//剩下的数据需要的BLOCK节点数目
-		uint32_t left_nbu = GetNodeBlockUsed(left);
-		//剩下的数据的最后一个BLOCK节点的偏移量
-		uint32_t left_lbu = GetLastBlockUsed(left);
+		uint32_t left_nbu = GetNodeBlockUsed(left, data_size);
 		
-		if (left_nbu > max_block - head_->block_used) {
-			LOG("[Append][%lu][failed] blocks > free blocks num [%u]",
-			     key, max_block - head_->block_used);
-			return -2;
-		}
+		while (lazy_active_ && left_nbu > FreeBlockNum(cls))
+			LazyScavenge(left, cls);
 
-		//填充最后一个BLOCK节点
-		memcpy(last_block->data + lbu, data, BLOCK_DATA_SIZE - lbu);
-		data += BLOCK_DATA_SIZE - lbu;
-
-		//处理剩余数据量的前n-1个BLOCK节点
-		int32_t pre_free_pos = head_->free_block_pos;
-		tmp_block = GetBlock(pre_free_pos);
-		for (uint32_t j = 0; j < left_nbu - 1; j++) {
-			head_->block_used++;
-			SET_BLOCK_USED_FLAG(tmp_block->flag);
-			memcpy(tmp_block->data, data, BLOCK_DATA_SIZE);
-			data += BLOCK_DATA_SIZE;
-			tmp_block = GetBlock(tmp_block->pos);
-		}
+		//剩余数据写入新分配的BLOCK节点，当前级别不够时换级别
+		int32_t pre_free_pos = AllocBlockChain(cls,
+				data + data_size - lbu, left);
+		if (pre_free_pos < 0)
+			return AppendRelocate(key, tmp_node, data, len);
 
-		//处理剩余数据量的最后一个BLOCK节点
-		head_->block_used++;
-		SET_BLOCK_USED_FLAG(tmp_block->flag);
-		memcpy(tmp_block->data, data, left_lbu);
+		//填充最后一个BLOCK节点
+		memcpy(last_block->data + lbu, data, data_size - lbu);
 
+		NodeWriteBegin(tmp_node);
 		tmp_node->crc32 = Crc32Append(tmp_node->crc32,
 				start_data,
 				len);	
-		head_->free_block_pos = tmp_block->pos;
-		tmp_block->pos  = -1;
 		last_block->pos = pre_free_pos;
+		//新分配的BLOCK链接在后面，整条链不再连续
+		CLR_BLOCK_EXTENT_FLAG(head_block->flag);
 		tmp_node->size += len;
+		NodeWriteEnd(tmp_node);
+		MarkDirty(last_block, classes_[cls].stride);
+		MarkDirty(head_block, offsetof(struct mem_block, data));
 
-		data_change++;
-		if ((msync_freq != 0) && (data_change > msync_freq)) {
-			data_change = 0;
-			MemSync(msync_flag);
-		}
+		DataChange(len);
 
 		/*LOG("[Append][%lu][success]", key);
 		LOG("[STAT][free_block_pos(%d)]"
@@ -1012,15 +5454,245 @@ int MemHash::Append(uint64_t key, const char* data, int len)
 	}
 }
 
+int MemHash::AppendRelocate(uint64_t key, struct mem_node* node,
+			    const char* data, int len)
+{
+	uint32_t size = node->size;
+	char *buf = (char *)malloc(size + len);
+	if (buf == NULL) {
+		LOG_ERROR("[Append][%lu][failed] malloc error.", key);
+		return -2;
+	}
+
+	//拷贝旧值后整体Set，Set会原地替换并回收旧的BLOCK链
+	CopyValue(node, buf);
+	memcpy(buf + size, data, len);
+
+	//SetWithTTL写入的超时时刻保持不变
+	time_t now = NodeTime();
+	int ret = SetNode(key, buf, size + len,
+			  (node->tval & (time_t)TVAL_DEADLINE) ? node->tval : now, now);
+	free(buf);
+
+	return ret;
+}
+
+int MemHash::MultiGet(const uint64_t* keys, int num, char* const* data,
+		      const int* max_len, int* data_len, int* ret)
+{
+	struct mem_node *node[MULTI_WINDOW];
+	struct node_hint hint;
+	int ok = 0;
+	for (int b = 0; b < num; b += MULTI_WINDOW) {
+		int n = num - b < (int)MULTI_WINDOW ? num - b : (int)MULTI_WINDOW;
+		hint.valid = MultiPrefetch(keys + b, n, 1, 0, node, hint.layout_seq);
+		for (int i = b; i < b + n; i++) {
+			hint.node = node[i - b];
+			data_len[i] = 0;
+			ret[i] = GetHint(keys[i], data[i], max_len[i], data_len[i], &hint);
+			ok += ret[i] == 0;
+		}
+	}
+
+	return ok;
+}
+
+int MemHash::MultiIsExist(const uint64_t* keys, int num, int* ret)
+{
+	struct mem_node *node[MULTI_WINDOW];
+	struct node_hint hint;
+	int exist = 0;
+	for (int b = 0; b < num; b += MULTI_WINDOW) {
+		int n = num - b < (int)MULTI_WINDOW ? num - b : (int)MULTI_WINDOW;
+		hint.valid = MultiPrefetch(keys + b, n, 0, 0, node, hint.layout_seq);
+		for (int i = b; i < b + n; i++) {
+			hint.node = node[i - b];
+			ret[i] = IsExistHint(keys[i], &hint);
+			exist += ret[i] == 1;
+		}
+	}
+
+	return exist;
+}
+
+int MemHash::MultiSet(const uint64_t* keys, int num, const char* const* data,
+		      const int* len, int* ret)
+{
+	struct mem_node *node[MULTI_WINDOW];
+	struct node_hint hint;
+	int ok = 0;
+	for (int b = 0; b < num; b += MULTI_WINDOW) {
+		int n = num - b < (int)MULTI_WINDOW ? num - b : (int)MULTI_WINDOW;
+		//整个窗口持锁，预取时没有找到的key在写入之前不会被其他线程写入
+		LockGuard guard(this, option_.shared ? NULL : OpLock(0));
+		//新value写入新分配的BLOCK，只预取NODE节点
+		int valid = MultiPrefetch(keys + b, n, 0, 1, node, hint.layout_seq);
+		time_t now = NodeTime();
+		for (int i = b; i < b + n; i++) {
+			//窗口内重复的key已被前面的Set写入，重新查找
+			hint.node  = node[i - b];
+			hint.valid = valid;
+			for (int j = b; j < i && hint.valid; j++)
+				hint.valid = keys[j] != keys[i];
+			ret[i] = SetNode(keys[i], data[i], len[i], now, now, &hint);
+			ok += ret[i] == 0;
+		}
+	}
+
+	return ok;
+}
+
+void MemHash::WillNeed(const void* p, uint32_t len)
+{
+	if (p == NULL)
+		return ;
+
+	size_t page  = sysconf(_SC_PAGESIZE);
+	char  *begin = (char *)((uintptr_t)p & ~(uintptr_t)(page - 1));
+	madvise(begin, (const char *)p + len - begin, MADV_WILLNEED);
+}
+
+void MemHash::PrefetchRange(const char* p, uint32_t len, int write)
+{
+	for (uint32_t off = 0; off < len; off += CACHE_LINE_SIZE) {
+		if (write)
+			__builtin_prefetch(p + off, 1);
+		else
+			__builtin_prefetch(p + off, 0);
+	}
+}
+
+int MemHash::MultiPrefetch(const uint64_t* keys, int num, int with_value,
+			   int write, struct mem_node** node, uint32_t& layout_seq)
+{
+	struct mem_block *block[MULTI_WINDOW];
+	//BLOCK链所在级别的数据区大小及还没有预取的value长度
+	uint32_t          data_size[MULTI_WINDOW];
+	uint32_t          left[MULTI_WINDOW];
+	uint32_t          stride[MULTI_WINDOW];
+	int               pending[MULTI_WINDOW];
+	int               npending = 0;
+
+	//迁移期间key可能在旧区域，共享模式下其他进程的写入及扩容不经过本进程，
+	//lazy效验期间节点需要先效验：这些情况下查找结果只作为预取提示
+	layout_seq = __atomic_load_n(&layout_seq_, __ATOMIC_ACQUIRE);
+	int valid = !option_.shared && !(layout_seq & 1) &&
+		    !__atomic_load_n(&lazy_active_, __ATOMIC_ACQUIRE) &&
+		    __atomic_load_n(&old_node_, __ATOMIC_ACQUIRE) == NULL;
+
+	for (int i = 0; i < num; i++) {
+		node[i] = NULL;
+		if (keys[i] != 0)
+			pending[npending++] = i;
+	}
+
+	//逐阶推进：先为所有未找到的key发出预取，再逐个比较，cache miss在key之间重叠
+	for (uint32_t level = 0; level < bucket_time && npending > 0; level++) {
+		for (int j = 0; j < npending; j++)
+			PrefetchRange((char *)NodeAt(LevelIndex(keys[pending[j]], level)),
+				      sizeof(struct mem_node), write);
+
+		int next = 0;
+		for (int j = 0; j < npending; j++) {
+			int i = pending[j];
+			struct mem_node *tmp_node = NodeAt(LevelIndex(keys[i], level));
+			if (tmp_node->key == keys[i])
+				node[i] = tmp_node;
+			else
+				pending[next++] = i;
+		}
+		npending = next;
+	}
+
+	if (!with_value)
+		return valid;
+
+	//BLOCK可能已换出：读取任何一个之前，先为所有key的第一个BLOCK发出预读，
+	//缺页的磁盘读取在key之间重叠
+	if (option_.willneed) {
+		for (int i = 0; i < num; i++) {
+			if (node[i] != NULL && node[i]->pos != INLINE_POS)
+				WillNeed(GetBlock(node[i]->pos), sizeof(struct mem_block));
+		}
+	}
+
+	//找到的key预取内联数据或者第一个BLOCK
+	for (int i = 0; i < num; i++) {
+		block[i] = NULL;
+		if (node[i] == NULL)
+			continue;
+
+		uint32_t size = node[i]->size;
+		int32_t  pos  = node[i]->pos;
+		if (pos == INLINE_POS) {
+			PrefetchRange(NodeInline(node[i]),
+				      size < inline_size ? size : inline_size, 0);
+			continue;
+		}
+
+		data_size[i] = BlockDataSize(pos);
+		block[i]     = GetBlock(pos);
+		left[i]      = size;
+		if (data_size[i] == 0 || block[i] == NULL) {
+			block[i] = NULL;
+			continue;
+		}
+		//连续区段不能越过所在级别的末尾
+		stride[i] = ExtentStride(pos, block[i]);
+		if (stride[i] != 0 && ((uint32_t)pos & BLOCK_INDEX_MASK) +
+		    GetNodeBlockUsed(size, data_size[i]) >
+		    classes_[(uint32_t)pos >> BLOCK_CLASS_SHIFT].count)
+			stride[i] = 0;
+		PrefetchRange((char *)block[i], offsetof(struct mem_block, data) +
+			      (size < data_size[i] ? size : data_size[i]), 0);
+	}
+
+	//逐跳推进BLOCK链，每一跳为所有key发出预取
+	for (uint32_t hop = 1; hop < MAX_BLOCK_NUM; hop++) {
+		int more = 0;
+		for (int i = 0; i < num; i++) {
+			if (block[i] == NULL)
+				continue;
+
+			if (left[i] <= data_size[i]) {
+				block[i] = NULL;
+				continue;
+			}
+			left[i] -= data_size[i];
+			block[i] = NextBlock(block[i], stride[i]);
+			if (block[i] == NULL)
+				continue;
+			PrefetchRange((char *)block[i], offsetof(struct mem_block, data) +
+				      (left[i] < data_size[i] ? left[i] : data_size[i]), 0);
+			//下一跳读取之前为所有key的这一跳发出预读
+			if (option_.willneed)
+				WillNeed(block[i], offsetof(struct mem_block, data) +
+					 (left[i] < data_size[i] ? left[i] : data_size[i]));
+			more = 1;
+		}
+		if (!more)
+			break;
+	}
+
+	return valid;
+}
+
 int MemHash::ForEachKey(uint64_t& key)
 {
 	if (key == 0)
 		foreach_key_pos = 0;
+
+	//共享模式下遍历不加锁，只读取key
+	LockGuard guard(this, OpLock(0));
 	
 	struct mem_node *tmp_node = NULL;
 	uint32_t i = 0;
-	for (i = foreach_key_pos; i < max_node; i++) {
-		tmp_node = node_ + i;
+	for (i = foreach_key_pos; i < node_total_; i++) {
+		//迁移期间先遍历旧区域，正在迁移的key可能重复但不会遗漏
+		uint32_t index = i < old_max_node_ ? max_node + i : i - old_max_node_;
+		tmp_node = NodeAt(index);
+		if (lazy_active_ && tmp_node->key != 0)
+			LazyVerify(index);
 		//遍历所有的非空NODE节点
 		if (tmp_node->key != 0) {
 			key = tmp_node->key;
@@ -1037,28 +5709,138 @@ int MemHash::ForEachKey(uint64_t& key)
 void MemHash::Stat(uint32_t& node_used, uint32_t& block_used)
 {
 	node_used  = head_->node_used * 100 / max_node;
-	block_used = head_->block_used * 100 / max_block;
+	block_used = (uint64_t)BlockUsedNum() * 100 / max_block;
+}
+
+uint32_t MemHash::BlockClassNum()
+{
+	return class_num_;
+}
+
+int MemHash::StatClass(uint32_t  cls,
+		       uint32_t& data_size,
+		       uint32_t& count,
+		       uint32_t& used)
+{
+	if (cls >= class_num_)
+		return -1;
+
+	data_size = classes_[cls].data_size;
+	count     = classes_[cls].count;
+	used      = *classes_[cls].used;
+
+	return 0;
 }
 
 void MemHash::MemSync(int flags)
 {
-	msync(mem_base, total_size, flags);
+	if (dirty_map_ == NULL ||
+	    __atomic_exchange_n(&dirty_all_, 0, __ATOMIC_ACQ_REL)) {
+		msync(mem_base, total_size, flags);
+		return ;
+	}
+
+	//头部的计数、空闲队列没有逐页记录，每次都落地
+	MarkDirty(mem_base, dirty_head_len_);
+
+	//先清除标记再落地，落地期间新写入的页留到下一次
+	//相近的页合并为一段；MS_SYNC每次调用都要等待设备落地，所有的页合并为一段
+	size_t page_num = (total_size + (1UL << dirty_shift_) - 1) >> dirty_shift_;
+	size_t run_begin = 0;
+	size_t run_end   = 0;
+	for (size_t w = 0; w < (page_num + 63) / 64; w++) {
+		if (__atomic_load_n(&dirty_map_[w], __ATOMIC_RELAXED) == 0)
+			continue;
+		uint64_t word = __atomic_exchange_n(&dirty_map_[w], 0, __ATOMIC_ACQ_REL);
+		while (word != 0) {
+			size_t page = w * 64 + __builtin_ctzll(word);
+			word &= word - 1;
+			if (run_end != 0 &&
+			    (flags == MS_SYNC || page <= run_end + DIRTY_MERGE_GAP)) {
+				run_end = page + 1;
+				continue;
+			}
+			if (run_end != 0)
+				msync(mem_base + (run_begin << dirty_shift_),
+				      (run_end - run_begin) << dirty_shift_, flags);
+			run_begin = page;
+			run_end   = page + 1;
+		}
+	}
+	if (run_end != 0)
+		msync(mem_base + (run_begin << dirty_shift_),
+		      (run_end - run_begin) << dirty_shift_, flags);
+}
+
+void MemHash::DirtyInit()
+{
+	dirty_shift_ = __builtin_ctzl(sysconf(_SC_PAGESIZE));
+	//扩容后的映射也在预留的地址空间内
+	size_t map_size = reserve_size_ != 0 ? reserve_size_ : total_size;
+	size_t page_num = (map_size + (1UL << dirty_shift_) - 1) >> dirty_shift_;
+	dirty_map_ = (uint64_t *)calloc((page_num + 63) / 64, sizeof(uint64_t));
+	if (dirty_map_ == NULL) {
+		printf("MemHash::DirtyInit calloc error.\n");
+		exit(-1);
+	}
+
+	if (head_ext_ != &legacy_ext_)
+		dirty_head_len_ = (char *)head_ext_ + sizeof(struct mem_head_ext) - mem_base;
+	else
+		dirty_head_len_ = (char *)head_ + sizeof(struct mem_head) - mem_base;
+
+	//打开时建立或者恢复文件的写入没有记录
+	dirty_all_ = 1;
+
+	return ;
+}
+
+void MemHash::MarkDirty(const void* p, size_t len)
+{
+	if (dirty_map_ == NULL)
+		return ;
+
+	size_t first = (size_t)((const char *)p - mem_base) >> dirty_shift_;
+	size_t last  = (size_t)((const char *)p - mem_base + len - 1) >> dirty_shift_;
+	for (size_t i = first; i <= last; i++) {
+		uint64_t bit = 1ULL << (i & 63);
+		//已标记时不再写，避免多个线程争用同一个缓存行
+		if ((__atomic_load_n(&dirty_map_[i >> 6], __ATOMIC_RELAXED) & bit) == 0)
+			__atomic_fetch_or(&dirty_map_[i >> 6], bit, __ATOMIC_RELEASE);
+	}
+}
+
+void MemHash::MarkAllDirty()
+{
+	if (dirty_map_ != NULL)
+		__atomic_store_n(&dirty_all_, 1, __ATOMIC_RELEASE);
+}
+
+void MemHash::MemSyncHead()
+{
+	//扩展头部在第一个页内
+	msync(mem_base, sysconf(_SC_PAGESIZE), MS_SYNC);
 }
 
-inline uint32_t MemHash::GetNodeBlockUsed(uint32_t size)
+void MemHash::OpenStat(struct open_stat& stat)
 {
-	if (size % BLOCK_DATA_SIZE == 0)
-		return size / BLOCK_DATA_SIZE;
+	stat = open_stat_;
+}
+
+inline uint32_t MemHash::GetNodeBlockUsed(uint32_t size, uint32_t data_size)
+{
+	if (size % data_size == 0)
+		return size / data_size;
 	else
-		return size / BLOCK_DATA_SIZE + 1;
+		return size / data_size + 1;
 }
 
-inline uint32_t MemHash::GetLastBlockUsed(uint32_t size)
+inline uint32_t MemHash::GetLastBlockUsed(uint32_t size, uint32_t data_size)
 {
-	if (size % BLOCK_DATA_SIZE == 0)
-		return BLOCK_DATA_SIZE;
+	if (size % data_size == 0)
+		return data_size;
 	else
-		return size % BLOCK_DATA_SIZE;
+		return size % data_size;
 }
 
 int MemHash::GeneratePrimes(uint32_t* primes,
@@ -1093,80 +5875,327 @@ int MemHash::IsPrime(uint32_t value)
 }
 
 
-void MemHash::Crc32CreateTable(uint32_t* crc32_table)
+uint32_t MemHash::Crc32Compute(const char* data, int len)
 {
-	for (uint32_t i = 0; i < 256; i++) {
-		crc32_table[i] = Crc32GetSummedPloys(i);
-	}       
+	return crc_engine_->append(0, data, len);
+}
 
-	return; 
+uint32_t MemHash::Crc32Append(uint32_t crc32, const char* data, int len)
+{
+	return crc_engine_->append(crc32, data, len);
 }
 
-uint32_t MemHash::Crc32GetSummedPloys(uint32_t top_byte)
+uint32_t MemHash::Crc32Head(const char* data, int len)
 {
-	uint32_t summed_ploys = top_byte << 24;
+	return crc_head_engine_->append(0, data, len);
+}
 
-	for (int i = 0; i < 8; i++) {
-		uint32_t top_bit = (summed_ploys >> 31) & 0x01;
-		summed_ploys = summed_ploys << 1;
+static uint64_t RealtimeMs(clockid_t id)
+{
+	struct timespec ts;
+	clock_gettime(id, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
 
-		if (top_bit == 0x01)
-			summed_ploys = summed_ploys ^ PLOY; 
-	}       
+uint64_t MemHash::NowMs()
+{
+	switch (option_.clock_source) {
+	case CLOCK_SOURCE_CACHED:
+		return __atomic_load_n(&clock_ms_, __ATOMIC_RELAXED);
+#ifdef MEM_HASH_X86
+	case CLOCK_SOURCE_TSC:
+		if (tsc_mult_ != 0)
+			return tsc_base_ms_ + (uint64_t)(((__uint128_t)(__rdtsc() -
+					tsc_base_) * tsc_mult_) >> 64);
+		return RealtimeMs(CLOCK_REALTIME);
+#endif
+	case CLOCK_SOURCE_COARSE:
+		return RealtimeMs(CLOCK_REALTIME_COARSE);
+	default:
+		return RealtimeMs(CLOCK_REALTIME);
+	}
+}
 
-	return summed_ploys;
+time_t MemHash::NodeTime()
+{
+	uint64_t now = NowMs();
+	return tval_ms_ ? (time_t)now : (time_t)(now / 1000);
 }
 
-uint32_t MemHash::Crc32Compute(const char* data, int len)
+int MemHash::Expired(time_t tval, time_t now)
 {
-	uint32_t reg = 0;
+	if (tval & (time_t)TVAL_DEADLINE)
+		return now > (tval & ~(time_t)TVAL_DEADLINE);
+	return expire_limit_ != 0 && now - tval > expire_limit_;
+}
 
-	for(int i = 0; i < len; i++) {
-		reg = (reg << 8) ^ crc32_table[(data[i] ^ ((reg >> 24)) & 0xFF)];
-	}       
+time_t MemHash::Deadline(uint64_t ttl_ms, time_t now)
+{
+	//旧文件的时间为秒，向上取整；超出标记位之下的范围时截断
+	uint64_t ttl   = tval_ms_ ? ttl_ms : (ttl_ms + 999) / 1000;
+	uint64_t limit = TVAL_DEADLINE - 1 - (uint64_t)now;
+	if (ttl > limit)
+		ttl = limit;
 
-	return reg;
+	return (time_t)(((uint64_t)now + ttl) | TVAL_DEADLINE);
 }
 
-uint32_t MemHash::Crc32Append(uint32_t crc32, const char* data, int len)
+void MemHash::ClockInit()
 {
-	uint32_t reg = crc32;
+	if (option_.clock_source == CLOCK_SOURCE_TSC) {
+#ifdef MEM_HASH_X86
+		//只使用不随频率、睡眠状态变化的TSC，按10ms的时间校准频率，
+		//之后不再与系统时间同步
+		unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+		if (__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) &&
+		    (edx & (1U << 8))) {
+			struct timespec ts0, ts1;
+			clock_gettime(CLOCK_REALTIME, &ts0);
+			uint64_t tsc0 = __rdtsc();
+			uint64_t begin = NowUs();
+			while (NowUs() - begin < 10000)
+				;
+			clock_gettime(CLOCK_REALTIME, &ts1);
+			uint64_t tsc1 = __rdtsc();
+
+			uint64_t ns = (ts1.tv_sec - ts0.tv_sec) * 1000000000ULL +
+				      ts1.tv_nsec - ts0.tv_nsec;
+			tsc_base_    = tsc1;
+			tsc_base_ms_ = (uint64_t)ts1.tv_sec * 1000 + ts1.tv_nsec / 1000000;
+			tsc_mult_    = (uint64_t)(((__uint128_t)ns << 64) /
+					((__uint128_t)(tsc1 - tsc0) * 1000000));
+			if (tsc_mult_ != 0)
+				return ;
+		}
+#endif
+		LOG_WARN("[Clock] invariant TSC not available, use CLOCK_REALTIME_COARSE");
+		option_.clock_source = CLOCK_SOURCE_COARSE;
+		return ;
+	}
 
-	for(int i = 0; i < len; i++) {
-		reg = (reg << 8) ^ crc32_table[(data[i] ^ ((reg >> 24)) & 0xFF)];
-	}       
+	if (option_.clock_source != CLOCK_SOURCE_CACHED)
+		return ;
 
-	return reg;
+	clock_ms_ = RealtimeMs(CLOCK_REALTIME);
+	clock_stop_ = 0;
+	int ret = pthread_create(&clock_tid_, NULL, ClockWorker, this);
+	if (ret != 0) {
+		LOG_WARN("[Clock] pthread_create error[%d]. %s, use CLOCK_REALTIME_COARSE",
+			 ret, strerror(ret));
+		option_.clock_source = CLOCK_SOURCE_COARSE;
+		return ;
+	}
+	clock_started_ = 1;
 }
 
-void MemHash::Log_(const char* fmt, ...)
+void MemHash::ClockStop()
 {
-	time_t now = time(NULL);
-	struct tm tmm;
-	localtime_r(&now, &tmm);
-	int buf_len = 0;
-	
-	buf_len += snprintf(log_buffer_ + buf_len, 32,
-			   "[%04d-%02d-%02d %02d:%02d:%02d]", 
-			   tmm.tm_year + 1900,
-			   tmm.tm_mon + 1,
-			   tmm.tm_mday,
-			   tmm.tm_hour,
-			   tmm.tm_min,
-			   tmm.tm_sec);
+	if (!clock_started_)
+		return ;
 
-	va_list ap;
-	va_start(ap, fmt);
-	buf_len += vsnprintf(log_buffer_ + buf_len,
-			     MAX_LOG_LEN - buf_len - 1, fmt, ap);
+	__atomic_store_n(&clock_stop_, 1, __ATOMIC_RELEASE);
+	pthread_join(clock_tid_, NULL);
+	clock_started_ = 0;
+}
+
+void* MemHash::ClockWorker(void* arg)
+{
+	MemHash *mem = (MemHash *)arg;
+
+	while (!__atomic_load_n(&mem->clock_stop_, __ATOMIC_ACQUIRE)) {
+		usleep(CLOCK_TICK_MS * 1000);
+		__atomic_store_n(&mem->clock_ms_, RealtimeMs(CLOCK_REALTIME),
+				 __ATOMIC_RELAXED);
+	}
+
+	return NULL;
+}
+
+void MemHash::LogStart()
+{
+	const char *path = option_.log_path != NULL ? option_.log_path : "run.log";
+	log_fd = open(path, O_CREAT | O_RDWR | O_APPEND, 0666);
+	if (log_fd == -1) {
+		printf("MemHash::Init open log error[%d]. %s\n", 
+				errno, strerror(errno));
+		exit(-1);
+	}
+
+	log_ring_ = (struct log_slot *)calloc(LOG_RING_SIZE, sizeof(struct log_slot));
+	if (log_ring_ == NULL) {
+		printf("MemHash::LogStart calloc error.\n");
+		exit(-1);
+	}
+	for (uint32_t i = 0; i < LOG_RING_SIZE; i++)
+		log_ring_[i].seq = i;
+
+	int ret = pthread_create(&log_tid_, NULL, LogWorker, this);
+	if (ret != 0) {
+		printf("MemHash::LogStart pthread_create error[%d]. %s\n",
+		       ret, strerror(ret));
+		exit(-1);
+	}
+}
+
+void MemHash::LogStop()
+{
+	if (log_ring_ != NULL) {
+		__atomic_store_n(&log_stop_, 1, __ATOMIC_RELEASE);
+		pthread_join(log_tid_, NULL);
+		free(log_ring_);
+		log_ring_ = NULL;
+	}
+
+	if (log_fd != -1) {
+		close(log_fd);
+		log_fd = -1;
+	}
+}
+
+void* MemHash::LogWorker(void* arg)
+{
+	MemHash *mem = (MemHash *)arg;
 
-	if (buf_len >= MAX_LOG_LEN - 1) 
-		buf_len = MAX_LOG_LEN - 1;
-	*(log_buffer_ + buf_len) = '\n';
+	while (!__atomic_load_n(&mem->log_stop_, __ATOMIC_ACQUIRE)) {
+		if (mem->LogDrain() == 0)
+			usleep(LOG_FLUSH_MS * 1000);
+	}
+
+	//退出前写完队列中剩余的日志
+	while (mem->LogDrain() != 0)
+		;
+	if (mem->log_dropped_ != 0 || mem->log_suppressed_ != 0) {
+		char line[128];
+		int len = snprintf(line, sizeof(line),
+				   "[LOG][dropped(%lu)][suppressed(%lu)]\n",
+				   mem->log_dropped_, mem->log_suppressed_);
+		write(mem->log_fd, line, len);
+	}
+
+	return NULL;
+}
+
+uint32_t MemHash::LogDrain()
+{
+	//攒够一批再调用write，时间前缀在这里生成
+	char buf[64 * 1024];
+	size_t len = 0;
+	uint32_t num = 0;
+	time_t last = 0;
+	char prefix[32] = {0};
+	int prefix_len = 0;
+
+	for (;;) {
+		struct log_slot *slot = &log_ring_[log_tail_ & (LOG_RING_SIZE - 1)];
+		if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != log_tail_ + 1)
+			break;
+
+		if (len + sizeof(prefix) + slot->len + 1 > sizeof(buf)) {
+			write(log_fd, buf, len);
+			len = 0;
+		}
+		if (slot->tval != last || prefix_len == 0) {
+			struct tm tmm;
+			localtime_r(&slot->tval, &tmm);
+			prefix_len = snprintf(prefix, sizeof(prefix),
+					      "[%04d-%02d-%02d %02d:%02d:%02d]", 
+					      tmm.tm_year + 1900,
+					      tmm.tm_mon + 1,
+					      tmm.tm_mday,
+					      tmm.tm_hour,
+					      tmm.tm_min,
+					      tmm.tm_sec);
+			last = slot->tval;
+		}
+		memcpy(buf + len, prefix, prefix_len);
+		len += prefix_len;
+		memcpy(buf + len, slot->text, slot->len);
+		len += slot->len;
+		buf[len++] = '\n';
+
+		//释放槽给下一轮的生产者
+		__atomic_store_n(&slot->seq, log_tail_ + LOG_RING_SIZE, __ATOMIC_RELEASE);
+		log_tail_++;
+		num++;
+	}
+
+	if (len != 0)
+		write(log_fd, buf, len);
+	__atomic_add_fetch(&log_written_, num, __ATOMIC_RELAXED);
+
+	return num;
+}
 
+void MemHash::LogStat(struct log_stat& stat)
+{
+	stat.written    = __atomic_load_n(&log_written_, __ATOMIC_RELAXED);
+	stat.dropped    = __atomic_load_n(&log_dropped_, __ATOMIC_RELAXED);
+	stat.suppressed = __atomic_load_n(&log_suppressed_, __ATOMIC_RELAXED);
+}
+
+void MemHash::Log_(int level, struct log_site* site, const char* fmt, ...)
+{
+	if (level > option_.log_level || log_ring_ == NULL)
+		return ;
+
+	//每个LOG位置每秒最多log_rate条，新的一秒由第一个调用者清零
+	time_t now = NowMs() / 1000;
+	uint32_t suppressed = 0;
+	if (option_.log_rate != 0) {
+		uint64_t window = __atomic_load_n(&site->window, __ATOMIC_RELAXED);
+		if (window != (uint64_t)now &&
+		    __atomic_compare_exchange_n(&site->window, &window, (uint64_t)now,
+						0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+			__atomic_store_n(&site->count, 0, __ATOMIC_RELAXED);
+			suppressed = __atomic_exchange_n(&site->suppressed, 0,
+							 __ATOMIC_RELAXED);
+		}
+		if (__atomic_add_fetch(&site->count, 1, __ATOMIC_RELAXED) >
+		    option_.log_rate) {
+			__atomic_add_fetch(&site->suppressed, 1, __ATOMIC_RELAXED);
+			__atomic_add_fetch(&log_suppressed_, 1, __ATOMIC_RELAXED);
+			return ;
+		}
+	}
+
+	//占用一个槽，队列满时丢弃
+	struct log_slot *slot = NULL;
+	uint64_t pos = __atomic_load_n(&log_head_, __ATOMIC_RELAXED);
+	for (;;) {
+		slot = &log_ring_[pos & (LOG_RING_SIZE - 1)];
+		uint64_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		int64_t diff = (int64_t)(seq - pos);
+		if (diff == 0) {
+			if (__atomic_compare_exchange_n(&log_head_, &pos, pos + 1, 1,
+							__ATOMIC_RELAXED,
+							__ATOMIC_RELAXED))
+				break;
+		} else if (diff < 0) {
+			__atomic_add_fetch(&log_dropped_, 1, __ATOMIC_RELAXED);
+			return ;
+		} else {
+			pos = __atomic_load_n(&log_head_, __ATOMIC_RELAXED);
+		}
+	}
+
+	va_list ap;
+	va_start(ap, fmt);
+	int len = vsnprintf(slot->text, MAX_LOG_LEN, fmt, ap);
 	va_end(ap);
+	if (len < 0)
+		len = 0;
+	if (len >= MAX_LOG_LEN)
+		len = MAX_LOG_LEN - 1;
+	if (suppressed != 0) {
+		int n = snprintf(slot->text + len, MAX_LOG_LEN - len,
+				 " [suppressed(%u)]", suppressed);
+		if (n > 0)
+			len = len + n < MAX_LOG_LEN ? len + n : MAX_LOG_LEN - 1;
+	}
+	slot->len  = len;
+	slot->tval = now;
 
-	write(log_fd, log_buffer_, buf_len + 1);
+	__atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
 }
 
 }//namespace mem_hash 
@@ -1,21 +1,121 @@
 #include <stdint.h>
 #include <time.h>
 #include <sys/mman.h>
+#include <sys/uio.h>
+#include <pthread.h>
+#include "mem_crc.h"
 
 namespace mem_hash {
-//crc32 多项式
-const uint32_t PLOY            = 0x04C11DB7;
 //支持的最大阶数
 const uint32_t MAX_BUCKET_SIZE = 200; 
 //单一BLOCK节点的容量
 const uint32_t BLOCK_DATA_SIZE = 512;
 //每个key对应的value存储最大的BLOCK个数
 const uint32_t MAX_BLOCK_NUM   = 20;
-//LOG 日志缓冲区最大长度
-const int32_t  MAX_LOG_LEN     = 4096;
-//mlock开关
+//LOG 每条日志的最大长度（不含时间）
+const int32_t  MAX_LOG_LEN     = 512;
+//mlock开关：锁定整个映射、不锁定、只锁定头部及NODE区域（BLOCK区域按需换页）
 const int      OPEN_MLOCK      = 1;
 const int      CLOSE_MLOCK     = 0;
+const int      NODE_MLOCK      = 2;
+//cache line大小，用于NODE区域对齐
+const uint32_t CACHE_LINE_SIZE = 64;
+//恢复时最大的线程数
+const uint32_t MAX_RECOVER_THREADS = 64;
+//正常关闭标记
+const uint32_t CLEAN_SHUTDOWN  = 0x4E41454C;
+//打开文件时走过的路径
+const int      OPEN_PATH_NEW   = 0;
+const int      OPEN_PATH_CLEAN = 1;
+const int      OPEN_PATH_FULL  = 2;
+const int      OPEN_PATH_LAZY  = 3;
+const int      OPEN_PATH_ATTACH = 4;
+//恢复方式：打开时完整效验，或者访问时效验加后台效验
+const int      RECOVER_MODE_FULL = 0;
+const int      RECOVER_MODE_LAZY = 1;
+//并发读乐观重试的次数，超过后加锁读
+const uint32_t SEQ_READ_RETRY  = 64;
+//后台效验每次持锁处理的节点个数
+const uint32_t LAZY_STEP_SIZE  = 4096;
+//扩展头部格式版本，版本2增加多进程锁，版本3增加BLOCK大小分级，版本4增加NODE内联数据
+//版本5增加key指纹数组，版本6增加在线扩容的文件布局，版本7的NODE时间为毫秒
+const uint32_t MEM_HASH_VERSION = 7;
+//多进程共享模式下key锁的最大个数及默认个数
+const uint32_t MAX_LOCK_STRIPES     = 64;
+const uint32_t DEFAULT_LOCK_STRIPES = 16;
+//BLOCK大小分级的最大级数，BLOCK偏移量的高位记录级别
+const uint32_t MAX_BLOCK_CLASS      = 8;
+const uint32_t BLOCK_CLASS_SHIFT    = 28;
+const uint32_t BLOCK_INDEX_MASK     = (1U << BLOCK_CLASS_SHIFT) - 1;
+//NODE节点内联数据区的最大长度，数据内联时NODE的pos为INLINE_POS
+const uint32_t MAX_INLINE_SIZE      = 1024;
+const int32_t  INLINE_POS           = -2;
+//AVX2一次比较的指纹个数（阶数）
+const uint32_t FP_BATCH             = 8;
+//批量接口每次分阶段预取的key个数
+const uint32_t MULTI_WINDOW         = 32;
+//BLOCK区整理每次持锁处理的NODE节点个数
+const uint32_t COMPACT_STEP_SIZE    = 256;
+//在线扩容迁移NODE区域时每次持锁处理的节点个数
+const uint32_t MIGRATE_STEP_SIZE    = 1024;
+//只落地变更页时，间隔不超过该页数的两段合并为一次msync
+const uint32_t DIRTY_MERGE_GAP      = 16;
+//日志级别，数值大于mem_option.log_level的日志不输出
+const int      LOG_LEVEL_ERROR      = 0;
+const int      LOG_LEVEL_WARN       = 1;
+const int      LOG_LEVEL_INFO       = 2;
+const int      LOG_LEVEL_DEBUG      = 3;
+//日志环形队列的槽数（2的幂），队列满时丢弃并计数
+const uint32_t LOG_RING_SIZE        = 4096;
+//后台日志线程没有日志时的等待间隔
+const uint32_t LOG_FLUSH_MS         = 10;
+//每个LOG位置每秒输出的默认条数
+const uint32_t DEFAULT_LOG_RATE     = 100;
+//时钟来源：每次调用clock_gettime(CLOCK_REALTIME)、CLOCK_REALTIME_COARSE，
+//后台线程每CLOCK_TICK_MS更新的缓存值，或者按打开时校准的TSC频率换算
+const int      CLOCK_SOURCE_REALTIME = 0;
+const int      CLOCK_SOURCE_COARSE   = 1;
+const int      CLOCK_SOURCE_CACHED   = 2;
+const int      CLOCK_SOURCE_TSC      = 3;
+const uint32_t CLOCK_TICK_MS         = 1;
+//NODE节点tval的标记位：为1时其余位是SetWithTTL指定的超时时刻，否则是最后修改时间
+//（都为NODE节点时间单位）
+const uint64_t TVAL_DEADLINE        = 1ULL << 62;
+//过期清理每次持锁处理的NODE节点个数
+const uint32_t SWEEP_STEP_SIZE      = 1024;
+//映射的预取方式：不预取、mmap时MAP_POPULATE、多线程并行预取
+const int      PREFAULT_NONE        = 0;
+const int      PREFAULT_POPULATE    = 1;
+const int      PREFAULT_PARALLEL    = 2;
+//NUMA策略：默认、绑定到mask中的节点、在mask中的节点间交错分配
+const int      NUMA_POLICY_DEFAULT  = 0;
+const int      NUMA_POLICY_BIND     = 1;
+const int      NUMA_POLICY_INTERLEAVE = 2;
+//淘汰模式下NODE节点访问计数的上限，CLOCK指针扫过时减一，为0的节点被淘汰
+const uint8_t  EVICT_HOT_MAX        = 3;
+//BLOCK不够时CLOCK指针每次Set最多扫过的NODE节点个数
+const uint32_t EVICT_SCAN_SIZE      = 4096;
+//快照每次持锁处理的NODE节点个数，快照文件格式版本
+const uint32_t SNAPSHOT_STEP_SIZE   = 1024;
+const uint32_t SNAPSHOT_VERSION     = 1;
+//并行导入时每个线程一批记录的大小，每个线程队列中最多的批数
+const uint32_t IMPORT_BATCH_SIZE    = 1 << 20;
+const uint32_t IMPORT_QUEUE_DEPTH   = 4;
+
+//Lemire快速取模：m = FastModM(d)预先计算，FastMod(a, m, d)与a % d结果相同
+//（a为64位，d为32位），只用乘法代替除法
+inline __uint128_t FastModM(uint32_t d)
+{
+	return ~(__uint128_t)0 / d + 1;
+}
+
+inline uint32_t FastMod(uint64_t a, __uint128_t m, uint32_t d)
+{
+	__uint128_t low    = m * a;
+	__uint128_t bottom = ((low & ~(uint64_t)0) * d) >> 64;
+	__uint128_t top    = (low >> 64) * d;
+	return (uint32_t)((bottom + top) >> 64);
+}
 
 //多阶HASH阶数、每阶的长度以及最大BLOCK的个数
 struct head_info {
@@ -33,27 +133,352 @@ struct mem_head  {
 	uint32_t block_used;
 };
 
-//NODE节点
+//扩展头部的格式信息
+struct ext_info {
+	uint32_t version;
+	uint32_t crc_type;
+};
+
+//BLOCK大小分级，每一级的数据区大小及个数
+struct class_info {
+	uint32_t class_num;
+	uint32_t data_size[MAX_BLOCK_CLASS];
+	uint32_t count[MAX_BLOCK_CLASS];
+};
+
+//NODE节点布局
+struct node_info {
+	//内联数据区长度，NODE节点的间隔为sizeof(mem_node) + inline_size
+	uint32_t inline_size;
+};
+
+//key指纹数组，每个NODE节点一个uint16指纹（0表示空），紧跟在NODE区域之后
+struct fp_info {
+	//指纹个数，为0时不使用指纹，否则等于NODE节点个数
+	uint32_t fp_num;
+};
+
+//在线扩容后的文件布局，偏移量相对于文件开头
+struct layout_info {
+	//扩容次数，为0时布局由Init的参数及扩展头部前面的字段决定
+	uint32_t grow_count;
+	//当前NODE区域的阶数、阶长度、指纹个数及偏移量
+	uint32_t bucket_time;
+	uint32_t bucket_len;
+	uint32_t fp_num;
+	uint64_t node_offset;
+	//迁移中的旧NODE区域，old_node_offset为0时没有迁移
+	uint32_t old_bucket_time;
+	uint32_t old_bucket_len;
+	uint64_t old_node_offset;
+	//BLOCK分级及各级的偏移量
+	struct   class_info class_info_;
+	uint64_t class_offset[MAX_BLOCK_CLASS];
+	uint64_t total_size;
+};
+
+//扩展头部（新格式文件才有，紧跟在mem_head之后）
+struct mem_head_ext {
+	char     magic[8];
+	uint32_t crc32_ext_info;
+	struct   ext_info ext_info_;
+	//正常关闭时为CLEAN_SHUTDOWN，打开后立即清除
+	uint32_t clean_shutdown;
+	//-----以下为版本2新增
+	//key锁个数，创建文件时确定，key % lock_stripes选择锁
+	uint32_t lock_stripes;
+	//有进程持锁崩溃过，可能有未回收的BLOCK，关闭时不写正常关闭标记
+	uint32_t owner_dead;
+	//进程间共享的robust锁：BLOCK空闲队列锁、按key分段的锁
+	pthread_mutex_t free_lock;
+	pthread_mutex_t stripe_lock[MAX_LOCK_STRIPES];
+	//-----以下为版本3新增
+	uint32_t crc32_class_info;
+	struct   class_info class_info_;
+	//各级BLOCK的空闲队列及使用个数，版本3之前使用mem_head中的字段
+	int32_t  class_free_pos[MAX_BLOCK_CLASS];
+	uint32_t class_block_used[MAX_BLOCK_CLASS];
+	//-----以下为版本4新增
+	uint32_t crc32_node_info;
+	struct   node_info node_info_;
+	//-----以下为版本5新增
+	uint32_t crc32_fp_info;
+	struct   fp_info fp_info_;
+	//-----以下为版本6新增
+	//两份布局交替写入，写完一份并落地后再切换layout_slot，崩溃时总有一份完整
+	uint32_t layout_slot;
+	uint32_t crc32_layout[2];
+	struct   layout_info layout_[2];
+	//旧NODE区域中下一个要迁移的节点
+	uint32_t migrate_cursor;
+	//-----以下为版本7新增（64位，版本6的长度即该字段的偏移量）
+	//NODE节点的tval为毫秒，之前的版本为秒
+	uint64_t tval_ms;
+};
+
+//NODE节点，开启内联时后面紧跟内联数据区
 struct mem_node  {
 	uint64_t key;
 	time_t   tval;
 	uint32_t size;
 	uint32_t crc32;
 	int32_t  pos;
+	//写NODE节点及其BLOCK链期间为奇数，并发读据此判断是否需要重读
+	uint32_t seq;
 };
 
-//BLOCK节点
+//BLOCK节点，数据区的实际大小由所在的级别决定
 struct mem_block {
 	uint32_t flag;
 	int32_t  pos;
 	char     data[BLOCK_DATA_SIZE];
 };
 
+//快照文件头部，之后依次是每条记录（snap_record紧跟value），最后是snap_tail
+struct snap_head {
+	char     magic[8];
+	//快照开始时的NODE节点时间
+	int64_t  snap_time;
+	uint32_t version;
+	//value的crc32算法（CRC_TYPE_*），与NODE节点中的相同
+	uint32_t crc_type;
+	//NODE节点时间是否为毫秒
+	uint32_t tval_ms;
+	//以上字段的crc32
+	uint32_t crc32;
+};
+
+//快照记录：key、NODE节点时间（含TVAL_DEADLINE标记）、value长度及其crc32
+struct snap_record {
+	uint64_t key;
+	int64_t  tval;
+	uint32_t size;
+	uint32_t crc32;
+};
+
+//快照文件尾部：记录个数、value总字节数、所有snap_record的crc32
+struct snap_tail {
+	char     magic[8];
+	uint64_t records;
+	uint64_t bytes;
+	uint32_t crc32_records;
+	//以上字段的crc32
+	uint32_t crc32;
+};
+
+//内存中的BLOCK级别信息
+struct block_class {
+	uint32_t  data_size;
+	//相邻BLOCK节点的间隔
+	uint32_t  stride;
+	uint32_t  count;
+	//在所有BLOCK节点中的起始编号
+	uint32_t  first;
+	//扩容增加的级别相对于文件开头的偏移量，为0时在BLOCK区域中依次排列
+	size_t    offset;
+	char*     base;
+	int32_t*  free_pos;
+	uint32_t* used;
+	//连续分配时的空闲位图（1为空闲）及下一次查找的起点，只在内存中
+	uint64_t* free_map;
+	uint32_t  map_hint;
+};
+
 //结构保护区
 struct mem_barrier {
 	char     barrier[8];
 };
 
+//初始化可选项
+struct mem_option {
+	mem_option();
+	//打开旧文件时恢复NODE/BLOCK使用的线程数
+	uint32_t recover_threads;
+	//非正常关闭的文件使用的恢复方式。LAZY模式下后台效验完成之前，写操作从文件中
+	//使用标志位已清除的BLOCK分配；这些BLOCK也用完时，写操作要在调用线程上持锁
+	//等到NODE节点全部效验完才能分配BLOCK
+	int      recover_mode;
+	//并发模式：Get/IsExist无锁读，Set/Del/Append持写锁
+	int      concurrent;
+	//多进程共享模式：多个进程同时打开同一个文件，写操作持key所在的锁
+	int      shared;
+	//创建新文件时key锁的个数
+	uint32_t lock_stripes;
+	//创建新文件时BLOCK的大小分级（数据区大小为8的倍数），级数为0时只有一级
+	//BLOCK_DATA_SIZE，个数为Init的max_block；否则忽略max_block
+	uint32_t block_classes;
+	uint32_t block_class_size[MAX_BLOCK_CLASS];
+	uint32_t block_class_count[MAX_BLOCK_CLASS];
+	//创建新文件时NODE节点内联数据区的长度（向上取8的倍数），不超过该长度的value
+	//直接存放在NODE节点中，不分配BLOCK；为0时不内联
+	uint32_t inline_size;
+	//创建新文件时在NODE区域之后保存每个节点的key指纹，查找时先比较指纹，
+	//指纹相同才访问NODE节点（支持AVX2时一次比较FP_BATCH阶）
+	int      fingerprint;
+	//BLOCK按连续区段分配：打开后根据BLOCK标记位建立空闲位图，一个value优先分配
+	//连续的BLOCK，读取时按地址顺序访问；关闭时重建空闲队列，文件格式不变
+	//多进程共享模式下不使用
+	int      extent_alloc;
+	//为在线扩容预留的地址空间（字节），文件映射在其开头，扩容时在后面就地映射，
+	//mem_base不变；为0或不大于文件大小时不支持Grow，共享模式下不使用
+	uint64_t grow_reserve;
+	//记录Set/Del/Append等写入的页，MemSync只落地头部及变更过的页（相邻的页合并
+	//为一次msync）；为0时每次落地整个映射
+	int      dirty_sync;
+	//后台落地线程：距上次落地超过flush_interval_ms或者写入量超过flush_dirty_bytes时
+	//MS_SYNC落地，先到者触发；两者都为0时不启动，启动后写操作不再按msync_freq落地
+	uint32_t flush_interval_ms;
+	uint64_t flush_dirty_bytes;
+	//日志文件路径（为NULL时为run.log）、级别，每个LOG位置每秒最多输出的条数
+	//（为0时不限制，超出的计数后在下一秒的第一条中给出）
+	const char* log_path;
+	int         log_level;
+	uint32_t    log_rate;
+	//时钟来源（CLOCK_SOURCE_*），用于数据超时判断及NODE节点时间
+	int         clock_source;
+	//数据超时（毫秒），不为0时代替Init的data_store_time；版本7之前的文件时间为秒，
+	//向上取整到秒
+	uint64_t    data_store_ms;
+	//淘汰模式（用作缓存）：Get时增加节点的访问计数，Set所有阶都被占用时淘汰其中
+	//计数最小的节点，BLOCK不够时由CLOCK指针扫描NODE区域淘汰计数为0的节点
+	//访问计数只在进程内，不写入文件
+	int         evict;
+	//映射使用透明大页（MADV_HUGEPAGE），减少随机查找NODE区域的TLB miss
+	int         huge_page;
+	//映射设置MADV_RANDOM：换出的页按需读入时不预读相邻的页
+	int         random_access;
+	//MultiGet读取BLOCK链之前，先为一组key的每一跳BLOCK发出MADV_WILLNEED，
+	//文件大于内存时换出的value并行读入
+	int         willneed;
+	//打开时预取映射的页（PREFAULT_*），并行预取的线程数（为0时为CPU个数）
+	int         prefault;
+	uint32_t    prefault_threads;
+	//NODE区域（含头部及指纹数组）与BLOCK区域分别的NUMA策略（NUMA_POLICY_*）及
+	//节点掩码（为0时为允许使用的所有节点），在预取之前设置
+	int         node_numa_policy;
+	uint64_t    node_numa_mask;
+	int         block_numa_policy;
+	uint64_t    block_numa_mask;
+};
+
+//打开文件的统计
+struct open_stat {
+	//OPEN_PATH_NEW/OPEN_PATH_CLEAN/OPEN_PATH_FULL/OPEN_PATH_LAZY
+	//OPEN_PATH_ATTACH：共享模式下其他进程已打开，跳过恢复
+	int      path;
+	uint32_t recover_threads;
+	//Init中创建或者效验、恢复文件的耗时
+	uint64_t cost_us;
+	//OPEN_PATH_LAZY时后台效验完成的耗时，未完成时为0
+	uint64_t lazy_cost_us;
+	//Init中映射文件的耗时（含MAP_POPULATE、并行预取及mlock）
+	uint64_t map_cost_us;
+};
+
+//BLOCK区整理的统计
+struct compact_stat {
+	//后台整理线程是否在运行
+	int      running;
+	//本轮整理的NODE节点位置，已完成的轮数
+	uint32_t node_cursor;
+	uint64_t passes;
+	//累计搬移的BLOCK链个数及value字节数
+	uint64_t chains_moved;
+	uint64_t bytes_moved;
+	//碎片度（百分比），统计时扫描NODE区域及BLOCK区域
+	//link_frag：BLOCK链中不指向相邻下一个BLOCK的跳转占所有跳转的比例
+	//spread_frag：各级已使用的BLOCK中位于前used个BLOCK之外的比例
+	uint32_t link_frag;
+	uint32_t spread_frag;
+};
+
+//过期清理的统计
+struct sweep_stat {
+	//后台清理线程是否在运行
+	int      running;
+	//本轮清理的NODE节点位置，已完成的轮数
+	uint32_t node_cursor;
+	uint64_t passes;
+	//累计回收的NODE节点个数及BLOCK个数
+	uint64_t nodes_reclaimed;
+	uint64_t blocks_reclaimed;
+};
+
+//淘汰模式的统计
+struct evict_stat {
+	//Set所有阶都被占用时淘汰的节点数，BLOCK不够时CLOCK淘汰的节点数
+	uint64_t probe_evicted;
+	uint64_t clock_evicted;
+	//淘汰回收的BLOCK个数
+	uint64_t blocks_freed;
+	//Get/GetView命中、未命中（不存在或超时）的次数，命中率（百分比）
+	uint64_t get_hits;
+	uint64_t get_misses;
+	uint32_t hit_ratio;
+};
+
+//快照的统计（最近一次Snapshot、Dump、LoadSnapshot或者Restore）
+struct snapshot_stat {
+	//写入或导入的记录个数及value字节数
+	uint64_t records;
+	uint64_t bytes;
+	//Snapshot期间写操作修改节点之前先保存的节点个数
+	uint64_t captured;
+	//导入跳过的已超时记录个数
+	uint64_t expired;
+	uint64_t cost_us;
+};
+
+//日志的统计
+struct log_stat {
+	//写入文件、队列满时丢弃、超过log_rate被限制的条数
+	uint64_t written;
+	uint64_t dropped;
+	uint64_t suppressed;
+};
+
+//恢复线程的任务区间及统计结果
+struct recover_task;
+//并行导入线程的批次队列及统计结果
+struct import_task;
+//批量接口预取时找到的节点
+struct node_hint;
+//日志环形队列的槽、LOG位置的限速状态
+struct log_slot;
+struct log_site;
+
+//GetView引用的BLOCK链
+struct view_pin;
+
+class MemHash;
+
+//GetView返回的数据段，可直接用于writev/sendmsg，Release或者析构之前有效
+//BLOCK链被引用期间，删除、覆盖、淘汰、超时及整理都推迟到Release时回收该链，
+//内联的value复制到view中。非共享模式下不持锁，可以交给其他线程Release；
+//共享模式下其他进程看不到引用，仍持有key所在的锁，只能由调用GetView的线程释放。
+//MemView要在MemHash析构之前释放
+class MemView {
+public:
+	MemView();
+	~MemView();
+	void Release();
+
+	struct iovec iov[MAX_BLOCK_NUM];
+	int          iovcnt;
+	uint32_t     size;
+
+private:
+	friend class MemHash;
+	MemView(MemView &rhs);
+	MemView& operator=(MemView& rhs);
+
+	pthread_mutex_t* lock_;
+	//被引用的BLOCK链首，没有引用时mem_为NULL
+	MemHash*         mem_;
+	int32_t          pin_pos_;
+	char             inline_[MAX_INLINE_SIZE];
+};
+
 class MemHash {
 public:
 	MemHash();
@@ -66,7 +491,8 @@ public:
 		    int             msync_flag, 
 		    uint32_t        bucket_time,
 		    uint32_t        bucket_len,
-		    uint32_t        max_block);
+		    uint32_t        max_block,
+		    const struct mem_option& option = mem_option());
 
 	int Meta(const char*    name,
 		    uint32_t&       bucket_time,
@@ -77,11 +503,26 @@ public:
 		    const char*     data,
 		    int             len);
 
+	//指定超时（毫秒）的Set，超时时刻记录在NODE节点中，不受data_store_time影响；
+	//ttl_ms为0时同Set。版本7之前的文件向上取整到秒
+	int SetWithTTL(uint64_t key,
+		    const char*     data,
+		    int             len,
+		    uint64_t        ttl_ms);
+
 	int Get(uint64_t        key,
 		    char*           data,
 		    int             max_len,
 		    int&            data_len);
 
+	//零拷贝读取，返回值同Get，引用表分配失败返回-4
+	int GetView(uint64_t    key,
+		    MemView&        view);
+
+	//获取value长度，用于准确分配Get的缓冲区
+	int GetSize(uint64_t    key,
+		    uint32_t&       size);
+
 	int IsExist(uint64_t    key);
 
 	int Del    (uint64_t    key);
@@ -90,12 +531,93 @@ public:
 		    const char*     data,
 		    int             len);
 
+	//批量接口：每MULTI_WINDOW个key一组，逐阶为所有key预取NODE节点，再逐跳预取
+	//找到的key的BLOCK链，之后逐个调用单key接口；ret[i]为keys[i]的返回值
+	//MultiGet、MultiSet返回ret为0的个数，MultiIsExist返回存在的个数
+	int MultiGet(const uint64_t* keys,
+		    int             num,
+		    char* const*    data,
+		    const int*      max_len,
+		    int*            data_len,
+		    int*            ret);
+
+	int MultiIsExist(const uint64_t* keys,
+		    int             num,
+		    int*            ret);
+
+	int MultiSet(const uint64_t* keys,
+		    int             num,
+		    const char* const* data,
+		    const int*      len,
+		    int*            ret);
+
 	//遍历key ， 传入key为0，重头开始遍历，否则继续上一次遍历
 	int ForEachKey(uint64_t& key);
 	void Stat(uint32_t& node_used_perct, uint32_t& block_used_perct);
+	//BLOCK级数及每一级的使用情况，cls越界时返回-1
+	uint32_t BlockClassNum();
+	int  StatClass(uint32_t  cls,
+		       uint32_t& data_size,
+		       uint32_t& count,
+		       uint32_t& used);
+	void OpenStat(struct open_stat& stat);
+	void LogStat(struct log_stat& stat);
+	//当前时间（毫秒），来源由mem_option.clock_source决定
+	uint64_t NowMs();
+	//BLOCK区整理：把分散的BLOCK链搬到所在级别靠前的连续空闲区段，每条链在seq
+	//窗口内切换pos，崩溃后恢复时看到的是旧链或者新链；共享模式下不支持
+	//CompactStep从上次的位置继续，处理到耗时超过budget_us为止，本轮完成返回0，
+	//还有剩余返回1（后台效验期间不处理），失败返回-1
+	int  CompactStep(uint32_t budget_us);
+	//后台线程每隔interval_ms调用一次CompactStep，期间所有操作持锁
+	int  CompactStart(uint32_t budget_us, uint32_t interval_ms);
+	void CompactStop();
+	void CompactStat(struct compact_stat& stat);
+	//在线扩容（只支持版本6以上的文件，共享模式下不支持）：
+	//bucket_time不为0时在文件末尾建立更大的NODE区域，之后由MigrateStep分步把旧区域
+	//的节点迁移过去，迁移期间查找先查旧区域再查新区域，旧区域迁移完成后不再使用；
+	//block_count不为0时在文件末尾增加一级BLOCK，大小与第block_cls级相同
+	//布局写入扩展头部，崩溃后重新打开可以继续迁移
+	int  Grow(uint32_t bucket_time, uint32_t bucket_len,
+		  uint32_t block_cls,   uint32_t block_count);
+	//迁移处理到耗时超过budget_us为止，没有迁移或迁移完成返回0，还有剩余返回1，
+	//失败返回-1（新区域没有空闲节点）
+	int  MigrateStep(uint32_t budget_us);
+	//过期清理：逐段扫描NODE区域，删除已超时的节点并回收BLOCK链
+	//SweepStep从上次的位置继续，处理到耗时超过budget_us为止，本轮完成返回0，
+	//还有剩余返回1（后台效验期间不处理），失败返回-1
+	int  SweepStep(uint32_t budget_us);
+	//后台线程每隔interval_ms调用一次SweepStep，期间所有操作持锁
+	int  SweepStart(uint32_t budget_us, uint32_t interval_ms);
+	void SweepStop();
+	void SweepStat(struct sweep_stat& stat);
+	//淘汰模式的统计，未开启时全为0
+	void EvictStat(struct evict_stat& stat);
+	//一致性快照：只写入快照开始时未超时的key，顺序写入path.tmp，完成后改名为path；
+	//共享模式下不支持。逐段持锁扫描NODE区域，段与段之间其他线程的写操作在修改
+	//还没有扫描到的节点之前先保存它的旧值，快照为开始时刻的内容
+	//成功返回0，失败返回-1
+	int  Snapshot(const char* path);
+	//流式导出：与Snapshot相同的内容及格式顺序写入fd（文件或者管道），不落地
+	int  Dump(int fd);
+	//导入快照中未超时的记录（key已存在时覆盖），见Restore
+	int  LoadSnapshot(const char* path, uint32_t threads = 1);
+	//从fd（文件或者管道）流式导入Dump的输出。threads大于1且MemHash为空（没有节点、
+	//没有迁移、非共享模式）时，读取线程按key把记录分给threads个导入线程，各线程
+	//不查找已有的key，直接抢占空闲节点写入，不按msync_freq落地、不逐条记日志，
+	//结束后下次落地整个映射；否则逐条Set。输入中的key不能重复（Dump的输出满足）
+	//导入期间不要调用其他接口（并发模式下等待）。校验或者写入失败返回-1，
+	//已导入的记录不回滚
+	int  Restore(int fd, uint32_t threads = 1);
+	void SnapshotStat(struct snapshot_stat& stat);
+	//dirty_sync开启时只落地头部及变更过的页
 	void MemSync(int flags = MS_ASYNC);
+	//等待调用之前完成的写操作落地：有后台落地线程时唤醒它并等待，timeout_ms为0时
+	//一直等待，超时返回-1；没有后台落地线程时直接MS_SYNC落地
+	int  WaitDurable(uint32_t timeout_ms = 0);
 	
 private:
+	friend class MemView;
 	MemHash(MemHash &rhs);
 	MemHash& operator=(MemHash& rhs);
 
@@ -110,15 +632,148 @@ private:
 			   uint32_t  bucket_len,
 			   uint32_t  max_block);
 
+	//写入value，tval为NODE节点要记录的时间，now为当前的NODE节点时间
+	//hint为批量接口预取时找到的节点，可以代替查找
+	int  SetNode(uint64_t key, const char* data, int len, time_t tval,
+		     time_t now, const struct node_hint* hint = NULL);
+	//带预取结果的Get、IsExist
+	int  GetHint(uint64_t key, char* data, int max_len, int& data_len,
+		     const struct node_hint* hint);
+	int  IsExistHint(uint64_t key, const struct node_hint* hint);
+	//预取结果仍有效时直接使用，否则GetNode
+	struct mem_node* HintNode(uint64_t key, const struct node_hint* hint);
 	//Set中的Del操作
 	void DelForInner(uint64_t    key);
+	//删除NODE节点并回收BLOCK链
+	void DelNode(struct mem_node* node);
+	//被GetView引用的链推迟到引用释放时回收
+	void FreeBlockChain(int32_t pos, uint32_t nbu);
+	//引用BLOCK链，失败返回-1；释放引用，链已被回收时在最后一个引用释放时归还
+	int  PinChain(int32_t pos);
+	void UnpinChain(int32_t pos);
+	//链被引用时记下回收请求并返回1
+	int  DeferFree(int32_t pos, uint32_t nbu);
+	int  ChainPinned(int32_t pos);
+	//某一级可分配的BLOCK个数
+	uint32_t FreeBlockNum(uint32_t cls);
+	//所有级别已使用的BLOCK个数
+	uint32_t BlockUsedNum();
+	//选择浪费内存和跳转次数最少、且空闲BLOCK足够的级别，没有时返回-1
+	int  ChooseBlockClass(uint32_t len);
+	//单个value的最大长度
+	uint32_t MaxValueLen();
+	//从某一级的空闲队列分配BLOCK链并写入数据，返回第一个BLOCK的偏移量，不够时返回-1
+	int32_t  AllocBlockChain(uint32_t cls, const char* data, uint32_t len);
+	//持空闲队列锁取下BLOCK链，不够时返回-1
+	int32_t  PopBlockChain(uint32_t cls, uint32_t nbu);
+	//连续分配：建立、释放空闲位图，从位图分配、回收BLOCK链
+	void ExtentInit();
+	void ExtentFini();
+	void ExtentMapBuild(struct recover_task* task);
+	int32_t  PopBlockExtent(uint32_t cls, uint32_t nbu);
+	void FreeBlockExtent(int32_t pos, uint32_t nbu);
+	//把位图中index所指的nbu个空闲BLOCK依次串成BLOCK链，contiguous时标记为连续区段
+	int32_t  LinkBlockRun(uint32_t cls, const uint32_t* index, uint32_t nbu,
+			      int contiguous);
+	//BLOCK链中的下一个BLOCK，stride不为0时为连续区段，按地址计算
+	inline struct mem_block* NextBlock(struct mem_block* block, uint32_t stride);
+	//BLOCK链为连续区段时返回BLOCK间隔，否则返回0
+	inline uint32_t ExtentStride(int32_t pos, struct mem_block* block);
+	//Append超出当前级别时按新长度重新Set
+	int  AppendRelocate(uint64_t key, struct mem_node* node,
+			    const char* data, int len);
+	//数据变更计数，达到msync_freq时落地；有后台落地线程时只累计写入量
+	void DataChange(uint32_t bytes);
+	//记录[p, p+len)所在的页已变更，在写入之后调用
+	inline void MarkDirty(const void* p, size_t len);
+	//没有逐页记录的批量写入（恢复、后台效验等），下次落地整个映射
+	void MarkAllDirty();
+	//建立变更页位图，打开时的写入由第一次落地整个映射覆盖
+	void DirtyInit();
+
+	//-----并发读相关
+	//无锁读，返回SEQ_READ_LOCKED时需要加锁重读
+	//hint不为NULL时第一次使用预取到的节点
+	int  GetOptimistic(uint64_t key, char* data, int max_len, int& data_len,
+			   const struct node_hint* hint);
+	int  IsExistOptimistic(uint64_t key, const struct node_hint* hint);
+	int  GetSizeOptimistic(uint64_t key, uint32_t& size);
+	inline void NodeWriteBegin(struct mem_node* node);
+	inline void NodeWriteEnd(struct mem_node* node);
+	//无锁读开始之后扩容切换过布局，没有找到的key需要重查
+	inline int LayoutChanged(uint32_t seq);
+	//占用空闲NODE节点、开始写并写入key，共享模式下与其他进程竞争，并行导入时与其他
+	//线程竞争
+	int  ClaimNode(struct mem_node* node, uint64_t key);
+
+	//-----多进程共享相关
+	//作用域内持有锁，robust锁的持有者崩溃时先修复
+	class LockGuard;
+	//加文件锁并判断是否是第一个打开的进程，文件为空时返回-1，否则返回fd
+	int  SharedOpen(const char* name);
+	//初始化完成，转为挂接状态
+	void SharedOpenDone();
+	//初始化文件头部的进程间锁
+	void SharedLockInit();
+	void LockMutex(pthread_mutex_t* mutex);
+	//尝试加锁，锁被占用时返回-1
+	int  TryLockMutex(pthread_mutex_t* mutex);
+	//robust锁的持有者崩溃后修复该锁保护的数据
+	void RepairMutex(pthread_mutex_t* mutex);
+	//持锁进程崩溃后修复该锁保护的NODE节点或空闲队列
+	void RepairStripe(uint32_t stripe);
+	void RepairFreeList();
+	//根据BLOCK标记位多线程重建各级的空闲队列及使用个数
+	void RebuildFreeList(struct recover_task* tasks, uint32_t task_num);
+	//空闲队列锁，非共享模式返回NULL（并行导入时为import_lock_）
+	pthread_mutex_t* FreeLock();
 	//初始化bucket数组
 	void BucketInit(uint32_t  bucket_time,
 		        uint32_t  bucket_len);
-	//初始化max_node
-	void NodeInit(); 
-	//初始化max_block
-	void BlockInit(uint32_t max_block);
+	//在线扩容的布局，版本6以上从文件读取，crc32效验失败返回-1
+	int  LayoutOld(int fd, uint32_t version, struct layout_info& layout);
+	//当前的布局
+	void LayoutFill(struct layout_info& layout);
+	//写入另一份布局并切换
+	void LayoutWrite(const struct layout_info& layout);
+	//迁移中的旧NODE区域的阶数、阶长度
+	void OldZoneInit(uint32_t bucket_time, uint32_t bucket_len);
+	//映射文件，设置grow_reserve时先预留地址空间
+	char* MapFile(int fd);
+	//映射之后、初始化内存布局之前：设置大页、NUMA策略，预取及mlock
+	void MapSetup();
+	//对[p, p+len)所在的页设置大页及NUMA策略
+	void ZoneAdvise(char* p, size_t len, int numa_policy, uint64_t numa_mask);
+	//多线程预取[p, p+len)所在的页
+	void Prefault(char* p, size_t len);
+	//映射之前某一级BLOCK相对于文件开头的偏移量
+	size_t ClassOffset(uint32_t cls);
+	//NODE_MLOCK：锁定各级BLOCK之外的部分，失败返回-1
+	int  MlockNodeZone();
+	//把旧NODE区域的节点移到新区域，新区域没有空闲节点时返回-1
+	int  MigrateNode(struct mem_node* node);
+	//迁移完成，切换为只有新区域的布局
+	void MigrateFinish();
+	//初始化max_node及NODE节点布局
+	void NodeInit(const struct node_info& info); 
+	//NODE节点布局，版本4以上从文件读取
+	void NodeInfoNew(struct node_info& info);
+	void NodeInfoOld(int fd, uint32_t version, struct node_info& info);
+	//初始化key指纹数组，版本5以上从文件读取
+	void FpInit(const struct fp_info& info);
+	void FpInfoNew(struct fp_info& info);
+	void FpInfoOld(int fd, uint32_t version, struct fp_info& info);
+	//根据BLOCK分级初始化max_block及各级的布局
+	void BlockInit(const struct class_info& info);
+	//新文件的BLOCK分级
+	void BlockClassNew(uint32_t max_block, struct class_info& info);
+	//旧文件的BLOCK分级，版本3之前只有一级
+	void BlockClassOld(int fd, uint32_t version, uint32_t max_block,
+			   struct class_info& info);
+	//mmap之后设置各级的内存地址及空闲队列位置
+	void BlockClassBind();
+	//根据扩展头部版本初始化扩展头部大小，旧格式文件为0
+	void HeadExtInit(uint32_t version);
 	//初始化MemHash整体大小total_size
 	void TotalSizeInit();
 	//初始化mmap新文件的内存布局
@@ -130,20 +785,124 @@ private:
 	void CheckBarrier(char* barrier);
 	//检查头部固定结构
 	void CheckHead();
-	//清除所有BLOCK节点的使用标记位
-	void ClearBlockUsedFlag();
-	//检查NODE节点和BLOCK节点的一致性
-	void CheckNodeBlock();
-	//恢复BLOCK节点
-	void RecoverBlock();
-	//根据key获取该key的node节点指针
+	//同步落地头部所在的页
+	void MemSyncHead();
+	//旧文件扩展头部的版本，不带扩展头部时为0；读取失败或者magic未知时返回-1
+	int  HeadExtVersion(int fd, uint32_t& version);
+	//多线程执行恢复的各个阶段
+	void Recover();
+	void RunRecoverTasks(int phase, uint32_t cls, uint32_t total,
+			     struct recover_task* tasks, uint32_t task_num);
+	static void* RecoverWorker(void* arg);
+	//清除某一级[begin, end)区间BLOCK节点的使用标记位
+	void ClearBlockUsedFlag(uint32_t cls, uint32_t begin, uint32_t end);
+	//检查[begin, end)区间NODE节点和BLOCK节点的一致性
+	void CheckNodeBlock(struct recover_task* task);
+	//效验单个NODE节点的BLOCK链，成功返回BLOCK个数，失败清空节点返回-1
+	int  CheckNode(struct mem_node* node);
+	//清空NODE节点
+	void ClearNode(struct mem_node* node);
+	//重建[begin, end)区间的BLOCK空闲队列
+	void RecoverBlock(struct recover_task* task);
+
+	//-----lazy效验相关
+	void LazyInit();
+	static void* LazyWorker(void* arg);
+	//处理一段NODE或BLOCK，全部完成时返回0
+	int  LazyStep();
+	//写操作空闲BLOCK不够时调用：NODE节点效验完之前先把cls级别（为-1时按len选择）
+	//中文件里未使用的BLOCK放入空闲队列，之后同LazyStep
+	int  LazyScavenge(uint32_t len, int cls);
+	//第一次访问NODE节点时效验
+	void LazyVerify(uint32_t node_pos);
+	//-----BLOCK区整理相关
+	static void* CompactWorker(void* arg);
+	//后台落地线程
+	static void* FlushWorker(void* arg);
+	void FlushStart();
+	void FlushStop();
+	//需要时把节点的BLOCK链搬到更靠前的连续区段，返回搬移的value字节数
+	uint32_t CompactNode(struct mem_node* node);
+	//-----淘汰相关
+	void EvictInit();
+	//NODE节点的访问计数，按节点在映射中的位置索引，扩容后不变
+	inline uint8_t* NodeHot(struct mem_node* node);
+	//增加访问计数，到上限后不再写
+	inline void Touch(struct mem_node* node);
+	//Get命中时增加访问计数，未命中时计数
+	inline void EvictHit(struct mem_node* node);
+	inline void EvictMiss();
+	//淘汰节点并计数
+	void EvictNode(struct mem_node* node, uint64_t& counter);
+	//持有key所在的锁时对要淘汰的victim_key加锁：锁相同时不需要再加，共享模式下
+	//其他锁只尝试加锁，失败返回-1；lock为需要释放的锁
+	int  EvictLock(uint64_t victim_key, uint64_t key, pthread_mutex_t*& lock);
+	//CLOCK指针扫描NODE区域淘汰节点，直到有级别能容纳len，返回该级别；不淘汰key本身
+	//没有级别容纳得下len返回-1，扫过EVICT_SCAN_SIZE个节点仍不够返回-2
+	int  EvictBlocks(uint64_t key, uint32_t len);
+	//已存在的key：空闲BLOCK加上旧值所在级别的BLOCK链够用时，先回收旧链再分配，
+	//不够时返回-1
+	int  ReplaceChain(struct mem_node* node, const char* data, int len,
+			  time_t tval);
+	//-----过期清理相关
+	static void* SweepWorker(void* arg);
+	//节点已超时则删除，返回回收的BLOCK个数，没有删除时返回-1
+	int  SweepNode(struct mem_node* node, time_t now);
+	//-----快照相关
+	//把节点追加到快照缓冲区，空节点及快照开始时已超时的节点不写
+	void SnapshotNode(struct mem_node* node);
+	//快照进行中写操作修改节点之前调用，还没有扫描到的节点先保存旧值
+	void SnapshotCapture(struct mem_node* node);
+	//把缓冲区中的记录写入快照文件，累计到尾部的统计及crc32
+	int  SnapshotFlush(int fd, const char* buf, size_t len,
+			   struct snap_tail& tail);
+	//快照中的NODE节点时间换算为当前文件的单位
+	time_t SnapshotTime(time_t tval, uint32_t tval_ms);
+	//-----导入相关
+	static void* ImportWorker(void* arg);
+	//效验并写入一条快照记录，已超时的跳过，失败返回负数
+	int  ImportRecord(struct import_task* task, const char* p);
+	//并行导入空的MemHash：不查找已有的key，直接抢占空闲节点写入
+	//BLOCK不够返回-2，没有空闲节点返回-3
+	int  ImportNode(uint64_t key, const char* data, uint32_t len, time_t tval,
+			uint32_t crc32);
+
+	//lazy效验、后台整理或清理期间、并发模式下返回需要持有的锁，否则返回NULL
+	//共享模式下返回key所在的锁，key为0（遍历）时返回NULL
+	pthread_mutex_t* OpLock(uint64_t key);
+	//根据key获取该key的node节点指针，迁移期间先查旧区域
 	struct mem_node* GetNode(uint64_t key);
+	struct mem_node* GetNodeNew(uint64_t key);
+	struct mem_node* GetNodeOld(struct mem_node* old_node, uint64_t key);
+	//通过指纹数组查找，AVX2版本一次比较FP_BATCH阶的指纹
+	struct mem_node* GetNodeFp(uint64_t key);
+	struct mem_node* GetNodeFpAvx2(uint64_t key);
+	//key的指纹，不为0
+	static inline uint16_t Fingerprint(uint64_t key);
+	//按NODE节点当前的key更新指纹（在seq窗口内调用）
+	inline void SetFingerprint(struct mem_node* node);
+	//根据编号获取NODE节点指针，及其反向转换
+	//迁移期间max_node之后的编号为旧区域的节点
+	inline struct mem_node* NodeAt(uint32_t index);
+	inline uint32_t NodeIndex(struct mem_node* node);
+	//NODE节点的内联数据区
+	inline char* NodeInline(struct mem_node* node);
+	//把value写入NODE节点的内联数据区（在seq窗口内调用）
+	void SetInline(struct mem_node* node, const char* data, int len,
+		       uint32_t crc32);
+	//拷贝NODE节点的value，调用方保证缓冲区足够
+	void CopyValue(struct mem_node* node, char* data);
 	//根据pos获取BLOCK节点的指针
 	inline struct mem_block* GetBlock(int32_t pos);
+	//BLOCK偏移量与所有BLOCK中的编号互相转换
+	inline uint32_t BlockIndex(int32_t pos);
+	int32_t BlockPos(uint32_t index);
+	//BLOCK链所在级别的数据区大小，偏移量非法时返回0
+	inline uint32_t BlockDataSize(int32_t pos);
 	//根据SIZE获取要使用BLOCK的个数
-	inline uint32_t GetNodeBlockUsed(uint32_t size);
+	inline uint32_t GetNodeBlockUsed(uint32_t size, uint32_t data_size);
 	//根据SIZE获取要使用的BLOCK最后一个节点的偏移量
-	inline uint32_t GetLastBlockUsed(uint32_t size);
+	inline uint32_t GetLastBlockUsed(uint32_t size, uint32_t data_size);
 
 	//-----primes相关
 	//质数产生
@@ -153,23 +912,72 @@ private:
 	//判断是否是质数
 	int IsPrime(uint32_t value);
 
+	//key在第level阶的NODE节点编号
+	inline uint32_t LevelIndex(uint64_t key, uint32_t level);
+	//批量接口的预取：只读不加锁，with_value时继续预取value，write时按写预取
+	//node为各key在新区域找到的节点（没有找到为NULL），返回1时可以在layout_seq
+	//之后布局没有变化的前提下代替GetNode（找到的节点使用前确认key），返回0时
+	//只作为预取提示
+	int  MultiPrefetch(const uint64_t* keys, int num, int with_value, int write,
+			   struct mem_node** node, uint32_t& layout_seq);
+	inline void PrefetchRange(const char* p, uint32_t len, int write);
+	//对[p, p+len)所在的页发出MADV_WILLNEED
+	void WillNeed(const void* p, uint32_t len);
+
 	//-----MemHash数据结构
 	//质数数组
 	uint32_t bucket[MAX_BUCKET_SIZE];
+	//每阶的起始NODE编号及快速取模常数，BucketInit时计算
+	uint32_t bucket_base[MAX_BUCKET_SIZE];
+	__uint128_t bucket_m[MAX_BUCKET_SIZE];
 	//阶数
 	uint32_t bucket_time;
 	//每阶长度
 	uint32_t bucket_len;
 	//NODE节点的个数
 	uint32_t max_node;
-	//BLOCK节点的个数
+	//迁移期间的旧NODE区域，没有迁移时old_node_为NULL
+	struct mem_node* old_node_;
+	uint32_t old_max_node_;
+	uint32_t old_bucket_time_;
+	uint32_t old_bucket_len_;
+	uint32_t old_bucket_[MAX_BUCKET_SIZE];
+	uint32_t old_bucket_base_[MAX_BUCKET_SIZE];
+	__uint128_t old_bucket_m_[MAX_BUCKET_SIZE];
+	//新旧两个区域的节点总数
+	uint32_t node_total_;
+	//扩容切换布局时为奇数，无锁读没有找到key时据此判断是否需要重查
+	uint32_t layout_seq_;
+	//扩容的布局，预留的地址空间大小及扩容使用的文件fd
+	struct layout_info layout_info_;
+	size_t   reserve_size_;
+	int      grow_fd_;
+	//NODE节点的间隔及内联数据区长度
+	size_t   node_size;
+	uint32_t inline_size;
+	//key指纹数组，不使用时为NULL；区域大小含gather越界读取的补齐
+	uint16_t* fp_;
+	size_t   fp_zone_size;
+	//是否使用AVX2比较指纹
+	int      fp_avx2_;
+	//BLOCK节点的个数（所有级别之和）
 	uint32_t max_block;
+	//BLOCK分级
+	struct block_class classes_[MAX_BLOCK_CLASS];
+	uint32_t class_num_;
+	//BLOCK区域大小
+	size_t   block_zone_size;
 	//MemHash的大小
 	size_t   total_size;
+	//扩展头部占用大小（含对齐），旧格式文件为0
+	size_t   head_ext_size;
 	//MemHash在内存中的mmap指针
 	char  *mem_base;
 	//HEAD区域开始指针
 	struct mem_head* head_;
+	//扩展头部指针，旧格式文件指向legacy_ext_
+	struct mem_head_ext* head_ext_;
+	struct mem_head_ext  legacy_ext_;
 	//NODE区域开始指针
 	struct mem_node* node_;
 	//BLOCK区域开始指针
@@ -182,22 +990,162 @@ private:
 	int msync_flag;
 	//数据变更次数
 	int data_change;
+	//变更过的页的位图，按预留的地址空间分配，只访问到的部分占用内存
+	uint64_t* dirty_map_;
+	uint32_t  dirty_shift_;
+	int       dirty_all_;
+	//每次都落地的头部长度
+	size_t    dirty_head_len_;
 	//ForEachKey开始位置
 	uint32_t foreach_key_pos;
 	//超时机制（数据存在时间）
 	time_t data_store_time;
+	//NODE节点时间为毫秒；换算为NODE节点时间单位的超时
+	int    tval_ms_;
+	time_t expire_limit_;
+
+	//-----时钟相关
+	//NODE节点时间单位的当前时间
+	inline time_t NodeTime();
+	//数据超时，now为NodeTime；tval带TVAL_DEADLINE时按其中的超时时刻判断
+	inline int Expired(time_t tval, time_t now);
+	//SetWithTTL的超时时刻（带TVAL_DEADLINE）
+	time_t Deadline(uint64_t ttl_ms, time_t now);
+	void ClockInit();
+	void ClockStop();
+	static void* ClockWorker(void* arg);
+	//缓存的时间（毫秒）及后台更新线程
+	uint64_t  clock_ms_;
+	int       clock_started_;
+	int       clock_stop_;
+	pthread_t clock_tid_;
+	//TSC：校准时的TSC及时间（毫秒），每个TSC周期的毫秒数（64位小数的定点数）
+	uint64_t  tsc_base_;
+	uint64_t  tsc_base_ms_;
+	uint64_t  tsc_mult_;
+	//初始化可选项
+	struct mem_option option_;
+	//打开文件的统计
+	struct open_stat open_stat_;
+
+	//连续分配的空闲位图已建立
+	int       extent_active_;
+	//后台效验是否进行中
+	int       lazy_active_;
+	int       lazy_stop_;
+	int       lazy_started_;
+	pthread_t lazy_tid_;
+	//lazy效验期间所有操作与后台线程互斥，并发模式下为写锁
+	pthread_mutex_t op_lock_;
+	//已效验的NODE节点、效验通过的BLOCK节点位图
+	uint8_t*  node_verified_;
+	uint8_t*  block_marked_;
+	uint32_t  lazy_node_cursor_;
+	uint32_t  lazy_block_cursor_;
+	//第一阶段提前放入空闲队列的BLOCK位图及扫描位置
+	uint8_t*  block_freed_;
+	uint32_t  lazy_scan_cursor_[MAX_BLOCK_CLASS];
+	//各级空闲队列中的BLOCK个数
+	uint32_t  lazy_free_num_[MAX_BLOCK_CLASS];
+	uint64_t  lazy_begin_us_;
+
+	//BLOCK区整理：本轮的位置、本轮是否临时建立了空闲位图
+	uint32_t  compact_cursor_;
+	int       compact_own_map_;
+	//后台整理线程
+	int       compact_started_;
+	int       compact_stop_;
+	pthread_t compact_tid_;
+	uint32_t  compact_budget_us_;
+	uint32_t  compact_interval_ms_;
+	uint64_t  compact_passes_;
+	uint64_t  compact_chains_;
+	uint64_t  compact_bytes_;
+
+	//过期清理：本轮的位置、后台清理线程及统计
+	uint32_t  sweep_cursor_;
+	int       sweep_started_;
+	int       sweep_stop_;
+	pthread_t sweep_tid_;
+	uint32_t  sweep_budget_us_;
+	uint32_t  sweep_interval_ms_;
+	uint64_t  sweep_passes_;
+	uint64_t  sweep_nodes_;
+	uint64_t  sweep_blocks_;
+
+	//淘汰模式：访问计数数组（未开启时为NULL）、CLOCK指针及统计
+	uint8_t*  hot_;
+	uint32_t  evict_hand_;
+	uint64_t  evict_probe_;
+	uint64_t  evict_clock_;
+	uint64_t  evict_blocks_;
+	uint64_t  evict_hits_;
+	uint64_t  evict_misses_;
+
+	//快照：已处理的NODE节点位图（快照进行中不为NULL）、开始时的节点个数及时间
+	uint8_t*  snap_done_;
+	uint32_t  snap_total_;
+	time_t    snap_now_;
+	//待写入的记录缓冲区（持锁追加），缓冲区分配失败
+	char*     snap_buf_;
+	size_t    snap_len_;
+	size_t    snap_cap_;
+	int       snap_error_;
+	struct snapshot_stat snap_stat_;
+	//并行导入进行中：空闲队列加import_lock_，节点通过seq抢占
+	int       import_active_;
+	pthread_mutex_t import_lock_;
+
+	//GetView引用的BLOCK链，pin_lock_保护
+	struct view_pin* pins_;
+	uint32_t  pin_num_;
+	uint32_t  pin_cap_;
+	pthread_mutex_t pin_lock_;
+
+	//后台落地线程，flush_cond_唤醒落地线程，durable_cond_唤醒WaitDurable
+	int             flush_started_;
+	int             flush_stop_;
+	int             flush_request_;
+	pthread_t       flush_tid_;
+	pthread_mutex_t flush_lock_;
+	pthread_cond_t  flush_cond_;
+	pthread_cond_t  durable_cond_;
+	//完成的写操作个数、已落地的写操作个数、上次落地之后的写入量
+	uint64_t        write_gen_;
+	uint64_t        durable_gen_;
+	uint64_t        flush_dirty_;
+
+	//共享模式下持有文件锁的fd
+	int       lock_fd_;
+	//共享模式下打开时没有其他进程挂接
+	int       shared_first_;
 
 	//-----crc32相关
-	void Crc32CreateTable(uint32_t* table);
-	uint32_t Crc32GetSummedPloys(uint32_t top_byte);
+	//数据校验，算法由文件头记录的crc_type决定
 	uint32_t Crc32Compute(const char* data, int len);
 	uint32_t Crc32Append(uint32_t crc32, const char* data, int len);
-	uint32_t crc32_table[256];	
+	//头部校验，固定使用旧算法
+	uint32_t Crc32Head(const char* data, int len);
+	const struct crc32_engine* crc_engine_;
+	const struct crc32_engine* crc_head_engine_;
 
 	//-----log相关
+	//日志格式化后放入多生产者环形队列，由后台线程批量写入文件，请求线程不调用write
 	int  log_fd;
-	char log_buffer_[MAX_LOG_LEN]; 
-	void Log_(const char *fmt, ...);
+	struct log_slot* log_ring_;
+	uint64_t  log_head_;
+	uint64_t  log_tail_;
+	int       log_stop_;
+	pthread_t log_tid_;
+	uint64_t  log_written_;
+	uint64_t  log_dropped_;
+	uint64_t  log_suppressed_;
+	void LogStart();
+	void LogStop();
+	static void* LogWorker(void* arg);
+	//把队列中已完成的日志写入文件，返回条数
+	uint32_t LogDrain();
+	void Log_(int level, struct log_site* site, const char *fmt, ...);
 };
 
 }